@@ -0,0 +1,44 @@
+#pragma once
+#include <cstdint>
+#include <cstdlib>
+
+#ifdef ESP_PLATFORM
+#include <esp_system.h>
+#endif
+
+// Exponential retry delays with "equal jitter": each delay is half the current step plus a
+// random share of the other half. Devices that lost the same broker at the same moment
+// therefore spread their retries instead of reconnecting in step.
+class Backoff
+{
+public:
+    Backoff(uint32_t minMs, uint32_t maxMs) : minMs(minMs), maxMs(maxMs), stepMs(minMs) {}
+
+    // The delay before the next attempt; each call doubles the step, up to the maximum
+    uint32_t next()
+    {
+        uint32_t half = stepMs / 2;
+        uint32_t delay = half + (half > 0 ? random() % (stepMs - half + 1) : 0);
+        stepMs = (stepMs * 2 < maxMs) ? stepMs * 2 : maxMs;
+        return delay;
+    }
+
+    void reset() { stepMs = minMs; }
+
+    uint32_t currentStepMs() const { return stepMs; }
+
+private:
+    uint32_t minMs;
+    uint32_t maxMs;
+    uint32_t stepMs;
+
+    // The hardware RNG on the device, so the fleet does not share one rand() sequence
+    static uint32_t random()
+    {
+#ifdef ESP_PLATFORM
+        return esp_random();
+#else
+        return (uint32_t)rand();
+#endif
+    }
+};
@@ -0,0 +1,306 @@
+#pragma once
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+// Devices at the same location share one open-meteo fetch over MQTT. A retained lease
+// names the device that fetches until the lease expires; it publishes the parsed forecast
+// as a retained binary message and the others render from it. Nothing here depends on
+// Arduino, so the same code runs on Linux against a local Mosquitto.
+
+static const int ForecastDays = 7;
+static const int ForecastHours = 7;
+
+struct forecastDay_t
+{
+    uint16_t year;
+    uint8_t month;
+    uint8_t day;
+    float minimum; // °C
+    float maximum;
+    uint8_t code;  // WMO weather code
+};
+
+struct forecastHour_t
+{
+    uint8_t hour;
+    float temperature;
+    uint8_t precipitation; // Probability, percent
+    uint8_t code;
+    uint8_t isDay;
+};
+
+// Everything the screen shows, in metric units; conversion happens when rendering
+struct forecast_t
+{
+    uint32_t fetchedAt; // Unix time, zero if the clock was not set
+    float temperature;
+    float feelsLike;
+    uint8_t code;
+    uint8_t isDay;
+    forecastDay_t days[ForecastDays];
+    forecastHour_t hours[ForecastHours];
+};
+
+// Wire format, little-endian, temperatures in tenths of a degree:
+//   u8 version, u8 n, n bytes publisher id, u32 fetchedAt, i16 temperature, i16 feelsLike,
+//   u8 code, u8 isDay, u8 days, days x (u16 year, u8 month, u8 day, i16 min, i16 max,
+//   u8 code), u8 hours, hours x (u8 hour, i16 temperature, u8 precipitation, u8 code,
+//   u8 isDay)
+static const uint8_t ForecastWireVersion = 1;
+static const size_t ForecastPublisherMax = 32;
+static const size_t ForecastWireMax = 2 + ForecastPublisherMax + 4 + 6 + 1 + ForecastDays * 9 + 1 + ForecastHours * 6;
+
+class ForecastWriter
+{
+public:
+    ForecastWriter(uint8_t *out, size_t size) : out(out), size(size) {}
+
+    void u8(uint8_t value)
+    {
+        if (length < size)
+            out[length] = value;
+        length++;
+    }
+
+    void u16(uint16_t value)
+    {
+        u8(value & 0xff);
+        u8(value >> 8);
+    }
+
+    void u32(uint32_t value)
+    {
+        u16(value & 0xffff);
+        u16(value >> 16);
+    }
+
+    void tenths(float value)
+    {
+        long scaled = std::isnan(value) ? 0 : lroundf(value * 10);
+        u16((uint16_t)(int16_t)(scaled < -32767 ? -32767 : (scaled > 32767 ? 32767 : scaled)));
+    }
+
+    // Zero if it did not fit
+    size_t finish() const { return length <= size ? length : 0; }
+
+private:
+    uint8_t *out;
+    size_t size;
+    size_t length = 0;
+};
+
+class ForecastReader
+{
+public:
+    ForecastReader(const uint8_t *in, size_t length) : in(in), length(length) {}
+
+    uint8_t u8()
+    {
+        if (offset >= length)
+        {
+            failed = true;
+            return 0;
+        }
+        return in[offset++];
+    }
+
+    uint16_t u16()
+    {
+        uint16_t low = u8();
+        return low | (uint16_t)(u8() << 8);
+    }
+
+    uint32_t u32()
+    {
+        uint32_t low = u16();
+        return low | ((uint32_t)u16() << 16);
+    }
+
+    float tenths() { return (int16_t)u16() / 10.0f; }
+
+    bool ok() const { return !failed; }
+
+private:
+    const uint8_t *in;
+    size_t length;
+    size_t offset = 0;
+    bool failed = false;
+};
+
+// Returns the encoded length, or zero if out is too small
+inline size_t encodeForecast(const forecast_t &forecast, const char *publisher, uint8_t *out, size_t size)
+{
+    ForecastWriter writer(out, size);
+    size_t publisherLength = strlen(publisher);
+    if (publisherLength > ForecastPublisherMax)
+        publisherLength = ForecastPublisherMax;
+
+    writer.u8(ForecastWireVersion);
+    writer.u8((uint8_t)publisherLength);
+    for (size_t i = 0; i < publisherLength; i++)
+        writer.u8((uint8_t)publisher[i]);
+
+    writer.u32(forecast.fetchedAt);
+    writer.tenths(forecast.temperature);
+    writer.tenths(forecast.feelsLike);
+    writer.u8(forecast.code);
+    writer.u8(forecast.isDay);
+
+    writer.u8(ForecastDays);
+    for (const forecastDay_t &day : forecast.days)
+    {
+        writer.u16(day.year);
+        writer.u8(day.month);
+        writer.u8(day.day);
+        writer.tenths(day.minimum);
+        writer.tenths(day.maximum);
+        writer.u8(day.code);
+    }
+
+    writer.u8(ForecastHours);
+    for (const forecastHour_t &hour : forecast.hours)
+    {
+        writer.u8(hour.hour);
+        writer.tenths(hour.temperature);
+        writer.u8(hour.precipitation);
+        writer.u8(hour.code);
+        writer.u8(hour.isDay);
+    }
+
+    return writer.finish();
+}
+
+// Rejects other versions and anything truncated; publisher receives the NUL-terminated id
+inline bool decodeForecast(const uint8_t *in, size_t length, forecast_t &forecast, char *publisher,
+                           size_t publisherSize)
+{
+    ForecastReader reader(in, length);
+    if (reader.u8() != ForecastWireVersion)
+        return false;
+
+    size_t publisherLength = reader.u8();
+    for (size_t i = 0; i < publisherLength; i++)
+    {
+        char c = (char)reader.u8();
+        if (i + 1 < publisherSize)
+            publisher[i] = c;
+    }
+    if (publisherSize > 0)
+        publisher[publisherLength < publisherSize ? publisherLength : publisherSize - 1] = 0;
+
+    forecast.fetchedAt = reader.u32();
+    forecast.temperature = reader.tenths();
+    forecast.feelsLike = reader.tenths();
+    forecast.code = reader.u8();
+    forecast.isDay = reader.u8();
+
+    if (reader.u8() != ForecastDays)
+        return false;
+    for (forecastDay_t &day : forecast.days)
+    {
+        day.year = reader.u16();
+        day.month = reader.u8();
+        day.day = reader.u8();
+        day.minimum = reader.tenths();
+        day.maximum = reader.tenths();
+        day.code = reader.u8();
+    }
+
+    if (reader.u8() != ForecastHours)
+        return false;
+    for (forecastHour_t &hour : forecast.hours)
+    {
+        hour.hour = reader.u8();
+        hour.temperature = reader.tenths();
+        hour.precipitation = reader.u8();
+        hour.code = reader.u8();
+        hour.isDay = reader.u8();
+    }
+
+    return reader.ok();
+}
+
+// Tracks the lease for one location. The lease payload is "<holder> <expires unix time>",
+// readable with mosquitto_sub; an empty payload clears it. Claims race only when no valid
+// lease is known, and then the broker's order decides: the last claim delivered is the
+// retained one, and everyone adopts whatever arrives last.
+class ForecastLease
+{
+public:
+    static const size_t MaxHolderLength = ForecastPublisherMax;
+
+    ForecastLease(uint32_t durationSeconds) : durationSeconds(durationSeconds) {}
+
+    void setSelf(const char *id)
+    {
+        snprintf(self, sizeof(self), "%s", id);
+    }
+
+    void clear()
+    {
+        holderId[0] = 0;
+        expires = 0;
+    }
+
+    // Returns false for a payload that is neither empty nor a lease
+    bool observe(const char *payload, size_t length)
+    {
+        if (length == 0)
+        {
+            clear();
+            return true;
+        }
+
+        char text[MaxHolderLength + 16];
+        if (length >= sizeof(text))
+            return false;
+        memcpy(text, payload, length);
+        text[length] = 0;
+
+        char *space = strchr(text, ' ');
+        if (space == nullptr || space == text || (size_t)(space - text) > MaxHolderLength)
+            return false;
+
+        size_t holderLength = space - text;
+        *space = 0;
+        char *end;
+        unsigned long expiresAt = strtoul(space + 1, &end, 10);
+        if (end == space + 1 || *end != 0)
+            return false;
+
+        memcpy(holderId, text, holderLength + 1);
+        expires = (uint32_t)expiresAt;
+        return true;
+    }
+
+    bool valid(uint32_t now) const { return holderId[0] != 0 && (int32_t)(expires - now) > 0; }
+    bool held(uint32_t now) const { return valid(now) && strcmp(holderId, self) == 0; }
+
+    // This device fetches when it holds the lease or nobody validly does
+    bool shouldFetch(uint32_t now) const { return !valid(now) || held(now); }
+
+    // Formats a claim or renewal for this device and adopts it locally straight away;
+    // returns the payload length
+    size_t claim(uint32_t now, char *out, size_t size)
+    {
+        int length = snprintf(out, size, "%s %lu", self, (unsigned long)(now + durationSeconds));
+        if (length < 0 || (size_t)length >= size)
+            return 0;
+
+        observe(out, length);
+        return length;
+    }
+
+    const char *holder() const { return holderId; }
+    uint32_t expiresAt() const { return expires; }
+
+private:
+    uint32_t durationSeconds;
+    char self[MaxHolderLength + 1] = {0};
+    char holderId[MaxHolderLength + 1] = {0};
+    uint32_t expires = 0;
+};
@@ -0,0 +1,265 @@
+#pragma once
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstring>
+#include <type_traits>
+
+// Deferred-format log records: instead of formatting on the device, a call site ships
+// the ID of its format string and its raw arguments, and whoever reads the record
+// formats it. The ID is the FNV-1a hash of the format string, so the host can map it
+// back through a table generated from the sources at build time.
+
+constexpr uint32_t logFormatId(const char *format, uint32_t hash = 2166136261u)
+{
+    return *format == 0 ? hash : logFormatId(format + 1, (hash ^ (uint8_t)*format) * 16777619u);
+}
+
+// Argument tags. Each tag byte is followed by the value, little-endian; strings carry a
+// length byte and are truncated to LogBinaryStringMax.
+static const uint8_t LogArgInt32 = 'i';
+static const uint8_t LogArgUint32 = 'u';
+static const uint8_t LogArgInt64 = 'q';
+static const uint8_t LogArgUint64 = 'Q';
+static const uint8_t LogArgFloat = 'f';
+static const uint8_t LogArgString = 's';
+
+static const size_t LogBinaryStringMax = 48;
+
+class LogArgWriter
+{
+public:
+    LogArgWriter(uint8_t *buffer, size_t capacity) : buffer(buffer), capacity(capacity) {}
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value>::type add(T value)
+    {
+        if (sizeof(T) <= 4)
+        {
+            if (std::is_signed<T>::value)
+                put(LogArgInt32, (int32_t)value);
+            else
+                put(LogArgUint32, (uint32_t)value);
+        }
+        else
+        {
+            if (std::is_signed<T>::value)
+                put(LogArgInt64, (int64_t)value);
+            else
+                put(LogArgUint64, (uint64_t)value);
+        }
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_enum<T>::value>::type add(T value)
+    {
+        put(LogArgInt32, (int32_t)value);
+    }
+
+    void add(double value)
+    {
+        put(LogArgFloat, (float)value);
+    }
+
+    void add(const char *value)
+    {
+        if (value == nullptr)
+            value = "(null)";
+
+        size_t length = strnlen(value, LogBinaryStringMax);
+        if (this->length + 2 + length > capacity)
+        {
+            overflowed = true;
+            return;
+        }
+
+        buffer[this->length++] = LogArgString;
+        buffer[this->length++] = (uint8_t)length;
+        memcpy(buffer + this->length, value, length);
+        this->length += length;
+    }
+
+    size_t size() const { return length; }
+    bool overflow() const { return overflowed; }
+
+private:
+    template <typename T>
+    void put(uint8_t tag, T value)
+    {
+        if (length + 1 + sizeof(T) > capacity)
+        {
+            overflowed = true;
+            return;
+        }
+
+        buffer[length++] = tag;
+        memcpy(buffer + length, &value, sizeof(T));
+        length += sizeof(T);
+    }
+
+    uint8_t *buffer;
+    size_t capacity;
+    size_t length = 0;
+    bool overflowed = false;
+};
+
+inline void encodeLogArgs(LogArgWriter &)
+{
+}
+
+template <typename T, typename... Rest>
+void encodeLogArgs(LogArgWriter &writer, T first, Rest... rest)
+{
+    writer.add(first);
+    encodeLogArgs(writer, rest...);
+}
+
+// Formats a record the way ArduinoLog would have, for the on-device Serial output.
+// Returns the length written to out, which is always NUL-terminated.
+inline size_t formatLogRecord(const char *format, const uint8_t *args, size_t argsLength, char *out, size_t outSize)
+{
+    size_t used = 0;
+    size_t position = 0;
+
+    auto append = [&](const char *text, size_t length)
+    {
+        if (used + length >= outSize)
+            length = outSize - used - 1;
+        memcpy(out + used, text, length);
+        used += length;
+    };
+
+    for (const char *p = format; *p != 0 && used + 1 < outSize; p++)
+    {
+        if (*p != '%' || p[1] == 0)
+        {
+            append(p, 1);
+            continue;
+        }
+
+        char specifier = *++p;
+        if (specifier == '%')
+        {
+            append(p, 1);
+            continue;
+        }
+
+        if (position >= argsLength)
+        {
+            append("?", 1);
+            continue;
+        }
+
+        uint8_t tag = args[position++];
+        int64_t integer = 0;
+        float real = 0;
+        const char *text = "";
+        size_t textLength = 0;
+
+        switch (tag)
+        {
+        case LogArgInt32:
+        {
+            int32_t value;
+            memcpy(&value, args + position, sizeof(value));
+            position += sizeof(value);
+            integer = value;
+            real = (float)value;
+            break;
+        }
+        case LogArgUint32:
+        {
+            uint32_t value;
+            memcpy(&value, args + position, sizeof(value));
+            position += sizeof(value);
+            integer = value;
+            real = (float)value;
+            break;
+        }
+        case LogArgInt64:
+        case LogArgUint64:
+            memcpy(&integer, args + position, sizeof(integer));
+            position += sizeof(integer);
+            real = (float)integer;
+            break;
+        case LogArgFloat:
+            memcpy(&real, args + position, sizeof(real));
+            position += sizeof(real);
+            integer = (int64_t)real;
+            break;
+        case LogArgString:
+            textLength = args[position++];
+            if (position + textLength > argsLength)
+                textLength = argsLength - position;
+            text = (const char *)args + position;
+            position += textLength;
+            break;
+        default:
+            // Unknown tag: the rest of the arguments cannot be located
+            position = argsLength;
+            break;
+        }
+
+        char number[72];
+        int length = 0;
+        switch (specifier)
+        {
+        case 's':
+        case 'S':
+            append(text, textLength);
+            break;
+        case 'c':
+            number[0] = (char)integer;
+            append(number, 1);
+            break;
+        case 'd':
+        case 'i':
+        case 'l':
+        case 'u':
+            length = snprintf(number, sizeof(number), "%lld", (long long)integer);
+            break;
+        case 'x':
+            length = snprintf(number, sizeof(number), "%llx", (unsigned long long)integer);
+            break;
+        case 'X':
+            length = snprintf(number, sizeof(number), "0x%llX", (unsigned long long)integer);
+            break;
+        case 'b':
+        case 'B':
+        {
+            char bits[65];
+            int count = 0;
+            uint64_t value = (uint64_t)integer;
+            do
+            {
+                bits[count++] = (value & 1) ? '1' : '0';
+                value >>= 1;
+            } while (value != 0 && count < 64);
+            if (specifier == 'B')
+                append("0b", 2);
+            while (count > 0)
+                number[length++] = bits[--count];
+            break;
+        }
+        case 't':
+            append(integer ? "T" : "F", 1);
+            break;
+        case 'T':
+            append(integer ? "true" : "false", integer ? 4 : 5);
+            break;
+        case 'D':
+        case 'F':
+            length = snprintf(number, sizeof(number), "%.2f", real);
+            break;
+        default:
+            append(p - 1, 2);
+            break;
+        }
+
+        if (length > 0)
+            append(number, (size_t)length < sizeof(number) ? length : sizeof(number) - 1);
+    }
+
+    out[used] = 0;
+    return used;
+}
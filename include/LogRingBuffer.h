@@ -0,0 +1,149 @@
+#pragma once
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+// Byte-oriented ring of length-prefixed records. Any number of producers reserve space
+// with a compare-and-swap and write their record in place; a single consumer reads
+// committed records in place and releases them. Records never wrap: when one would
+// cross the end of the storage a padding record fills the remainder first.
+//
+// Every byte of free space is kept zeroed (the consumer clears records as it releases
+// them), so a header word of zero always means "reserved but not yet committed".
+class LogRingBuffer
+{
+public:
+    // capacity must be a power of two and storage must be 4-byte aligned
+    LogRingBuffer(uint8_t *storage, uint32_t capacity)
+        : storage(storage), capacity(capacity), mask(capacity - 1)
+    {
+        memset(storage, 0, capacity);
+    }
+
+    // Largest payload a single record can carry
+    uint32_t maxRecordLength() const
+    {
+        return capacity / 4 - HeaderSize;
+    }
+
+    // Returns space for a payload of the given length, or nullptr if the ring is full.
+    // The caller fills it and passes it to commit() with the same length. An uncontended
+    // reservation is a single compare-and-swap.
+    uint8_t *reserve(uint32_t length)
+    {
+        if (length == 0 || length > maxRecordLength())
+        {
+            dropped.fetch_add(1, std::memory_order_relaxed);
+            return nullptr;
+        }
+
+        uint32_t recordSize = HeaderSize + align(length);
+        uint32_t start = head.load(std::memory_order_relaxed);
+        uint32_t position, padding, total;
+
+        do
+        {
+            position = start & mask;
+            uint32_t contiguous = capacity - position;
+            padding = (recordSize > contiguous) ? contiguous : 0;
+            total = padding + recordSize;
+
+            if (start + total - tail.load(std::memory_order_acquire) > capacity)
+            {
+                dropped.fetch_add(1, std::memory_order_relaxed);
+                return nullptr;
+            }
+        } while (!head.compare_exchange_weak(start, start + total, std::memory_order_acq_rel, std::memory_order_relaxed));
+
+        updateHighWater(start + total - tail.load(std::memory_order_relaxed));
+
+        if (padding > 0)
+        {
+            headerAt(position)->store(padding | CommittedFlag | PaddingFlag, std::memory_order_release);
+            position = 0;
+        }
+
+        return storage + position + HeaderSize;
+    }
+
+    void commit(uint8_t *payload, uint32_t length)
+    {
+        headerAt((payload - storage) - HeaderSize)->store(length | CommittedFlag, std::memory_order_release);
+    }
+
+    // Next committed record, or nullptr if the oldest reservation is not committed yet
+    const uint8_t *peek(uint32_t &length)
+    {
+        while (true)
+        {
+            uint32_t start = tail.load(std::memory_order_relaxed);
+            if (start == head.load(std::memory_order_acquire))
+                return nullptr;
+
+            uint32_t position = start & mask;
+            uint32_t header = headerAt(position)->load(std::memory_order_acquire);
+            if ((header & CommittedFlag) == 0)
+                return nullptr;
+
+            if (header & PaddingFlag)
+            {
+                releaseBytes(position, header & LengthMask);
+                continue;
+            }
+
+            length = header & LengthMask;
+            return storage + position + HeaderSize;
+        }
+    }
+
+    void release()
+    {
+        uint32_t position = tail.load(std::memory_order_relaxed) & mask;
+        uint32_t header = headerAt(position)->load(std::memory_order_relaxed);
+        releaseBytes(position, HeaderSize + align(header & LengthMask));
+    }
+
+    uint32_t droppedRecords() const { return dropped.load(std::memory_order_relaxed); }
+    uint32_t highWaterBytes() const { return highWater.load(std::memory_order_relaxed); }
+    uint32_t usedBytes() const { return head.load(std::memory_order_relaxed) - tail.load(std::memory_order_relaxed); }
+    uint32_t capacityBytes() const { return capacity; }
+
+private:
+    static const uint32_t HeaderSize = 4;
+    static const uint32_t CommittedFlag = 0x80000000;
+    static const uint32_t PaddingFlag = 0x40000000;
+    static const uint32_t LengthMask = 0x00ffffff;
+
+    static uint32_t align(uint32_t length)
+    {
+        return (length + 3) & ~3u;
+    }
+
+    std::atomic<uint32_t> *headerAt(uint32_t position)
+    {
+        return reinterpret_cast<std::atomic<uint32_t> *>(storage + position);
+    }
+
+    void releaseBytes(uint32_t position, uint32_t size)
+    {
+        memset(storage + position, 0, size);
+        tail.fetch_add(size, std::memory_order_release);
+    }
+
+    void updateHighWater(uint32_t used)
+    {
+        uint32_t previous = highWater.load(std::memory_order_relaxed);
+        while (used > previous && !highWater.compare_exchange_weak(previous, used, std::memory_order_relaxed))
+        {
+        }
+    }
+
+    uint8_t *storage;
+    const uint32_t capacity;
+    const uint32_t mask;
+    std::atomic<uint32_t> head{0};
+    std::atomic<uint32_t> tail{0};
+    std::atomic<uint32_t> dropped{0};
+    std::atomic<uint32_t> highWater{0};
+};
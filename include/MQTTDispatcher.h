@@ -1,71 +1,129 @@
 #pragma once
-#include <unordered_map>
+#include <string>
+#include <string_view>
 #include <vector>
 #include <functional>
-#include <sstream>
 
-using Handler = std::function<void(const std::string&, const std::string&)>;
+// Handlers get views into the client's buffer; copy anything that must outlive the call
+using Handler = std::function<void(std::string_view topic, const uint8_t* payload, size_t length)>;
 
+// Routes topics to handlers through a trie of topic levels, with MQTT's "+" (one level)
+// and "#" (the rest, including none) wildcards. Registering allocates; dispatch does not.
 class MQTTDispatcher
 {
 public:
-	void registerHandler(const std::string& topicPattern, const Handler handler)
+	MQTTDispatcher()
 	{
-		handlers.push_back({split(topicPattern), handler});
+		nodes.emplace_back();
 	}
 
-	void dispatch(const std::string& topic, const std::string& payload) const
+	void registerHandler(std::string_view topicPattern, Handler handler)
 	{
-		auto topicLevels = split(topic);
-
-		for (const auto& [patternLevels, handler] : handlers)
+		int node = Root;
+		size_t start = 0;
+		while (true)
 		{
-			if (match(patternLevels, topicLevels))
+			size_t end = topicPattern.find('/', start);
+			node = child(node, topicPattern.substr(start, end == std::string_view::npos ? end : end - start));
+			if (end == std::string_view::npos)
 			{
-				handler(topic, payload);
+				break;
 			}
+			start = end + 1;
 		}
+
+		handlers.push_back(std::move(handler));
+		nodes[node].handlers.push_back((int)handlers.size() - 1);
+	}
+
+	// Calls every handler whose pattern matches; returns how many did
+	int dispatch(std::string_view topic, const uint8_t* payload, size_t length) const
+	{
+		// Wildcards at the first level do not match topics such as "$SYS/..."
+		bool system = !topic.empty() && topic[0] == '$';
+		return match(Root, 0, system, topic, payload, length);
 	}
 
 private:
-	std::vector<std::pair<std::vector<std::string>, Handler>> handlers;
+	static const int Root = 0;
+
+	struct Node
+	{
+		std::string level;
+		std::vector<int> children;
+		std::vector<int> handlers;
+	};
 
-	static std::vector<std::string> split(const std::string& topic)
+	std::vector<Node> nodes;
+	std::vector<Handler> handlers;
+
+	int child(int parent, std::string_view level)
 	{
-		std::vector<std::string> result;
-		std::stringstream ss(topic);
-		std::string item;
-		while (std::getline(ss, item, '/'))
+		for (int index : nodes[parent].children)
 		{
-			result.push_back(item);
+			if (nodes[index].level == level)
+			{
+				return index;
+			}
 		}
-		return result;
+
+		nodes.push_back({std::string(level), {}, {}});
+		int index = (int)nodes.size() - 1;
+		nodes[parent].children.push_back(index);
+		return index;
 	}
 
-	static bool match(const std::vector<std::string>& pattern, const std::vector<std::string>& topic)
+	int fire(int node, std::string_view topic, const uint8_t* payload, size_t length) const
 	{
-		size_t i = 0;
-		for (; i < pattern.size(); ++i)
+		for (int index : nodes[node].handlers)
 		{
-			if (i >= topic.size())
-			{
-				return pattern[i] == "#";
-			}
+			handlers[index](topic, payload, length);
+		}
+		return (int)nodes[node].handlers.size();
+	}
+
+	// Matches the levels of topic from start on against the children of node
+	int match(int node, size_t start, bool system, std::string_view topic, const uint8_t* payload, size_t length) const
+	{
+		size_t end = topic.find('/', start);
+		std::string_view level = topic.substr(start, end == std::string_view::npos ? end : end - start);
 
-			if (pattern[i] == "#")
+		int matched = 0;
+		for (int index : nodes[node].children)
+		{
+			const std::string& pattern = nodes[index].level;
+			if (pattern == "#")
 			{
-				return true;
+				if (!system)
+				{
+					matched += fire(index, topic, payload, length);
+				}
+				continue;
 			}
-			if (pattern[i] == "+")
+
+			if (pattern == "+" ? system : pattern != level)
 			{
 				continue;
 			}
-			if (pattern[i] != topic[i])
+
+			matched += (end == std::string_view::npos)
+						   ? fire(index, topic, payload, length) + finalHash(index, topic, payload, length)
+						   : match(index, end + 1, false, topic, payload, length);
+		}
+
+		return matched;
+	}
+
+	// "a/#" also matches "a" itself
+	int finalHash(int node, std::string_view topic, const uint8_t* payload, size_t length) const
+	{
+		for (int index : nodes[node].children)
+		{
+			if (nodes[index].level == "#")
 			{
-				return false;
+				return fire(index, topic, payload, length);
 			}
 		}
-
-		return i == topic.size();
+		return 0;
 	}
 };
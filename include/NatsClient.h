@@ -0,0 +1,708 @@
+#pragma once
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fcntl.h>
+#include <netdb.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/select.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include "Backoff.h"
+
+#ifndef MSG_NOSIGNAL
+#define MSG_NOSIGNAL 0
+#endif
+
+// Minimal NATS core client for the text protocol (CONNECT, PUB, SUB, UNSUB, PING, PONG
+// and MSG) on plain BSD sockets, so the same code runs on lwIP and on Linux against a
+// local nats-server. The socket is non-blocking: loop() advances a connection attempt,
+// reads whatever has arrived and answers pings, and publish() only appends to the write
+// buffer, so a burst of messages leaves in one send on the next flush(). Only the host
+// name lookup at the start of an attempt can block, and its result is cached.
+//
+// Not thread-safe; callers serialise access. Time comes from the caller in milliseconds.
+class NatsClient
+{
+public:
+    enum State
+    {
+        Idle,        // Not asked to connect
+        Waiting,     // Backing off before the next attempt
+        Connecting,  // TCP connect in progress
+        Handshaking, // Waiting for INFO, then for the PONG that answers CONNECT
+        Connected
+    };
+
+    typedef void (*MessageHandler)(const char *subject, const char *replyTo, const uint8_t *payload, size_t length,
+                                   void *context);
+
+    static const int MaxSubscriptions = 8;
+    static const size_t MaxSubjectLength = 64;
+
+    static const uint32_t ConnectTimeoutMs = 5000;
+    static const uint32_t PingIntervalMs = 20000;
+    static const int MaxPingsOut = 2;
+    static const uint32_t MinBackoffMs = 500;
+    static const uint32_t MaxBackoffMs = 30000;
+
+    // Messages larger than the read buffer are skipped; publishes larger than the write
+    // buffer are refused
+    NatsClient(size_t writeCapacity = 4096, size_t readCapacity = 2048)
+        : writeBuffer((uint8_t *)malloc(writeCapacity)), writeCapacity(writeBuffer ? writeCapacity : 0),
+          readBuffer((uint8_t *)malloc(readCapacity)), readCapacity(readBuffer ? readCapacity : 0)
+    {
+    }
+
+    ~NatsClient()
+    {
+        closeSocket();
+        free(writeBuffer);
+        free(readBuffer);
+    }
+
+    NatsClient(const NatsClient &) = delete;
+    NatsClient &operator=(const NatsClient &) = delete;
+
+    // Changing the server or credentials drops a live connection; it is re-established
+    // with the new settings
+    void setServer(const char *host, uint16_t port)
+    {
+        if (strcmp(host, this->host) == 0 && port == this->port)
+            return;
+
+        snprintf(this->host, sizeof(this->host), "%s", host);
+        this->port = port;
+        haveAddress = false;
+        restart();
+    }
+
+    void setCredentials(const char *user, const char *password, const char *name)
+    {
+        if (strcmp(user, this->user) == 0 && strcmp(password, this->password) == 0 && strcmp(name, this->name) == 0)
+            return;
+
+        snprintf(this->user, sizeof(this->user), "%s", user);
+        snprintf(this->password, sizeof(this->password), "%s", password);
+        snprintf(this->name, sizeof(this->name), "%s", name);
+        restart();
+    }
+
+    void setMessageHandler(MessageHandler handler, void *context)
+    {
+        this->handler = handler;
+        this->handlerContext = context;
+    }
+
+    // Starts connecting on the next loop(); the client then reconnects by itself, with
+    // jittered exponential backoff, until disconnect()
+    void connect()
+    {
+        if (state != Idle)
+            return;
+
+        backoff.reset();
+        nextAttemptMs = nowMs;
+        state = Waiting;
+    }
+
+    // Drops the connection or the wait before the next attempt and starts over straight
+    // away; for when the network comes back and the old socket cannot be trusted
+    void restart()
+    {
+        if (state == Idle)
+            return;
+
+        closeSocket();
+        backoff.reset();
+        nextAttemptMs = nowMs;
+        state = Waiting;
+    }
+
+    void disconnect()
+    {
+        closeSocket();
+        state = Idle;
+    }
+
+    void loop(uint32_t now)
+    {
+        nowMs = now;
+
+        switch (state)
+        {
+        case Idle:
+            return;
+        case Waiting:
+            if ((int32_t)(nowMs - nextAttemptMs) >= 0)
+                startConnect();
+            return;
+        case Connecting:
+            checkConnect();
+            return;
+        case Handshaking:
+        case Connected:
+            break;
+        }
+
+        if (!readAvailable())
+            return;
+
+        if (state == Handshaking && nowMs - stateSinceMs > ConnectTimeoutMs)
+        {
+            fail("handshake timed out");
+            return;
+        }
+
+        if (state == Connected && nowMs - lastPingMs >= PingIntervalMs)
+        {
+            if (pingsOut >= MaxPingsOut)
+            {
+                fail("stale connection");
+                return;
+            }
+
+            appendControl("PING\r\n");
+            pingsOut++;
+            lastPingMs = nowMs;
+        }
+
+        flush();
+    }
+
+    // Queues a message; it goes out on the next flush() or loop(). False when not
+    // connected or the write buffer cannot take it even after a flush.
+    bool publish(const char *subject, const uint8_t *payload, size_t length, const char *replyTo = nullptr)
+    {
+        if (state != Connected)
+            return false;
+
+        char header[2 * MaxSubjectLength + 32];
+        int headerLength = (replyTo != nullptr)
+                               ? snprintf(header, sizeof(header), "PUB %s %s %lu\r\n", subject, replyTo, (unsigned long)length)
+                               : snprintf(header, sizeof(header), "PUB %s %lu\r\n", subject, (unsigned long)length);
+        if (headerLength <= 0 || (size_t)headerLength >= sizeof(header) || length > maxPayload)
+            return false;
+
+        if (!reserveWrite(headerLength + length + 2))
+        {
+            refusedMessages++;
+            return false;
+        }
+
+        append((const uint8_t *)header, headerLength);
+        append(payload, length);
+        append((const uint8_t *)"\r\n", 2);
+        publishedMessages++;
+        return true;
+    }
+
+    // Returns the subscription ID, or -1. Subscriptions are renewed after a reconnect.
+    int subscribe(const char *subject, const char *queue = nullptr)
+    {
+        for (subscription_t &subscription : subscriptions)
+        {
+            if (subscription.sid != 0)
+                continue;
+
+            if (strlen(subject) >= sizeof(subscription.subject) ||
+                (queue != nullptr && strlen(queue) >= sizeof(subscription.queue)))
+                return -1;
+
+            subscription.sid = nextSid++;
+            snprintf(subscription.subject, sizeof(subscription.subject), "%s", subject);
+            snprintf(subscription.queue, sizeof(subscription.queue), "%s", queue != nullptr ? queue : "");
+            if (state == Connected || (state == Handshaking && infoReceived))
+                sendSubscription(subscription);
+            return subscription.sid;
+        }
+
+        return -1;
+    }
+
+    bool unsubscribe(int sid)
+    {
+        for (subscription_t &subscription : subscriptions)
+        {
+            if (sid <= 0 || subscription.sid != sid)
+                continue;
+
+            subscription.sid = 0;
+            if (state == Connected)
+            {
+                char line[32];
+                int length = snprintf(line, sizeof(line), "UNSUB %d\r\n", sid);
+                appendControl(line, length);
+            }
+            return true;
+        }
+
+        return false;
+    }
+
+    // Hands as much of the write buffer to the socket as it takes without waiting
+    bool flush()
+    {
+        if (fd < 0 || (state != Handshaking && state != Connected))
+            return false;
+
+        size_t sent = 0;
+        while (sent < writeLength)
+        {
+            ssize_t written = send(fd, writeBuffer + sent, writeLength - sent, MSG_DONTWAIT | MSG_NOSIGNAL);
+            if (written > 0)
+            {
+                sent += written;
+                bytesSent += written;
+                continue;
+            }
+
+            if (written < 0 && errno == EINTR)
+                continue;
+
+            if (written < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                break;
+
+            fail("write failed");
+            return false;
+        }
+
+        if (sent > 0)
+        {
+            memmove(writeBuffer, writeBuffer + sent, writeLength - sent);
+            writeLength -= sent;
+        }
+        return true;
+    }
+
+    State getState() const { return state; }
+    bool connected() const { return state == Connected; }
+    bool active() const { return state != Idle; }
+    size_t pendingBytes() const { return writeLength; }
+    const char *lastError() const { return error; }
+
+    uint32_t connects() const { return connectCount; }
+    uint32_t published() const { return publishedMessages; }
+    uint32_t refused() const { return refusedMessages; }
+    uint32_t received() const { return receivedMessages; }
+    uint32_t skipped() const { return skippedMessages; }
+    uint64_t sentBytes() const { return bytesSent; }
+
+private:
+    struct subscription_t
+    {
+        int sid;
+        char subject[MaxSubjectLength];
+        char queue[32];
+    };
+
+    void closeSocket()
+    {
+        if (fd >= 0)
+        {
+            close(fd);
+            fd = -1;
+        }
+        writeLength = 0;
+        readLength = 0;
+        skipRemaining = 0;
+    }
+
+    void fail(const char *reason)
+    {
+        if (reason != error)
+            snprintf(error, sizeof(error), "%s", reason);
+        closeSocket();
+        state = Waiting;
+        nextAttemptMs = nowMs + backoff.next();
+    }
+
+    bool resolve()
+    {
+        addrinfo hints = {};
+        hints.ai_family = AF_INET;
+        hints.ai_socktype = SOCK_STREAM;
+
+        addrinfo *result = nullptr;
+        if (getaddrinfo(host, nullptr, &hints, &result) != 0 || result == nullptr)
+            return false;
+
+        memcpy(&address, result->ai_addr, sizeof(address));
+        address.sin_port = htons(port);
+        freeaddrinfo(result);
+        haveAddress = true;
+        return true;
+    }
+
+    void startConnect()
+    {
+        if (host[0] == 0 || (!haveAddress && !resolve()))
+        {
+            fail("cannot resolve server");
+            return;
+        }
+
+        fd = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+        if (fd < 0)
+        {
+            fail("no socket");
+            return;
+        }
+
+        fcntl(fd, F_SETFL, fcntl(fd, F_GETFL, 0) | O_NONBLOCK);
+        int noDelay = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+
+        stateSinceMs = nowMs;
+        if (::connect(fd, (const sockaddr *)&address, sizeof(address)) == 0)
+        {
+            beginHandshake();
+        }
+        else if (errno == EINPROGRESS)
+        {
+            state = Connecting;
+        }
+        else
+        {
+            // The address may have moved; look it up again next time
+            haveAddress = false;
+            fail("connect failed");
+        }
+    }
+
+    void checkConnect()
+    {
+        fd_set writable;
+        FD_ZERO(&writable);
+        FD_SET(fd, &writable);
+        timeval noWait = {0, 0};
+
+        int ready = select(fd + 1, nullptr, &writable, nullptr, &noWait);
+        if (ready > 0)
+        {
+            int socketError = 0;
+            socklen_t length = sizeof(socketError);
+            getsockopt(fd, SOL_SOCKET, SO_ERROR, &socketError, &length);
+            if (socketError == 0)
+            {
+                beginHandshake();
+                return;
+            }
+
+            haveAddress = false;
+            fail("connect refused");
+        }
+        else if (ready < 0 || nowMs - stateSinceMs > ConnectTimeoutMs)
+        {
+            haveAddress = false;
+            fail("connect timed out");
+        }
+    }
+
+    void beginHandshake()
+    {
+        state = Handshaking;
+        stateSinceMs = nowMs;
+        infoReceived = false;
+    }
+
+    // The server opens with INFO; answer with CONNECT, the subscriptions and a PING whose
+    // PONG confirms all of them
+    void sendConnect()
+    {
+        char line[512];
+        int length = snprintf(line, sizeof(line),
+                              "CONNECT {\"verbose\":false,\"pedantic\":false,\"lang\":\"c\",\"version\":\"1.0\",\"protocol\":1,\"name\":");
+        length += quote(line + length, sizeof(line) - length, name);
+        if (user[0] != 0)
+        {
+            length += snprintf(line + length, sizeof(line) - length, ",\"user\":");
+            length += quote(line + length, sizeof(line) - length, user);
+            length += snprintf(line + length, sizeof(line) - length, ",\"pass\":");
+            length += quote(line + length, sizeof(line) - length, password);
+        }
+        length += snprintf(line + length, sizeof(line) - length, "}\r\n");
+        appendControl(line, length);
+
+        for (subscription_t &subscription : subscriptions)
+        {
+            if (subscription.sid != 0)
+                sendSubscription(subscription);
+        }
+
+        appendControl("PING\r\n");
+    }
+
+    // Writes a JSON string; returns its length, stopping short of the end of out
+    static int quote(char *out, size_t size, const char *text)
+    {
+        size_t length = 0;
+        if (size < 3)
+            return 0;
+
+        out[length++] = '"';
+        for (const char *p = text; *p != 0 && length + 3 < size; p++)
+        {
+            if (*p == '"' || *p == '\\')
+                out[length++] = '\\';
+            out[length++] = *p;
+        }
+        out[length++] = '"';
+        out[length] = 0;
+        return length;
+    }
+
+    void sendSubscription(const subscription_t &subscription)
+    {
+        char line[MaxSubjectLength + 64];
+        int length = subscription.queue[0] != 0
+                         ? snprintf(line, sizeof(line), "SUB %s %s %d\r\n", subscription.subject, subscription.queue, subscription.sid)
+                         : snprintf(line, sizeof(line), "SUB %s %d\r\n", subscription.subject, subscription.sid);
+        appendControl(line, length);
+    }
+
+    bool reserveWrite(size_t length)
+    {
+        if (writeCapacity - writeLength >= length)
+            return true;
+
+        flush();
+        return writeCapacity - writeLength >= length;
+    }
+
+    void append(const uint8_t *data, size_t length)
+    {
+        memcpy(writeBuffer + writeLength, data, length);
+        writeLength += length;
+    }
+
+    void appendControl(const char *line, int length = -1)
+    {
+        if (length < 0)
+            length = strlen(line);
+
+        if (reserveWrite(length))
+            append((const uint8_t *)line, length);
+    }
+
+    // Reads and handles everything the socket has; false if the connection was lost
+    bool readAvailable()
+    {
+        // Bounded so a flood of messages cannot hold the caller forever
+        for (int reads = 0; reads < 8; reads++)
+        {
+            if (readLength == readCapacity)
+            {
+                fail("protocol line too long");
+                return false;
+            }
+
+            ssize_t received = recv(fd, readBuffer + readLength, readCapacity - readLength, MSG_DONTWAIT);
+            if (received > 0)
+            {
+                readLength += received;
+                if (!process())
+                    return false;
+                continue;
+            }
+
+            if (received < 0 && errno == EINTR)
+                continue;
+
+            if (received < 0 && (errno == EAGAIN || errno == EWOULDBLOCK))
+                return true;
+
+            fail(received == 0 ? "connection closed" : "read failed");
+            return false;
+        }
+
+        return true;
+    }
+
+    static char *findLineEnd(char *text, size_t length)
+    {
+        for (size_t i = 0; i + 1 < length; i++)
+        {
+            if (text[i] == '\r' && text[i + 1] == '\n')
+                return text + i;
+        }
+        return nullptr;
+    }
+
+    // Handles every complete operation in the read buffer and keeps the remainder
+    bool process()
+    {
+        size_t position = 0;
+        while (position < readLength)
+        {
+            // Answering can fail a write and drop the connection under us
+            if (fd < 0)
+                return false;
+
+            if (skipRemaining > 0)
+            {
+                size_t skip = (skipRemaining < readLength - position) ? skipRemaining : readLength - position;
+                position += skip;
+                skipRemaining -= skip;
+                continue;
+            }
+
+            char *line = (char *)readBuffer + position;
+            char *end = findLineEnd(line, readLength - position);
+            if (end == nullptr)
+                break;
+
+            size_t consumed = end - line + 2;
+            *end = 0;
+
+            if (strncmp(line, "MSG ", 4) == 0)
+            {
+                size_t total;
+                if (!handleMessage(line, readLength - position, consumed, total))
+                {
+                    *end = '\r';
+                    break;
+                }
+                position += total;
+                continue;
+            }
+
+            if (strcmp(line, "PING") == 0)
+            {
+                appendControl("PONG\r\n");
+            }
+            else if (strcmp(line, "PONG") == 0)
+            {
+                pingsOut = 0;
+                if (state == Handshaking && infoReceived)
+                {
+                    state = Connected;
+                    connectCount++;
+                    backoff.reset();
+                    lastPingMs = nowMs;
+                    error[0] = 0;
+                }
+            }
+            else if (strncmp(line, "INFO ", 5) == 0)
+            {
+                const char *field = strstr(line, "\"max_payload\":");
+                if (field != nullptr)
+                    maxPayload = strtoul(field + 14, nullptr, 10);
+
+                if (state == Handshaking && !infoReceived)
+                {
+                    infoReceived = true;
+                    sendConnect();
+                }
+            }
+            else if (strncmp(line, "-ERR", 4) == 0)
+            {
+                // Fatal errors are followed by the server closing the connection
+                snprintf(error, sizeof(error), "%s", line + (line[4] == ' ' ? 5 : 4));
+                if (state == Handshaking)
+                {
+                    fail(error);
+                    return false;
+                }
+            }
+
+            position += consumed;
+        }
+
+        if (fd < 0)
+            return false;
+
+        memmove(readBuffer, readBuffer + position, readLength - position);
+        readLength -= position;
+        return true;
+    }
+
+    // "MSG <subject> <sid> [reply-to] <bytes>"; false if the payload has not all arrived.
+    // total is how much of the buffer the message used.
+    bool handleMessage(char *line, size_t available, size_t consumed, size_t &total)
+    {
+        char *tokens[5];
+        char *rest = nullptr;
+        int count = 0;
+        for (char *token = strtok_r(line + 4, " ", &rest); token != nullptr && count < 5; token = strtok_r(nullptr, " ", &rest))
+            tokens[count++] = token;
+
+        if (count < 3 || count > 4)
+        {
+            total = consumed;
+            return true;
+        }
+
+        size_t length = strtoul(tokens[count - 1], nullptr, 10);
+        total = consumed + length + 2;
+        if (total > readCapacity)
+        {
+            // Can never fit: drop what is here and skip the rest as it arrives
+            skippedMessages++;
+            skipRemaining = total > available ? total - available : 0;
+            total = total > available ? available : total;
+            return true;
+        }
+
+        if (total > available)
+        {
+            // Undo the tokenising so the line parses again once the rest is in
+            for (char *p = line; p < line + consumed - 2; p++)
+            {
+                if (*p == 0)
+                    *p = ' ';
+            }
+            return false;
+        }
+
+        receivedMessages++;
+        if (handler != nullptr)
+            handler(tokens[0], count == 4 ? tokens[2] : nullptr, (const uint8_t *)line + consumed, length, handlerContext);
+        return true;
+    }
+
+    char host[64] = "";
+    uint16_t port = 4222;
+    char user[64] = "";
+    char password[64] = "";
+    char name[48] = "";
+
+    sockaddr_in address = {};
+    bool haveAddress = false;
+    int fd = -1;
+
+    State state = Idle;
+    uint32_t nowMs = 0;
+    uint32_t stateSinceMs = 0;
+    uint32_t nextAttemptMs = 0;
+    Backoff backoff{MinBackoffMs, MaxBackoffMs};
+    uint32_t lastPingMs = 0;
+    int pingsOut = 0;
+    bool infoReceived = false;
+    size_t maxPayload = 1024 * 1024;
+
+    uint8_t *writeBuffer;
+    size_t writeCapacity;
+    size_t writeLength = 0;
+    uint8_t *readBuffer;
+    size_t readCapacity;
+    size_t readLength = 0;
+    size_t skipRemaining = 0;
+
+    subscription_t subscriptions[MaxSubscriptions] = {};
+    int nextSid = 1;
+    MessageHandler handler = nullptr;
+    void *handlerContext = nullptr;
+
+    char error[64] = "";
+    uint32_t connectCount = 0;
+    uint32_t publishedMessages = 0;
+    uint32_t refusedMessages = 0;
+    uint32_t receivedMessages = 0;
+    uint32_t skippedMessages = 0;
+    uint64_t bytesSent = 0;
+};
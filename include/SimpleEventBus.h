@@ -1,47 +1,166 @@
 #pragma once
-#include <Arduino.h>
-#include <functional>
-#include <vector>
-#include <map>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <type_traits>
 
+#ifdef ESP_PLATFORM
+#include <freertos/FreeRTOS.h>
+#else
+#include <mutex>
+#endif
+
+// Routes events, named by an enum, to plain function handlers. Tables are fixed at compile
+// time and payloads are copied by value, so publishing never allocates. Handlers subscribe
+// during setup; publishing is safe from any task.
+//
+// A handler runs on the publishing task unless it subscribes through a Mailbox: then the
+// delivery is queued and runs when the mailbox's owner calls dispatch(), e.g. on the task
+// that owns LVGL.
+template <typename Event, typename Payload, int EventCount, int MaxSubscribers = 4, int MailboxDepth = 8>
 class SimpleEventBus
 {
-private:
-    std::map<String, std::vector<std::function<void(String)>>> subscribers;
+    static_assert(std::is_enum<Event>::value, "Events are named by an enum");
+    static_assert(std::is_trivially_copyable<Payload>::value, "Payloads are copied into mailboxes");
 
 public:
-    void subscribe(String event, std::function<void(String)> callback)
-    {
-        subscribers[event].push_back(callback);
-    }
+    using Handler = void (*)(Event event, const Payload &payload);
 
-    void publish(String event, String data = "")
+    class Mailbox
     {
-        if (subscribers.find(event) != subscribers.end())
+    public:
+        // wake, if given, is called after each delivery is queued, so the owner can sleep
+        explicit Mailbox(void (*wake)() = nullptr) : wake(wake) {}
+
+        // Runs the queued deliveries on the calling task; returns how many ran
+        int dispatch()
+        {
+            int count = 0;
+            Delivery delivery;
+            while (take(delivery))
+            {
+                delivery.handler(delivery.event, delivery.payload);
+                count++;
+            }
+            return count;
+        }
+
+        uint32_t dropped() const { return droppedCount; }
+        uint32_t highWater() const { return highWaterMark; }
+
+    private:
+        friend class SimpleEventBus;
+
+        struct Delivery
+        {
+            Handler handler;
+            Event event;
+            Payload payload;
+        };
+
+        // Drops the delivery if the owner has fallen behind by a full mailbox
+        bool post(Handler handler, Event event, const Payload &payload)
+        {
+            lock();
+            bool queued = count < MailboxDepth;
+            if (queued)
+            {
+                deliveries[(head + count) % MailboxDepth] = {handler, event, payload};
+                count++;
+                if ((uint32_t)count > highWaterMark)
+                    highWaterMark = count;
+            }
+            else
+            {
+                droppedCount++;
+            }
+            unlock();
+
+            if (queued && wake != nullptr)
+                wake();
+            return queued;
+        }
+
+        bool take(Delivery &delivery)
         {
-            for (auto &callback : subscribers[event])
+            lock();
+            bool available = count > 0;
+            if (available)
             {
-                callback(data);
+                delivery = deliveries[head];
+                head = (head + 1) % MailboxDepth;
+                count--;
             }
+            unlock();
+            return available;
         }
+
+#ifdef ESP_PLATFORM
+        portMUX_TYPE mux = portMUX_INITIALIZER_UNLOCKED;
+        void lock() { portENTER_CRITICAL(&mux); }
+        void unlock() { portEXIT_CRITICAL(&mux); }
+#else
+        std::mutex mutex;
+        void lock() { mutex.lock(); }
+        void unlock() { mutex.unlock(); }
+#endif
+
+        void (*wake)();
+        Delivery deliveries[MailboxDepth];
+        int head = 0;
+        int count = 0;
+        uint32_t highWaterMark = 0;
+        uint32_t droppedCount = 0;
+    };
+
+    // Call during setup; returns false once the event's table is full
+    bool subscribe(Event event, Handler handler, Mailbox *mailbox = nullptr)
+    {
+        int index = (int)event;
+        if (index < 0 || index >= EventCount || handler == nullptr)
+            return false;
+
+        int count = counts[index].load();
+        if (count >= MaxSubscribers)
+            return false;
+
+        subscribers[index][count] = {handler, mailbox};
+        counts[index] = count + 1;
+        return true;
     }
-};
 
-// Usage:
-/*
-SimpleEventBus eventBus;
+    // Returns how many handlers ran or were queued
+    int publish(Event event, const Payload &payload = Payload())
+    {
+        int index = (int)event;
+        if (index < 0 || index >= EventCount)
+            return 0;
 
-void setup() {
-    eventBus.subscribe("weather_update", [](String data) {
-        Serial.println("Weather: " + data);
-    });
+        int delivered = 0;
+        int count = counts[index].load();
+        for (int i = 0; i < count; i++)
+        {
+            const Subscriber &subscriber = subscribers[index][i];
+            if (subscriber.mailbox == nullptr)
+            {
+                subscriber.handler(event, payload);
+                delivered++;
+            }
+            else if (subscriber.mailbox->post(subscriber.handler, event, payload))
+            {
+                delivered++;
+            }
+        }
+        return delivered;
+    }
 
-    eventBus.subscribe("mqtt_message", [](String data) {
-        Serial.println("MQTT: " + data);
-    });
-}
+private:
+    struct Subscriber
+    {
+        Handler handler;
+        Mailbox *mailbox;
+    };
 
-void publishWeather() {
-    eventBus.publish("weather_update", "25.3°C");
-}
-*/
\ No newline at end of file
+    Subscriber subscribers[EventCount][MaxSubscribers] = {};
+    std::atomic<int> counts[EventCount] = {};
+};
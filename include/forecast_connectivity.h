@@ -0,0 +1,38 @@
+#pragma once
+
+#include <Arduino.h>
+#include <lvgl.h>
+
+// Each network link reports when it comes up and when it drops; the time from a drop to
+// the link being up again is its time to reconnect
+enum link_t
+{
+    LINK_WIFI = 0,
+    LINK_MQTT,
+    LINK_NATS,
+    LINK_COUNT
+};
+
+struct linkStats_t
+{
+    bool up;
+    uint32_t drops;              // Unexpected losses; disconnects asked for are not counted
+    uint32_t reconnects;         // Drops recovered from
+    uint32_t lastReconnectMs;    // Time to reconnect after the latest drop
+    uint32_t averageReconnectMs; // Exponential, weight 1/4
+    uint32_t maxReconnectMs;
+    uint32_t downForMs;          // How long a dropped link has been down so far
+};
+
+// Follows the station's WiFi events and publishes EVENT_NETWORK_CHANGED on the WiFi event
+// task; handlers only set flags and wake their own task. Call before setupWifi().
+void setupConnectivity();
+bool networkUp();
+
+// Safe from any task
+void linkUp(link_t link);
+void linkDown(link_t link, bool dropped);
+
+const char *getLinkName(link_t link);
+linkStats_t getLinkStats(link_t link);
+void logLinkStats(lv_timer_t *timer);
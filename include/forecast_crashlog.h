@@ -0,0 +1,36 @@
+#pragma once
+
+#include <Arduino.h>
+
+// The last log records of each boot are mirrored into RTC memory, which survives a
+// panic, watchdog or software reset, so the lines leading up to a crash can be shipped
+// after the reboot. Slots are fixed-size and picked by the record's sequence number;
+// longer records are truncated.
+static const int CrashLogSlots = 32;
+static const int CrashLogSlotSize = 128;
+
+// A recovered tail is kept until it is published, retried at this interval for up to
+// the timeout
+static const uint32_t CrashLogRetryMs = 5000;
+static const uint32_t CrashLogShipTimeoutMs = 10 * 60 * 1000;
+
+// Room left in front of the recovered lines for a batch header
+static const size_t CrashLogHeaderRoom = 32;
+
+// Reads the previous boot's tail, if the reset left one, and starts this boot's. Call
+// before anything is logged.
+void setupCrashLog();
+
+// Copies a record into its slot: for LogRecordText the line without the newline, for
+// LogRecordBinary the format ID, format address and arguments, which may be passed as a
+// second piece. Safe from any task; costs a copy of at most one slot.
+void mirrorToCrashLog(uint8_t kind, uint8_t level, uint32_t sequence, const uint8_t *data, size_t length,
+                      const uint8_t *more = nullptr, size_t moreLength = 0);
+
+// The previous boot's lines, formatted and tagged with the reset reason, one per line.
+// CrashLogHeaderRoom bytes in front of the returned pointer are free for the caller.
+// Returns nullptr if there is nothing (left) to ship.
+uint8_t *getRecoveredCrashLog(size_t &length, uint32_t &lines);
+void releaseRecoveredCrashLog();
+
+const char *getResetReasonName();
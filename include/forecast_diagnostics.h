@@ -0,0 +1,15 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Operators query devices over NATS request/reply: "aura2.diag" reaches the whole fleet
+// and "aura2.diag.<device>" one device. The request names the sections wanted, separated
+// by spaces or commas, or is empty for all of them; the reply is one compact JSON object.
+// Sections: heap, tasks, jobs (with heartbeat ages), wifi, stalls, nats, links, log.
+
+// Subscribes the diagnostics subjects; call after setupNats()
+void setupDiagnostics();
+
+// Writes the snapshot for the requested sections; returns its length, or zero if it did
+// not fit
+size_t writeDiagnostics(const char *sections, size_t sectionsLength, char *out, size_t outSize);
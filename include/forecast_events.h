@@ -0,0 +1,41 @@
+#pragma once
+
+#include <Arduino.h>
+#include "SimpleEventBus.h"
+
+enum event_t
+{
+    EVENT_SETTING_CHANGED = 0, // The web settings page saved a setting
+    EVENT_NETWORK_CHANGED,     // The station gained or lost its IP address
+    EVENT_FORECAST_READY,      // The weather job has a new forecast for the screen
+    EVENT_COUNT
+};
+
+enum setting_t
+{
+    SETTING_BRIGHTNESS = 0,
+    SETTING_CLOCK_FORMAT,
+    SETTING_TEMPERATURE_UNIT,
+    SETTING_DIM_SCHEDULE,
+    SETTING_DAYLIGHT_SAVING,
+    SETTING_LOCATION,
+    SETTING_MQTT,
+    SETTING_NATS,
+    SETTING_FLEET_WEATHER
+};
+
+struct eventData_t
+{
+    setting_t setting; // EVENT_SETTING_CHANGED
+    bool up;           // EVENT_NETWORK_CHANGED
+};
+
+using EventBus = SimpleEventBus<event_t, eventData_t, EVENT_COUNT>;
+
+extern EventBus eventBus;
+
+// Deliveries for handlers that touch LVGL; loop() runs them on the loop task
+extern EventBus::Mailbox uiMailbox;
+
+void publishSettingChanged(setting_t setting);
+void publishNetworkChanged(bool up);
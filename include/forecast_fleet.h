@@ -0,0 +1,43 @@
+#pragma once
+
+#include <Arduino.h>
+#include <lvgl.h>
+#include "FleetForecast.h"
+
+// Opt-in with use_fleet_weather: devices whose locations match to two decimals (about a
+// kilometre) elect one fetcher per location through a retained lease under
+// aura/fleet/weather/<lat>,<lon>/. The lease outlives two missed fetches before another
+// device takes over.
+static const uint32_t FleetLeaseSeconds = 25 * 60;
+
+// Followers see an expired lease on the same weather run, since a shared forecast runs every
+// follower's job at once. Each waits a random share of this before claiming, and the first
+// claim reaches the others before their turn comes.
+static const uint32_t FleetClaimJitterMs = 30 * 1000;
+
+struct fleetStats_t
+{
+    bool holder;             // This device fetches for its location
+    uint32_t leaseExpiresAt; // Unix time, zero if no lease is known
+    uint32_t claims;         // Leases taken because none was valid
+    uint32_t shared;         // Forecasts published for the fleet
+    uint32_t received;       // Forecasts from other devices
+    uint32_t skippedFetches; // Fetches left to the lease holder
+};
+
+// Subscribes the fleet topics; call before setupMqtt()
+void setupFleetWeather();
+
+// Asked by updateWeather() before it fetches; false while another device holds the lease.
+// When nobody holds it, the lease is claimed after a random delay and the weather job runs
+// again then.
+bool fleetShouldFetch();
+
+// After a successful fetch: renews the lease and publishes the forecast for the others
+void shareForecast(const forecast_t &forecast);
+
+// Takes the latest forecast shared by another device, once
+bool takeSharedForecast(forecast_t &forecast);
+
+fleetStats_t getFleetStats();
+void logFleetStats(lv_timer_t *timer);
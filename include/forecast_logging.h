@@ -0,0 +1,175 @@
+#pragma once
+
+#include <Arduino.h>
+#include <ArduinoLog.h>
+#include <ArduinoJson.h>
+#include <lvgl.h>
+#include "LogBinary.h"
+
+// Log lines wait here between Log.* and the logger task, as variable-length records
+static const uint32_t LogRingSize = 8192;
+
+// Each task builds its current line in a staging slot before it is copied into the ring
+static const int LogStagingSlots = 8;
+static const int LogStagingLineMax = 256;
+
+// Lines are shipped to NATS in batches, published once a batch reaches the flush size
+// or its oldest line has waited the maximum delay
+static const uint32_t LogBatchMaxBytes = 1024;
+static const uint32_t LogBatchFlushBytes = LogBatchMaxBytes - LogStagingLineMax;
+static const uint32_t LogBatchMaxDelayMs = 1000;
+
+// Only the logger task writes to Serial, through a TX buffer large enough that it never
+// waits for the UART; output the buffer cannot take is dropped and counted. Set the
+// rate with -D LOG_SERIAL_BAUD=...
+static const size_t LogSerialTxBufferSize = 4096;
+#ifndef LOG_SERIAL_BAUD
+#define LOG_SERIAL_BAUD 115200
+#endif
+
+// Every record in the ring starts with its kind, level, per-boot sequence number and the
+// esp_timer time of the call in µs. Text records go on with the line, '\n' and a NUL;
+// deferred-format records with the format ID, the format string's address (so the line
+// can still be printed on the device) and the raw arguments.
+static const uint8_t LogRecordText = 0;
+static const uint8_t LogRecordBinary = 1;
+static const size_t LogRecordHeaderSize = 14;
+static const size_t LogBinaryHeaderSize = LogRecordHeaderSize + 8;
+
+// Raw arguments a deferred-format call site may carry
+static const size_t LogBinaryArgsMax = 96;
+
+// Calls more verbose than this are compiled out; set with -D LOG_LEVEL_FLOOR=...
+#ifndef LOG_LEVEL_FLOOR
+#define LOG_LEVEL_FLOOR LOG_LEVEL_VERBOSE
+#endif
+
+// Each module logs under a category whose level can be changed at runtime
+enum logCategory_t
+{
+    LOG_SYSTEM = 0,
+    LOG_WEATHER,
+    LOG_MQTT,
+    LOG_SETTINGS,
+    LOG_LVGL,
+    LOG_TOUCH,
+    LOG_POWER,
+    LOG_JOBS,
+    LOG_NATS,
+    LOG_CATEGORY_COUNT
+};
+
+// Indexed by logCategory_t; read on every LOG_* call, so kept as a plain array
+extern uint8_t logLevels[LOG_CATEGORY_COUNT];
+
+struct logStats_t
+{
+    uint32_t droppedLines;       // Ring full when the line was committed
+    uint32_t splitLines;         // Lines longer than a staging slot, shipped in pieces
+    uint32_t unstagedBytes;      // Dropped because every staging slot was busy
+    uint32_t unstagedLines;      // Lost entirely for the same reason
+    uint32_t unpublishedLines;   // In batches NATS did not take
+    uint32_t serialDroppedBytes; // Dropped because the Serial TX buffer was full
+    uint32_t shippedLines;       // Published to NATS
+    uint32_t publishedBatches;
+    uint32_t textWireBytes;   // Published bytes per format, batch headers included
+    uint32_t textWireLines;
+    uint32_t binaryWireBytes;
+    uint32_t binaryWireLines;
+    uint32_t textCallCycles;  // Average CPU cycles per LOG_* call in each mode
+    uint32_t binaryCallCycles;
+    uint32_t highWaterBytes;
+    uint32_t capacityBytes;
+};
+
+// Starts Serial and the logger task; call first thing in setup(), once preferences are
+// open, so nothing else needs to touch Serial
+void setupLogging();
+logStats_t getLogStats();
+
+// Records lost on the way to NATS so far this boot; each batch carries it so the host can
+// tell dropped records from ones still in flight
+uint32_t getLogDroppedRecords();
+void logLogStats(lv_timer_t *timer);
+
+// Category names are the lowercase enum names without the prefix, e.g. "weather"; level
+// names are ArduinoLog's: silent, fatal, error, warning, info, trace, verbose
+const char *getLogCategoryName(logCategory_t category);
+const char *getLogLevelName(int level);
+int parseLogLevel(const char *name);
+
+// Changes and persists a category's level. "all" sets every category.
+bool setLogLevel(const char *category, int level);
+
+// Applies a JSON object of category to level name, e.g. {"weather":"verbose"}, then
+// replaces its contents with the level of every category. False if anything was invalid.
+bool applyLogLevels(JsonDocument &levels);
+
+// When binary logging is on, LOG_* calls skip formatting and ship a format ID and raw
+// arguments; the host decodes them with the table util/log_formats.py generates.
+void setBinaryLogging(bool enabled);
+bool isBinaryLogging();
+
+void logBinaryRecord(int level, uint32_t formatId, const char *format, const uint8_t *args, size_t argsLength);
+void recordLogCallCycles(bool binary, uint32_t cycles);
+
+template <typename... Args>
+void logTextLine(int level, const char *format, Args... args)
+{
+    switch (level)
+    {
+    case LOG_LEVEL_FATAL:
+        Log.fatalln(format, args...);
+        break;
+    case LOG_LEVEL_ERROR:
+        Log.errorln(format, args...);
+        break;
+    case LOG_LEVEL_WARNING:
+        Log.warningln(format, args...);
+        break;
+    case LOG_LEVEL_INFO:
+        Log.infoln(format, args...);
+        break;
+    case LOG_LEVEL_TRACE:
+        Log.traceln(format, args...);
+        break;
+    default:
+        Log.verboseln(format, args...);
+        break;
+    }
+}
+
+template <typename... Args>
+void logDeferred(int level, uint32_t formatId, const char *format, Args... args)
+{
+    uint32_t started = ESP.getCycleCount();
+    bool binary = isBinaryLogging();
+    if (binary)
+    {
+        uint8_t buffer[LogBinaryArgsMax];
+        LogArgWriter writer(buffer, sizeof(buffer));
+        encodeLogArgs(writer, args...);
+        logBinaryRecord(level, formatId, format, buffer, writer.size());
+    }
+    else
+    {
+        logTextLine(level, format, args...);
+    }
+    recordLogCallCycles(binary, ESP.getCycleCount() - started);
+}
+
+// The format must be a string literal: its ID is computed at compile time. The floor
+// check folds away at compile time, leaving one load and compare per call.
+#define LOG_AT(category, level, format, ...) \
+    do \
+    { \
+        if ((level) <= LOG_LEVEL_FLOOR && (level) <= logLevels[category]) \
+            logDeferred(level, std::integral_constant<uint32_t, logFormatId(format)>::value, format, ##__VA_ARGS__); \
+    } while (0)
+
+#define LOG_FATAL(category, format, ...) LOG_AT(category, LOG_LEVEL_FATAL, format, ##__VA_ARGS__)
+#define LOG_ERROR(category, format, ...) LOG_AT(category, LOG_LEVEL_ERROR, format, ##__VA_ARGS__)
+#define LOG_WARNING(category, format, ...) LOG_AT(category, LOG_LEVEL_WARNING, format, ##__VA_ARGS__)
+#define LOG_INFO(category, format, ...) LOG_AT(category, LOG_LEVEL_INFO, format, ##__VA_ARGS__)
+#define LOG_TRACE(category, format, ...) LOG_AT(category, LOG_LEVEL_TRACE, format, ##__VA_ARGS__)
+#define LOG_VERBOSE(category, format, ...) LOG_AT(category, LOG_LEVEL_VERBOSE, format, ##__VA_ARGS__)
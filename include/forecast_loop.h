@@ -0,0 +1,27 @@
+#pragma once
+
+#include <Arduino.h>
+
+// Upper bound on a single idle sleep of the main loop
+static const uint32_t LoopMaxSleepMs = 1000;
+
+struct loopStats_t
+{
+    uint32_t wakeupsPerSecond;      // Loop iterations during the last full second
+    uint32_t eventWakeupsPerSecond; // Of those, woken early by touch, network or LVGL
+    uint32_t lastSleepMs;           // Sleep requested by the last iteration
+    uint32_t averageOversleepUs;    // Timed wakeups: actual minus requested sleep
+    uint32_t maxOversleepUs;
+    uint32_t averageWakeLatencyUs;  // Event wakeups: wake request to the loop running
+    uint32_t maxWakeLatencyUs;
+};
+
+void setupLoop();
+
+// Blocks the loop task until the deadline passes or something wakes it
+void waitForNextEvent(uint32_t sleepMs);
+
+void wakeMainLoop();
+void wakeMainLoopFromISR();
+
+loopStats_t getLoopStats();
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+#include <lvgl.h>
+
+// A background task browses for the watched service types and caches what it finds, so
+// callers pick a host from memory and never wait on an mDNS query
+static const int MaxMdnsServices = 2;
+static const int MaxMdnsCandidates = 4;
+
+// Arduino's mDNS API does not expose record TTLs; this is the usual host record TTL
+static const uint32_t MdnsCacheTtlMs = 120 * 1000;
+
+struct mdnsCandidate_t
+{
+    char hostname[32];
+    char address[16];        // Dotted IPv4
+    uint16_t port;
+    uint32_t seenMs;         // Last answer that included it
+    uint32_t lastSuccessMs;  // Zero until a caller reports a success
+    uint32_t failures;       // Consecutive failures reported since the last success
+};
+
+struct mdnsStats_t
+{
+    uint32_t queries;
+    uint32_t emptyQueries;
+    uint32_t expired;        // Candidates dropped after not being seen for a TTL
+    uint32_t lastQueryMs;    // Duration of the latest query
+    uint32_t maxQueryMs;
+};
+
+// Starts the resolver task; call after MDNS.begin()
+void setupMdnsResolver();
+
+// Registers a service type such as ("mqtt", "tcp") and returns its handle, or -1 if the
+// table is full; the same type registered twice shares one handle
+int watchMdnsService(const char *service, const char *proto);
+
+// Copies the cached candidates, best first: fewest recent failures, then most recent
+// success. Returns how many were copied; zero if nothing has been found yet.
+int getMdnsCandidates(int handle, mdnsCandidate_t *candidates, int maxCandidates);
+
+// Callers say how connecting to a candidate went, which orders later lookups
+void reportMdnsCandidate(int handle, const char *address, bool success);
+
+// Asks for a fresh query without waiting for it, e.g. when every candidate failed
+void refreshMdnsService(int handle);
+
+mdnsStats_t getMdnsStats();
+void logMdnsStats(lv_timer_t *timer);
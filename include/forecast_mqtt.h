@@ -1,11 +1,79 @@
 #pragma once
 
 #include "lvgl.h"
+#include <ArduinoJson.h>
+#include "MQTTDispatcher.h"
 
+// Topics other modules subscribe through subscribeMqtt()
+static const int MaxMqttSubscriptions = 4;
+
+// Publishes wait for the MQTT task in a queue with one slot per topic
+static const int MqttOutboxSlots = 8;
+static const size_t MqttTopicMax = 96;
+static const size_t MqttPayloadMax = 384;
+
+// Message counts and costs; averages cover roughly the last eight messages
+struct mqttStats_t
+{
+    uint32_t inboundMessages;
+    uint32_t unhandledMessages;
+    uint32_t fallbackParses;      // Payloads the fast parser left to ArduinoJson
+    uint32_t messageCycles;       // Whole callback: routing, parsing and the handler's work
+    uint32_t maxMessageCycles;
+    uint32_t parseCycles;         // Parsing a backlight command alone
+    uint32_t outboxDepth;
+    uint32_t outboxHighWater;
+    uint32_t coalescedPublishes;  // Replaced by a newer value before they were sent
+    uint32_t droppedPublishes;    // Queue full or too large
+    uint32_t failedPublishes;     // Refused by the client
+    uint32_t sentPublishes;
+    uint32_t publishLatencyUs;    // From queueing to sent
+    uint32_t maxPublishLatencyUs;
+    uint32_t discoveryPasses;     // On every connect and every Home Assistant restart
+    uint32_t discoveryArenaBytes; // Built once per boot
+    int32_t discoveryHeapBytes;   // Free heap lost during the last pass, other tasks included
+};
+
+// Entities whose state is published under a change/interval/heartbeat policy
+enum mqttEntity_t
+{
+    MQTT_ENTITY_TEMPERATURE = 0,
+    MQTT_ENTITY_BACKLIGHT,
+    MQTT_ENTITY_COUNT
+};
+
+struct mqttEntityStats_t
+{
+    uint32_t updates;    // Values recorded by the producers
+    uint32_t sent;
+    uint32_t heartbeats; // Sent only because the heartbeat interval passed
+    uint32_t suppressed; // Within the deadband of the last value sent
+    uint32_t deferred;   // Changes held back by the minimum interval
+};
+
+// Asks the MQTT task to (re)connect with the current settings
 void checkMqttConnection(lv_timer_t *timer);
-void loopMqtt();
 void setupMqtt();
 
-void publishHomeAssistantDiscovery();
+// Routes topics matching pattern to handler, which runs on the MQTT task. The dispatcher is
+// not locked, so call before setupMqtt(); the pattern must outlive it. Returns a slot for
+// setMqttSubscription(), or -1. Nothing is subscribed at the broker until a topic is set.
+int subscribeMqtt(const char *pattern, Handler handler);
+
+// Sets the topic the broker sends for a slot, one the slot's pattern matches, or "" for
+// none. Safe from any task; the MQTT task swaps the subscription and renews it on connect.
+bool setMqttSubscription(int slot, const char *topic);
+
+// Queues a publish for the MQTT task without blocking; false if MQTT is off, the queue
+// is full or the message too large. A queued topic keeps only its latest value.
+bool queueMqttPublish(const char *topic, const char *payload, size_t length, bool retained);
+
+// Record the current readings; the MQTT task publishes them as the entity's policy allows.
+// Call publishSensorState() only with freshly fetched values.
 void publishSensorState();
 void publishBacklightState();
+void publishLogLevels(const JsonDocument &levels);
+
+mqttStats_t getMqttStats();
+mqttEntityStats_t getMqttEntityStats(mqttEntity_t entity);
+void logMqttStats(lv_timer_t *timer);
@@ -2,10 +2,50 @@
 
 #include "lvgl.h"
 
+// Messages wait here between the producers and the NATS task, as variable-length
+// records; producers never wait for the network
+static const uint32_t NatsOutboxSize = 8192;
+
+// Request subjects the device answers on, and the largest reply
+static const int MaxNatsResponders = 4;
+static const size_t NatsReplyMax = 3072;
+
+struct natsStats_t
+{
+    bool connected;
+    uint32_t uptimeMs;         // Of the current connection, zero when down
+    uint32_t connectedMs;      // Total across all connections this boot
+    uint32_t connects;         // Successful handshakes; all but the first are reconnects
+    uint32_t failedAttempts;   // Connection attempts that never got to connected
+    uint32_t disconnects;      // Connections lost after they were up
+    uint32_t queuedMessages;   // Accepted into the outbox
+    uint32_t sentMessages;     // Handed to the client and sent
+    uint32_t droppedMessages;  // Outbox full, or still queued when the connection went down
+    uint32_t outboxHighWaterBytes;
+    uint32_t requests;         // Requests answered
+    const char *lastError;
+};
+
+// Settings and checks post to the NATS task, which owns the connection
 void checkNatsConnection(lv_timer_t *timer);
 void connectNats();
 void disconnectNats();
-void loopNats();
 void setupNats();
 
-void publishLogMessage(const char* message);
+// Queues a message for the NATS task; false if NATS is not connected or the outbox is full
+bool publishNats(const char *subject, const uint8_t *payload, size_t length);
+
+// Publishes a framed batch of log lines, binary batches on their own subject; false if
+// it was not queued
+bool publishLogBatch(const char *batch, size_t length, bool binary);
+
+// Answers a request on the NATS task: writes the reply and returns its length, or zero
+// to send none
+using natsResponder_t = size_t (*)(const uint8_t *request, size_t length, char *reply, size_t replySize);
+
+// Serves requests on a subject for as long as the device runs; subscriptions are renewed
+// after every reconnect. False if the table is full or the subject too long.
+bool respondNats(const char *subject, natsResponder_t responder);
+
+natsStats_t getNatsStats();
+void logNatsStats(lv_timer_t *timer);
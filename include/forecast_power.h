@@ -0,0 +1,51 @@
+#pragma once
+
+#include <Arduino.h>
+#include <lvgl.h>
+
+// Activities that keep the CPU at full speed and out of light sleep while they run
+enum powerActivity_t
+{
+    POWER_RENDER = 0,
+    POWER_FLUSH,
+    POWER_TOUCH,
+    POWER_NETWORK,
+    POWER_ACTIVITY_COUNT
+};
+
+struct powerStats_t
+{
+    bool lightSleepEnabled;
+    uint32_t sleepEligiblePercent; // Share of the last window with no power lock held
+    uint32_t lockAcquisitions[POWER_ACTIVITY_COUNT];
+};
+
+void setupPower();
+void powerLockAcquire(powerActivity_t activity);
+void powerLockRelease(powerActivity_t activity);
+powerStats_t getPowerStats();
+void logPowerStats(lv_timer_t *timer);
+
+// The backlight PWM runs from the RTC 8 MHz clock so it keeps going in light sleep
+void setBacklightLevel(uint8_t level);
+
+// Holds a power lock for the lifetime of a scope
+class PowerLock
+{
+public:
+    explicit PowerLock(powerActivity_t activity) : activity(activity)
+    {
+        powerLockAcquire(activity);
+    }
+
+    ~PowerLock()
+    {
+        powerLockRelease(activity);
+    }
+
+    PowerLock(const PowerLock &) = delete;
+    PowerLock &operator=(const PowerLock &) = delete;
+
+private:
+    powerActivity_t activity;
+};
@@ -22,6 +22,7 @@ extern String utc_offset;
 extern bool use_dst;
 extern bool use_mqtt;
 extern bool use_nats;
+extern bool use_fleet_weather;
 extern String natsServer;
 extern String natsUser;
 extern String natsPassword;
@@ -0,0 +1,48 @@
+#pragma once
+
+#include <Arduino.h>
+#include <lvgl.h>
+
+static const int MaxJobs = 16;
+
+// Job callbacks share the lv_timer signature so existing handlers can be scheduled directly
+using jobCallback_t = void (*)(lv_timer_t *timer);
+
+enum jobClass_t
+{
+    JOB_UI = 0,     // Runs inside lv_timer_handler() and may touch LVGL objects
+    JOB_BACKGROUND  // Runs on a per-core background task and must not touch LVGL
+};
+
+struct jobDefinition_t
+{
+    const char *name;
+    jobCallback_t callback;
+    jobClass_t jobClass;
+    uint8_t priority;    // Higher runs first when several jobs are due together
+    uint32_t periodMs;
+    uint32_t deadlineMs; // Allowed time from release to completion
+    BaseType_t core;     // Core for background jobs; UI jobs always run on the loop task
+};
+
+struct jobStats_t
+{
+    const char *name;
+    jobClass_t jobClass;
+    uint32_t runs;
+    uint32_t missedDeadlines;
+    uint32_t lastDurationUs;
+    uint32_t maxDurationUs;
+    uint32_t averageDurationUs;
+};
+
+int scheduleJob(const jobDefinition_t &job, bool runNow = false);
+int findJob(const char *name);
+void runJobNow(int jobId);
+
+// Name of the job currently running on a task, or nullptr when it is between jobs
+const char *getActiveJobName(TaskHandle_t task);
+
+int getJobCount();
+bool getJobStats(int jobId, jobStats_t &stats);
+void logJobStats(lv_timer_t *timer);
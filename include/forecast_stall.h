@@ -0,0 +1,74 @@
+#pragma once
+
+#include <Arduino.h>
+#include <lvgl.h>
+
+static const int MaxStallWatches = 8;
+static const int StallBacktraceDepth = 8;
+static const int MaxStallReports = 4;
+
+// The loop legitimately sleeps for up to LoopMaxSleepMs between heartbeats
+static const uint32_t LoopStallThresholdMs = 2000;
+
+struct stallReport_t
+{
+    uint32_t sequence;
+    uint32_t uptimeSeconds; // When the stall was detected
+    uint32_t durationMs;    // Zero if the device reset before the task recovered
+    char task[16];
+    char job[16];
+    char site[24];
+    uint8_t depth;
+    uint32_t backtrace[StallBacktraceDepth];
+};
+
+struct stallStats_t
+{
+    uint32_t stalls;
+    uint32_t totalStallMs;
+    uint32_t maxStallMs;
+    uint32_t lastStallMs;
+};
+
+void setupStallMonitor();
+
+// Watches the calling task; a threshold of zero records heartbeat age without raising stalls
+int registerStallWatch(const char *name, uint32_t thresholdMs);
+void stallHeartbeat();
+
+// Milliseconds since a watched task last posted a heartbeat, or -1 if it is not watched
+int32_t getHeartbeatAge(int watch, const char **name);
+
+stallStats_t getStallStats();
+int getStallReports(stallReport_t *reports, int maxReports);
+void logStallStats(lv_timer_t *timer);
+
+// Names the blocking call a watched task is in, so a stall report can point at it
+class StallSite
+{
+public:
+    explicit StallSite(const char *site);
+    ~StallSite();
+
+    StallSite(const StallSite &) = delete;
+    StallSite &operator=(const StallSite &) = delete;
+
+private:
+    int watch;
+    const char *previous;
+};
+
+// Marks a watched task as blocked on purpose, such as a wait for work with no deadline, so
+// the wait is not reported as a stall. Leaving counts as a heartbeat.
+class StallParked
+{
+public:
+    StallParked();
+    ~StallParked();
+
+    StallParked(const StallParked &) = delete;
+    StallParked &operator=(const StallParked &) = delete;
+
+private:
+    int watch;
+};
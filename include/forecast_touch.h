@@ -0,0 +1,34 @@
+#pragma once
+
+#include <lvgl.h>
+
+// Raw XPT2046 ADC bounds mapped onto the display; persisted in preferences
+struct touchCalibration_t
+{
+    uint16_t minimumX;
+    uint16_t maximumX;
+    uint16_t minimumY;
+    uint16_t maximumY;
+};
+
+struct touchStats_t
+{
+    uint32_t presses;
+    uint32_t samples;          // SPI reads of the controller
+    uint32_t rateLimited;      // LVGL reads answered from the previous sample
+    uint32_t jitterRejected;   // Filtered points suppressed as jitter
+    uint32_t lastLatencyUs;    // Touch IRQ to LV_EVENT_PRESSED
+    uint32_t maxLatencyUs;
+    uint32_t averageLatencyUs;
+};
+
+void setupTouch();
+void touchpadRead(lv_indev_t *indev, lv_indev_data_t *data);
+
+// Feeds LVGL a touch read from the loop task when one is due; returns how long until the
+// next, or LV_NO_TIMER_READY while the panel is idle and only its IRQ can start one
+uint32_t readTouch();
+
+touchCalibration_t getTouchCalibration();
+void setTouchCalibration(const touchCalibration_t &calibration);
+touchStats_t getTouchStats();
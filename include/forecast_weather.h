@@ -10,5 +10,10 @@ extern bool display_seven_day_forecast;
 extern float temperature_now;
 extern float feels_like_temperature;
 
+// Redraws or refetches when the units or location change; call before setupWebserver()
+void setupWeather();
+
+// The weather job: fetches and parses on a background task, then hands the forecast to
+// the loop task to render
 void updateWeather(lv_timer_t *timer);
 void toggleSevenDayForecast();
@@ -0,0 +1,146 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include "forecast_connectivity.h"
+#include "forecast_events.h"
+#include "forecast_logging.h"
+
+struct linkState_t
+{
+    bool up;
+    bool wasUp;        // A first connection is not a reconnect
+    uint32_t downSinceMs;
+    linkStats_t stats;
+};
+
+static const char *const linkNames[LINK_COUNT] = {"wifi", "mqtt", "nats"};
+
+static linkState_t links[LINK_COUNT];
+static portMUX_TYPE linksMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Runs on the WiFi event task. The driver reconnects the station by itself and raises a
+// disconnect for every failed attempt, so only changes of state are published.
+static void connectivityEvent(arduino_event_id_t event, arduino_event_info_t info)
+{
+    switch (event)
+    {
+    case ARDUINO_EVENT_WIFI_STA_GOT_IP:
+        if (!links[LINK_WIFI].up)
+        {
+            linkUp(LINK_WIFI);
+            publishNetworkChanged(true);
+        }
+        break;
+
+    case ARDUINO_EVENT_WIFI_STA_DISCONNECTED:
+    case ARDUINO_EVENT_WIFI_STA_LOST_IP:
+        if (links[LINK_WIFI].up)
+        {
+            if (event == ARDUINO_EVENT_WIFI_STA_DISCONNECTED)
+                LOG_WARNING(LOG_SYSTEM, "WiFi disconnected, reason %d", info.wifi_sta_disconnected.reason);
+            else
+                LOG_WARNING(LOG_SYSTEM, "WiFi lost its IP address");
+
+            linkDown(LINK_WIFI, true);
+            publishNetworkChanged(false);
+        }
+        break;
+
+    default:
+        break;
+    }
+}
+
+void setupConnectivity()
+{
+    WiFi.setAutoReconnect(true);
+    WiFi.onEvent(connectivityEvent);
+
+    if (WiFi.status() == WL_CONNECTED)
+        linkUp(LINK_WIFI);
+}
+
+bool networkUp()
+{
+    return links[LINK_WIFI].up;
+}
+
+void linkUp(link_t link)
+{
+    uint32_t now = millis();
+    int32_t reconnectMs = -1;
+
+    portENTER_CRITICAL(&linksMux);
+    linkState_t &state = links[link];
+    if (!state.up)
+    {
+        if (state.wasUp && state.downSinceMs != 0)
+        {
+            uint32_t elapsed = now - state.downSinceMs;
+            linkStats_t &stats = state.stats;
+            stats.reconnects++;
+            stats.lastReconnectMs = elapsed;
+            stats.averageReconnectMs = (stats.averageReconnectMs == 0)
+                                           ? elapsed
+                                           : stats.averageReconnectMs - (stats.averageReconnectMs >> 2) + (elapsed >> 2);
+            if (elapsed > stats.maxReconnectMs)
+                stats.maxReconnectMs = elapsed;
+            reconnectMs = (int32_t)elapsed;
+        }
+
+        state.up = true;
+        state.wasUp = true;
+        state.downSinceMs = 0;
+    }
+    portEXIT_CRITICAL(&linksMux);
+
+    if (reconnectMs >= 0)
+    {
+        LOG_INFO(LOG_SYSTEM, "Link %s back after %d ms", linkNames[link], reconnectMs);
+    }
+}
+
+void linkDown(link_t link, bool dropped)
+{
+    portENTER_CRITICAL(&linksMux);
+    linkState_t &state = links[link];
+    if (state.up)
+    {
+        state.up = false;
+        if (dropped)
+        {
+            state.stats.drops++;
+            state.downSinceMs = millis();
+            if (state.downSinceMs == 0)
+                state.downSinceMs = 1;
+        }
+    }
+    portEXIT_CRITICAL(&linksMux);
+}
+
+const char *getLinkName(link_t link)
+{
+    return (link >= 0 && link < LINK_COUNT) ? linkNames[link] : "?";
+}
+
+linkStats_t getLinkStats(link_t link)
+{
+    portENTER_CRITICAL(&linksMux);
+    linkStats_t stats = links[link].stats;
+    stats.up = links[link].up;
+    uint32_t downSinceMs = links[link].downSinceMs;
+    portEXIT_CRITICAL(&linksMux);
+
+    stats.downForMs = (!stats.up && downSinceMs != 0) ? millis() - downSinceMs : 0;
+    return stats;
+}
+
+void logLinkStats(lv_timer_t *timer)
+{
+    for (int link = 0; link < LINK_COUNT; link++)
+    {
+        linkStats_t stats = getLinkStats((link_t)link);
+        LOG_INFO(LOG_SYSTEM, "Link %s %s: %d drops, %d reconnects, time to reconnect last %d ms, avg %d ms, max %d ms",
+                 linkNames[link], stats.up ? "up" : "down", stats.drops, stats.reconnects, stats.lastReconnectMs,
+                 stats.averageReconnectMs, stats.maxReconnectMs);
+    }
+}
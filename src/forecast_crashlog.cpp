@@ -0,0 +1,246 @@
+#include <Arduino.h>
+#include <atomic>
+#include <esp_attr.h>
+#include <esp_system.h>
+#include <esp_idf_version.h>
+#include "LogBinary.h"
+#include "forecast_crashlog.h"
+#include "forecast_logging.h"
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+#include <esp_app_desc.h>
+#define crashLogAppDescription() esp_app_get_description()
+#else
+#include <esp_ota_ops.h>
+#define crashLogAppDescription() esp_ota_get_app_description()
+#endif
+
+static const uint32_t CrashLogMagic = 0x41435254; // "TRCA"
+
+static const size_t CrashLogLineMax = 160;
+static const size_t CrashLogTagMax = 32;
+
+// Binary slots hold the format ID and the format string's address, then the arguments
+static const size_t CrashLogBinaryHeader = 8;
+
+struct crashLogSlot_t
+{
+    volatile uint32_t sequence; // The record's; zero while the slot is being written
+    uint8_t kind;
+    uint8_t level;
+    uint8_t length;
+    uint8_t data[CrashLogSlotSize - 7];
+};
+
+struct crashLogTail_t
+{
+    uint32_t magic;
+    uint32_t buildId;
+    crashLogSlot_t slots[CrashLogSlots];
+};
+
+// Left alone by the bootloader and startup code; only a power cycle clears it
+RTC_NOINIT_ATTR static crashLogTail_t crashTail;
+
+// Who may write each slot: the newest sequence number to claim it, and how many callers
+// are inside mirrorToCrashLog() for it. Only needed while writing, so ordinary RAM.
+struct crashLogClaim_t
+{
+    std::atomic<uint32_t> sequence;
+    std::atomic<uint8_t> writers;
+};
+
+static crashLogClaim_t claims[CrashLogSlots];
+
+static const char *resetReasonName = "unknown";
+static uint8_t *recovered = nullptr;
+static size_t recoveredLength = 0;
+static uint32_t recoveredLines = 0;
+
+static uint32_t currentBuildId()
+{
+    uint32_t id;
+    memcpy(&id, crashLogAppDescription()->app_elf_sha256, sizeof(id));
+    return id;
+}
+
+static const char *describeResetReason(esp_reset_reason_t reason)
+{
+    switch (reason)
+    {
+    case ESP_RST_POWERON:
+        return "power-on";
+    case ESP_RST_EXT:
+        return "external";
+    case ESP_RST_SW:
+        return "software";
+    case ESP_RST_PANIC:
+        return "panic";
+    case ESP_RST_INT_WDT:
+        return "interrupt watchdog";
+    case ESP_RST_TASK_WDT:
+        return "task watchdog";
+    case ESP_RST_WDT:
+        return "watchdog";
+    case ESP_RST_DEEPSLEEP:
+        return "deep sleep";
+    case ESP_RST_BROWNOUT:
+        return "brownout";
+    case ESP_RST_SDIO:
+        return "sdio";
+    default:
+        return "unknown";
+    }
+}
+
+void mirrorToCrashLog(uint8_t kind, uint8_t level, uint32_t sequence, const uint8_t *data, size_t length,
+                      const uint8_t *more, size_t moreLength)
+{
+    // Records CrashLogSlots apart share a slot, and a text line keeps the sequence number
+    // it started with, so an older record can arrive after a newer one, even while the
+    // newer one is being written. Only a record newer than the slot's claim may write it.
+    int index = sequence % CrashLogSlots;
+    crashLogClaim_t &claim = claims[index];
+    crashLogSlot_t &slot = crashTail.slots[index];
+
+    claim.writers++;
+    uint32_t claimed = claim.sequence.load();
+    do
+    {
+        if (claimed != 0 && (int32_t)(sequence - claimed) <= 0)
+        {
+            claim.writers--;
+            return;
+        }
+    } while (!claim.sequence.compare_exchange_weak(claimed, sequence));
+
+    length = min(length, sizeof(slot.data));
+    moreLength = min(moreLength, sizeof(slot.data) - length);
+
+    // A reset part way through leaves the slot unclaimed rather than torn
+    slot.sequence = 0;
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+    slot.kind = kind;
+    slot.level = level;
+    slot.length = (uint8_t)(length + moreLength);
+    memcpy(slot.data, data, length);
+    if (moreLength > 0)
+        memcpy(slot.data + length, more, moreLength);
+    std::atomic_signal_fence(std::memory_order_seq_cst);
+
+    // A newer record that took the slot meanwhile publishes it itself. If an older one
+    // may still be copying over this one, the slot stays unclaimed rather than torn.
+    if (claim.sequence.load() == sequence && claim.writers.load() == 1)
+        slot.sequence = sequence;
+    claim.writers--;
+}
+
+// Formats one slot as "[<reason> #<sequence>] <line>"
+static size_t formatRecoveredSlot(const crashLogSlot_t &slot, char *out, size_t outSize)
+{
+    size_t length = snprintf(out, outSize, "[%s #%lu] ", resetReasonName, (unsigned long)slot.sequence);
+    if (length >= outSize)
+        return 0;
+
+    if (slot.kind == LogRecordBinary && slot.length >= CrashLogBinaryHeader)
+    {
+        static const char levels[] = "FEWITV";
+        uint32_t formatAddress;
+        memcpy(&formatAddress, slot.data + 4, 4);
+
+        out[length++] = (slot.level >= 1 && slot.level <= 6) ? levels[slot.level - 1] : '?';
+        out[length++] = ':';
+        out[length++] = ' ';
+        length += formatLogRecord((const char *)(uintptr_t)formatAddress, slot.data + CrashLogBinaryHeader,
+                                  slot.length - CrashLogBinaryHeader,
+                                  out + length, outSize - length - 1);
+    }
+    else
+    {
+        size_t text = min((size_t)slot.length, outSize - length - 2);
+        memcpy(out + length, slot.data, text);
+        length += text;
+    }
+
+    out[length++] = '\n';
+    return length;
+}
+
+// Binary records point at their format string, so they can only be formatted by the
+// image that wrote them
+static void recoverTail(bool sameBuild)
+{
+    // Oldest first; the slots hold the most recent sequence numbers, so the order is
+    // the sequence order
+    int order[CrashLogSlots];
+    int count = 0;
+    for (int i = 0; i < CrashLogSlots; i++)
+    {
+        const crashLogSlot_t &slot = crashTail.slots[i];
+        if (slot.sequence == 0 || slot.length > sizeof(slot.data) || (slot.kind == LogRecordBinary && !sameBuild))
+            continue;
+
+        int position = count++;
+        while (position > 0 && crashTail.slots[order[position - 1]].sequence > slot.sequence)
+        {
+            order[position] = order[position - 1];
+            position--;
+        }
+        order[position] = i;
+    }
+
+    if (count == 0)
+        return;
+
+    recovered = (uint8_t *)malloc(CrashLogHeaderRoom + count * (CrashLogLineMax + CrashLogTagMax));
+    if (recovered == nullptr)
+        return;
+
+    char *lines = (char *)recovered + CrashLogHeaderRoom;
+    for (int i = 0; i < count; i++)
+    {
+        recoveredLength += formatRecoveredSlot(crashTail.slots[order[i]], lines + recoveredLength,
+                                               CrashLogLineMax + CrashLogTagMax);
+    }
+    recoveredLines = count;
+}
+
+void setupCrashLog()
+{
+    esp_reset_reason_t reason = esp_reset_reason();
+    resetReasonName = describeResetReason(reason);
+
+    // RTC memory holds noise after a power cycle
+    uint32_t buildId = currentBuildId();
+    if (crashTail.magic == CrashLogMagic && reason != ESP_RST_POWERON)
+    {
+        recoverTail(crashTail.buildId == buildId);
+    }
+
+    memset(&crashTail, 0, sizeof(crashTail));
+    crashTail.magic = CrashLogMagic;
+    crashTail.buildId = buildId;
+}
+
+uint8_t *getRecoveredCrashLog(size_t &length, uint32_t &lines)
+{
+    if (recovered == nullptr)
+        return nullptr;
+
+    length = recoveredLength;
+    lines = recoveredLines;
+    return recovered + CrashLogHeaderRoom;
+}
+
+void releaseRecoveredCrashLog()
+{
+    free(recovered);
+    recovered = nullptr;
+    recoveredLength = 0;
+    recoveredLines = 0;
+}
+
+const char *getResetReasonName()
+{
+    return resetReasonName;
+}
@@ -0,0 +1,262 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <esp_heap_caps.h>
+#include "forecast_diagnostics.h"
+#include "forecast_nats.h"
+#include "forecast_preferences.h"
+#include "forecast_scheduler.h"
+#include "forecast_stall.h"
+#include "forecast_logging.h"
+#include "forecast_connectivity.h"
+
+// Snapshots are written straight into the reply buffer with snprintf rather than built
+// as a JsonDocument, so taking one does not move the heap numbers it reports
+static String deviceId;
+
+struct diagnosticsWriter_t
+{
+    char *out;
+    size_t size;
+    size_t length;
+    bool full;
+};
+
+static void append(diagnosticsWriter_t &writer, const char *format, ...)
+{
+    if (writer.full)
+        return;
+
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(writer.out + writer.length, writer.size - writer.length, format, args);
+    va_end(args);
+
+    if (written < 0 || (size_t)written >= writer.size - writer.length)
+        writer.full = true;
+    else
+        writer.length += written;
+}
+
+// Names come from task and job tables, but are quoted safely all the same
+static void appendString(diagnosticsWriter_t &writer, const char *text)
+{
+    append(writer, "\"");
+    for (const char *c = text; *c != 0; c++)
+    {
+        if (*c == '"' || *c == '\\')
+            append(writer, "\\%c", *c);
+        else if ((uint8_t)*c < 0x20)
+            append(writer, "\\u%04x", *c);
+        else
+            append(writer, "%c", *c);
+    }
+    append(writer, "\"");
+}
+
+static bool sectionWanted(const char *sections, size_t sectionsLength, const char *name)
+{
+    if (sectionsLength == 0)
+        return true;
+
+    size_t nameLength = strlen(name);
+    size_t start = 0;
+    while (start < sectionsLength)
+    {
+        size_t end = start;
+        while (end < sectionsLength && sections[end] != ' ' && sections[end] != ',')
+            end++;
+
+        if (end - start == nameLength && strncmp(sections + start, name, nameLength) == 0)
+            return true;
+        start = end + 1;
+    }
+
+    return false;
+}
+
+static void writeHeap(diagnosticsWriter_t &writer)
+{
+    append(writer, ",\"heap\":{\"free\":%u,\"min\":%u,\"largest\":%u}",
+           (unsigned)heap_caps_get_free_size(MALLOC_CAP_DEFAULT),
+           (unsigned)heap_caps_get_minimum_free_size(MALLOC_CAP_DEFAULT),
+           (unsigned)heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT));
+}
+
+// [name, priority, stack high-water mark in bytes]
+static void writeTasks(diagnosticsWriter_t &writer)
+{
+#if configUSE_TRACE_FACILITY
+    UBaseType_t count = uxTaskGetNumberOfTasks() + 2;
+    TaskStatus_t *tasks = (TaskStatus_t *)malloc(count * sizeof(TaskStatus_t));
+    if (tasks == nullptr)
+        return;
+
+    count = uxTaskGetSystemState(tasks, count, nullptr);
+    append(writer, ",\"tasks\":[");
+    for (UBaseType_t i = 0; i < count; i++)
+    {
+        append(writer, i == 0 ? "[" : ",[");
+        appendString(writer, tasks[i].pcTaskName);
+        append(writer, ",%u,%u]", (unsigned)tasks[i].uxCurrentPriority, (unsigned)tasks[i].usStackHighWaterMark);
+    }
+    append(writer, "]");
+    free(tasks);
+#endif
+}
+
+// Jobs as [name, runs, missed deadlines, average µs, max µs], then the stall monitor's
+// heartbeat ages as [name, ms]
+static void writeJobs(diagnosticsWriter_t &writer)
+{
+    append(writer, ",\"jobs\":[");
+    bool first = true;
+    int count = getJobCount();
+    for (int i = 0; i < count; i++)
+    {
+        jobStats_t stats;
+        if (!getJobStats(i, stats))
+            continue;
+
+        append(writer, first ? "[" : ",[");
+        appendString(writer, stats.name);
+        append(writer, ",%u,%u,%u,%u]", (unsigned)stats.runs, (unsigned)stats.missedDeadlines,
+               (unsigned)stats.averageDurationUs, (unsigned)stats.maxDurationUs);
+        first = false;
+    }
+
+    append(writer, "],\"heartbeats\":[");
+    first = true;
+    for (int i = 0; i < MaxStallWatches; i++)
+    {
+        const char *name;
+        int32_t age = getHeartbeatAge(i, &name);
+        if (age < 0)
+            continue;
+
+        append(writer, first ? "[" : ",[");
+        appendString(writer, name);
+        append(writer, ",%d]", (int)age);
+        first = false;
+    }
+    append(writer, "]");
+}
+
+static void writeWifi(diagnosticsWriter_t &writer)
+{
+    append(writer, ",\"wifi\":{\"rssi\":%d,\"channel\":%d,\"ip\":\"%s\"}", (int)WiFi.RSSI(), (int)WiFi.channel(),
+           WiFi.localIP().toString().c_str());
+}
+
+// Reports as [sequence, uptime s, duration ms, task, job, site, [backtrace]]
+static void writeStalls(diagnosticsWriter_t &writer)
+{
+    stallStats_t stats = getStallStats();
+    append(writer, ",\"stalls\":{\"count\":%u,\"totalMs\":%u,\"maxMs\":%u,\"reports\":[", (unsigned)stats.stalls,
+           (unsigned)stats.totalStallMs, (unsigned)stats.maxStallMs);
+
+    stallReport_t reports[MaxStallReports];
+    int count = getStallReports(reports, MaxStallReports);
+    for (int i = 0; i < count; i++)
+    {
+        const stallReport_t &report = reports[i];
+        append(writer, "%s[%u,%u,%u,", i == 0 ? "" : ",", (unsigned)report.sequence, (unsigned)report.uptimeSeconds,
+               (unsigned)report.durationMs);
+        appendString(writer, report.task);
+        append(writer, ",");
+        appendString(writer, report.job);
+        append(writer, ",");
+        appendString(writer, report.site);
+        append(writer, ",[");
+        for (int frame = 0; frame < report.depth; frame++)
+            append(writer, frame == 0 ? "%u" : ",%u", (unsigned)report.backtrace[frame]);
+        append(writer, "]]");
+    }
+    append(writer, "]}");
+}
+
+static void writeNats(diagnosticsWriter_t &writer)
+{
+    natsStats_t stats = getNatsStats();
+    append(writer, ",\"nats\":{\"upMs\":%u,\"connectedMs\":%u,\"connects\":%u,\"failed\":%u,\"disconnects\":%u,"
+                   "\"sent\":%u,\"dropped\":%u,\"requests\":%u}",
+           (unsigned)stats.uptimeMs, (unsigned)stats.connectedMs, (unsigned)stats.connects,
+           (unsigned)stats.failedAttempts, (unsigned)stats.disconnects, (unsigned)stats.sentMessages,
+           (unsigned)stats.droppedMessages, (unsigned)stats.requests);
+}
+
+// Links as [name, up, drops, reconnects, last, average and max time to reconnect in ms,
+// down for ms]
+static void writeLinks(diagnosticsWriter_t &writer)
+{
+    append(writer, ",\"links\":[");
+    for (int link = 0; link < LINK_COUNT; link++)
+    {
+        linkStats_t stats = getLinkStats((link_t)link);
+        append(writer, link == 0 ? "[" : ",[");
+        appendString(writer, getLinkName((link_t)link));
+        append(writer, ",%d,%u,%u,%u,%u,%u,%u]", stats.up ? 1 : 0, (unsigned)stats.drops, (unsigned)stats.reconnects,
+               (unsigned)stats.lastReconnectMs, (unsigned)stats.averageReconnectMs, (unsigned)stats.maxReconnectMs,
+               (unsigned)stats.downForMs);
+    }
+    append(writer, "]");
+}
+
+static void writeLog(diagnosticsWriter_t &writer)
+{
+    logStats_t stats = getLogStats();
+    append(writer, ",\"log\":{\"shipped\":%u,\"dropped\":%u,\"unstaged\":%u,\"unpublished\":%u,\"serialDropped\":%u,"
+                   "\"highWater\":%u}",
+           (unsigned)stats.shippedLines, (unsigned)stats.droppedLines, (unsigned)stats.unstagedLines,
+           (unsigned)stats.unpublishedLines, (unsigned)stats.serialDroppedBytes, (unsigned)stats.highWaterBytes);
+}
+
+size_t writeDiagnostics(const char *sections, size_t sectionsLength, char *out, size_t outSize)
+{
+    diagnosticsWriter_t writer = {out, outSize, 0, false};
+
+    append(writer, "{\"id\":");
+    appendString(writer, deviceId.c_str());
+    append(writer, ",\"uptime\":%u", (unsigned)(millis() / 1000));
+
+    if (sectionWanted(sections, sectionsLength, "heap"))
+        writeHeap(writer);
+    if (sectionWanted(sections, sectionsLength, "tasks"))
+        writeTasks(writer);
+    if (sectionWanted(sections, sectionsLength, "jobs"))
+        writeJobs(writer);
+    if (sectionWanted(sections, sectionsLength, "wifi"))
+        writeWifi(writer);
+    if (sectionWanted(sections, sectionsLength, "stalls"))
+        writeStalls(writer);
+    if (sectionWanted(sections, sectionsLength, "nats"))
+        writeNats(writer);
+    if (sectionWanted(sections, sectionsLength, "links"))
+        writeLinks(writer);
+    if (sectionWanted(sections, sectionsLength, "log"))
+        writeLog(writer);
+
+    append(writer, "}");
+    return writer.full ? 0 : writer.length;
+}
+
+static size_t answerDiagnostics(const uint8_t *request, size_t length, char *reply, size_t replySize)
+{
+    size_t replyLength = writeDiagnostics((const char *)request, length, reply, replySize);
+    if (replyLength == 0)
+        replyLength = snprintf(reply, replySize, "{\"id\":\"%s\",\"error\":\"snapshot too large, ask for fewer sections\"}",
+                               deviceId.c_str());
+    return replyLength;
+}
+
+void setupDiagnostics()
+{
+    deviceId = getDeviceIdentifier();
+    String deviceSubject = "aura2.diag." + deviceId;
+    if (!respondNats("aura2.diag", answerDiagnostics) || !respondNats(deviceSubject.c_str(), answerDiagnostics))
+    {
+        LOG_ERROR(LOG_NATS, "Diagnostics subjects could not be registered");
+        return;
+    }
+
+    LOG_INFO(LOG_NATS, "Diagnostics answering on aura2.diag and %s", deviceSubject.c_str());
+}
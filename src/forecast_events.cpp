@@ -0,0 +1,20 @@
+#include <Arduino.h>
+#include "forecast_events.h"
+#include "forecast_loop.h"
+
+EventBus eventBus;
+EventBus::Mailbox uiMailbox(wakeMainLoop);
+
+void publishSettingChanged(setting_t setting)
+{
+    eventData_t data = {};
+    data.setting = setting;
+    eventBus.publish(EVENT_SETTING_CHANGED, data);
+}
+
+void publishNetworkChanged(bool up)
+{
+    eventData_t data = {};
+    data.up = up;
+    eventBus.publish(EVENT_NETWORK_CHANGED, data);
+}
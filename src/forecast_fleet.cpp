@@ -0,0 +1,349 @@
+#include <Arduino.h>
+#include <time.h>
+#include <esp_timer.h>
+#include <esp_system.h>
+#include "forecast_fleet.h"
+#include "forecast_mqtt.h"
+#include "forecast_connectivity.h"
+#include "forecast_events.h"
+#include "forecast_preferences.h"
+#include "forecast_scheduler.h"
+#include "forecast_logging.h"
+
+// Handlers are routed for every location, but the broker is only asked for this device's
+// location, and only while fleet weather is on
+static const char *const FleetTopicPrefix = "aura/fleet/weather/";
+static const char *const FleetLeasePattern = "aura/fleet/weather/+/lease";
+static const char *const FleetForecastPattern = "aura/fleet/weather/+/forecast";
+
+// Lease times are Unix times, so nothing is judged until SNTP has set the clock
+static const time_t FleetClockValidAfter = 1600000000;
+
+static String deviceId;
+static int weatherJob = -1;
+static int leaseSubscription = -1;
+static int forecastSubscription = -1;
+
+// A claim waiting out its jitter; only the weather job, on its background task, touches these
+static esp_timer_handle_t claimTimer = nullptr;
+static uint32_t claimDueMs = 0;
+
+// The lease and location are read by the MQTT task's handlers and the weather job
+static portMUX_TYPE fleetMux = portMUX_INITIALIZER_UNLOCKED;
+static ForecastLease lease(FleetLeaseSeconds);
+static char locationKey[32];
+static forecast_t sharedForecast;
+static bool sharedPending = false;
+static bool subscribed = false;
+
+static volatile uint32_t claims = 0;
+static volatile uint32_t sharedForecasts = 0;
+static volatile uint32_t receivedForecasts = 0;
+static volatile uint32_t skippedFetches = 0;
+
+static uint32_t fleetNow()
+{
+    time_t now = time(nullptr);
+    return now > FleetClockValidAfter ? (uint32_t)now : 0;
+}
+
+// Without the broker or the clock the lease cannot be judged, so the device fetches for
+// itself and shares nothing
+static bool fleetActive()
+{
+    return use_fleet_weather && use_mqtt && getLinkStats(LINK_MQTT).up && fleetNow() != 0;
+}
+
+static void fleetTopic(char *topic, size_t size, const char *kind)
+{
+    char key[sizeof(locationKey)];
+    portENTER_CRITICAL(&fleetMux);
+    memcpy(key, locationKey, sizeof(key));
+    portEXIT_CRITICAL(&fleetMux);
+
+    snprintf(topic, size, "%s%s/%s", FleetTopicPrefix, key, kind);
+}
+
+// Follows the location and the setting. A new location starts with no known lease until its
+// retained one arrives on the new subscription.
+static void updateLocation()
+{
+    char key[sizeof(locationKey)];
+    snprintf(key, sizeof(key), "%.2f,%.2f", weather_latitude, weather_longitude);
+    bool enabled = use_fleet_weather;
+
+    portENTER_CRITICAL(&fleetMux);
+    bool changed = strcmp(key, locationKey) != 0;
+    if (changed)
+    {
+        memcpy(locationKey, key, sizeof(locationKey));
+        lease.clear();
+        sharedPending = false;
+    }
+    bool resubscribe = changed || enabled != subscribed;
+    subscribed = enabled;
+    portEXIT_CRITICAL(&fleetMux);
+
+    if (!resubscribe)
+        return;
+
+    char topic[MqttTopicMax] = "";
+    if (enabled)
+        fleetTopic(topic, sizeof(topic), "lease");
+    setMqttSubscription(leaseSubscription, topic);
+    if (enabled)
+        fleetTopic(topic, sizeof(topic), "forecast");
+    setMqttSubscription(forecastSubscription, topic);
+}
+
+// True if the topic's location level is this device's location
+static bool forThisLocation(std::string_view topic)
+{
+    size_t prefixLength = strlen(FleetTopicPrefix);
+    size_t end = topic.rfind('/');
+    if (topic.size() <= prefixLength || end == std::string_view::npos || end <= prefixLength)
+        return false;
+
+    std::string_view key = topic.substr(prefixLength, end - prefixLength);
+    portENTER_CRITICAL(&fleetMux);
+    bool matches = key.size() == strlen(locationKey) && key.compare(locationKey) == 0;
+    portEXIT_CRITICAL(&fleetMux);
+    return matches;
+}
+
+// Runs on the MQTT task
+static void handleLease(std::string_view topic, const uint8_t *payload, size_t length)
+{
+    if (!forThisLocation(topic))
+        return;
+
+    // Parsed outside the lock, then adopted whole
+    ForecastLease observed(FleetLeaseSeconds);
+    observed.setSelf(deviceId.c_str());
+    if (!observed.observe((const char *)payload, length))
+    {
+        LOG_WARNING(LOG_WEATHER, "Ignoring a malformed fleet lease (%d bytes)", length);
+        return;
+    }
+
+    portENTER_CRITICAL(&fleetMux);
+    lease = observed;
+    portEXIT_CRITICAL(&fleetMux);
+
+    LOG_TRACE(LOG_WEATHER, "Fleet lease held by %s until %d", observed.holder()[0] != 0 ? observed.holder() : "nobody",
+              observed.expiresAt());
+}
+
+// Runs on the MQTT task; the weather job hands the forecast on to the loop task
+static void handleForecast(std::string_view topic, const uint8_t *payload, size_t length)
+{
+    if (!use_fleet_weather || !forThisLocation(topic))
+        return;
+
+    forecast_t forecast;
+    char publisher[ForecastPublisherMax + 1];
+    if (!decodeForecast(payload, length, forecast, publisher, sizeof(publisher)))
+    {
+        LOG_WARNING(LOG_WEATHER, "Ignoring a malformed fleet forecast (%d bytes)", length);
+        return;
+    }
+
+    // Our own retained forecast comes back on every connect
+    if (strcmp(publisher, deviceId.c_str()) == 0)
+        return;
+
+    portENTER_CRITICAL(&fleetMux);
+    sharedForecast = forecast;
+    sharedPending = true;
+    portEXIT_CRITICAL(&fleetMux);
+    receivedForecasts++;
+
+    LOG_TRACE(LOG_WEATHER, "Fleet forecast from %s, fetched at %d", publisher, forecast.fetchedAt);
+
+    if (weatherJob < 0)
+        weatherJob = findJob("weather");
+    runJobNow(weatherJob);
+}
+
+// Runs on the web server's task
+static void fleetSettingChanged(event_t event, const eventData_t &data)
+{
+    if (data.setting == SETTING_FLEET_WEATHER || data.setting == SETTING_LOCATION)
+        updateLocation();
+}
+
+// Runs on the esp_timer task
+static void claimDue(void *argument)
+{
+    if (weatherJob < 0)
+        weatherJob = findJob("weather");
+    runJobNow(weatherJob);
+}
+
+void setupFleetWeather()
+{
+    deviceId = getDeviceIdentifier();
+    lease.setSelf(deviceId.c_str());
+
+    leaseSubscription = subscribeMqtt(FleetLeasePattern, handleLease);
+    forecastSubscription = subscribeMqtt(FleetForecastPattern, handleForecast);
+    if (leaseSubscription < 0 || forecastSubscription < 0)
+    {
+        LOG_ERROR(LOG_WEATHER, "Fleet weather topics could not be subscribed");
+    }
+
+    esp_timer_create_args_t timerArgs = {};
+    timerArgs.callback = claimDue;
+    timerArgs.name = "fleet_claim";
+    esp_timer_create(&timerArgs, &claimTimer);
+
+    eventBus.subscribe(EVENT_SETTING_CHANGED, fleetSettingChanged);
+    updateLocation();
+}
+
+// Starts the wait before a claim; false while it has not run out
+static bool claimWaitOver()
+{
+    uint32_t nowMs = millis();
+    if (claimDueMs == 0)
+    {
+        uint32_t delayMs = 1 + esp_random() % FleetClaimJitterMs;
+        claimDueMs = (nowMs + delayMs) | 1;
+        esp_timer_stop(claimTimer);
+        esp_timer_start_once(claimTimer, (uint64_t)delayMs * 1000);
+        LOG_TRACE(LOG_WEATHER, "No fleet lease; claiming in %d ms unless another device does", delayMs);
+        return false;
+    }
+
+    // The job also runs early, e.g. for a shared forecast
+    if ((int32_t)(nowMs - claimDueMs) < 0)
+        return false;
+
+    claimDueMs = 0;
+    return true;
+}
+
+bool fleetShouldFetch()
+{
+    updateLocation();
+    if (!fleetActive())
+        return true;
+
+    uint32_t now = fleetNow();
+    portENTER_CRITICAL(&fleetMux);
+    ForecastLease current = lease;
+    portEXIT_CRITICAL(&fleetMux);
+
+    if (!current.shouldFetch(now))
+    {
+        claimDueMs = 0;
+        skippedFetches++;
+        LOG_TRACE(LOG_WEATHER, "Leaving the fetch to %s until %d", current.holder(), current.expiresAt());
+        return false;
+    }
+
+    if (current.held(now))
+        return true;
+
+    // Nobody holds a valid lease. After the jitter, if still nobody does, claim it and
+    // fetch. Should another device claim within the same moment, the claim the broker
+    // delivers last wins for everyone.
+    if (!claimWaitOver())
+    {
+        skippedFetches++;
+        return false;
+    }
+
+    char payload[ForecastLease::MaxHolderLength + 16];
+    size_t length = current.claim(now, payload, sizeof(payload));
+    char topic[MqttTopicMax];
+    fleetTopic(topic, sizeof(topic), "lease");
+    if (length > 0 && queueMqttPublish(topic, payload, length, true))
+    {
+        portENTER_CRITICAL(&fleetMux);
+        lease = current;
+        portEXIT_CRITICAL(&fleetMux);
+        claims++;
+        LOG_INFO(LOG_WEATHER, "Claimed the fleet weather lease on %s", topic);
+    }
+
+    return true;
+}
+
+void shareForecast(const forecast_t &forecast)
+{
+    if (!fleetActive())
+        return;
+
+    uint32_t now = fleetNow();
+    portENTER_CRITICAL(&fleetMux);
+    ForecastLease current = lease;
+    portEXIT_CRITICAL(&fleetMux);
+
+    // Another device's claim arrived during the fetch; it publishes instead
+    if (!current.held(now))
+        return;
+
+    uint8_t encoded[ForecastWireMax];
+    size_t encodedLength = encodeForecast(forecast, deviceId.c_str(), encoded, sizeof(encoded));
+
+    // Renewed only after a successful fetch, so a holder that cannot reach open-meteo
+    // loses the lease when it runs out
+    char payload[ForecastLease::MaxHolderLength + 16];
+    size_t length = current.claim(now, payload, sizeof(payload));
+
+    char topic[MqttTopicMax];
+    fleetTopic(topic, sizeof(topic), "lease");
+    bool queued = length > 0 && queueMqttPublish(topic, payload, length, true);
+    fleetTopic(topic, sizeof(topic), "forecast");
+    queued = queued && encodedLength > 0 && queueMqttPublish(topic, (const char *)encoded, encodedLength, true);
+
+    if (queued)
+    {
+        portENTER_CRITICAL(&fleetMux);
+        lease = current;
+        portEXIT_CRITICAL(&fleetMux);
+        sharedForecasts++;
+    }
+}
+
+bool takeSharedForecast(forecast_t &forecast)
+{
+    if (!use_fleet_weather)
+        return false;
+
+    portENTER_CRITICAL(&fleetMux);
+    bool pending = sharedPending;
+    if (pending)
+        forecast = sharedForecast;
+    sharedPending = false;
+    portEXIT_CRITICAL(&fleetMux);
+    return pending;
+}
+
+fleetStats_t getFleetStats()
+{
+    fleetStats_t stats;
+    uint32_t now = fleetNow();
+    portENTER_CRITICAL(&fleetMux);
+    stats.holder = now != 0 && lease.held(now);
+    stats.leaseExpiresAt = lease.expiresAt();
+    portEXIT_CRITICAL(&fleetMux);
+
+    stats.claims = claims;
+    stats.shared = sharedForecasts;
+    stats.received = receivedForecasts;
+    stats.skippedFetches = skippedFetches;
+    return stats;
+}
+
+void logFleetStats(lv_timer_t *timer)
+{
+    if (!use_fleet_weather)
+        return;
+
+    fleetStats_t stats = getFleetStats();
+    LOG_INFO(LOG_WEATHER, "Fleet weather: %s, lease until %d; %d claims, %d shared, %d received, %d fetches skipped",
+             stats.holder ? "fetching" : "following", stats.leaseExpiresAt, stats.claims, stats.shared, stats.received,
+             stats.skippedFetches);
+}
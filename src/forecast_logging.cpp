@@ -0,0 +1,725 @@
+#include <Arduino.h>
+#include <ArduinoLog.h>
+#include <atomic>
+#include <esp_timer.h>
+#include "LogRingBuffer.h"
+#include "forecast_logging.h"
+#include "forecast_crashlog.h"
+#include "forecast_nats.h"
+#include "forecast_stall.h"
+#include "forecast_preferences.h"
+
+// Text records end with '\n' and a terminating NUL, so the logger hands the line to
+// Serial and NATS straight out of the ring
+alignas(4) static uint8_t logStorage[LogRingSize];
+static LogRingBuffer logRing(logStorage, LogRingSize);
+
+struct logStaging_t
+{
+    TaskHandle_t task; // Owner while a line is in progress, nullptr when free
+    uint16_t length;
+    uint32_t sequence; // Taken, with the time, when the line's first character arrives
+    int64_t startedUs;
+    char line[LogStagingLineMax];
+};
+
+static logStaging_t staging[LogStagingSlots];
+static volatile int lastStagingSlot = 0;
+static portMUX_TYPE stagingMux = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t loggerTaskHandle = nullptr;
+static volatile uint32_t splitLines = 0;
+static volatile uint32_t unstagedBytes = 0;
+static volatile uint32_t unstagedLines = 0;
+static volatile uint32_t unpublishedLines = 0;
+static volatile uint32_t serialDroppedBytes = 0;
+
+// Numbers every record in call order, dropped ones included, so the host can spot gaps.
+// The boot ID tells the host when the numbering has started over.
+static std::atomic<uint32_t> nextSequence(1);
+static uint32_t bootId = 0;
+
+static const uint8_t LogBinaryWireVersion = 2;
+
+bool use_binary_logging = false;
+
+// Touch logs per sample, so it stays quiet unless asked
+uint8_t logLevels[LOG_CATEGORY_COUNT] = {
+    LOG_LEVEL_INFO,    // system
+    LOG_LEVEL_INFO,    // weather
+    LOG_LEVEL_INFO,    // mqtt
+    LOG_LEVEL_INFO,    // settings
+    LOG_LEVEL_INFO,    // lvgl
+    LOG_LEVEL_WARNING, // touch
+    LOG_LEVEL_INFO,    // power
+    LOG_LEVEL_INFO,    // jobs
+    LOG_LEVEL_INFO,    // nats
+};
+
+static const char *const categoryNames[LOG_CATEGORY_COUNT] = {
+    "system", "weather", "mqtt", "settings", "lvgl", "touch", "power", "jobs", "nats"};
+
+static const char *const levelNames[] = {
+    "silent", "fatal", "error", "warning", "info", "trace", "verbose"};
+
+// Lines bound for NATS are gathered into one payload per format. Text batches start with
+// a "#batch <time> <lines> <boot ID> <dropped> <uptime µs>" line followed by the lines;
+// binary batches start with "AL", a version byte and the same five fields, followed by
+// length-prefixed records. The header is written into the reserved space in front of the
+// lines once the batch is complete, so the whole frame goes out in one publish without
+// another copy. The crash tail recovered at boot still goes out under the short
+// "#batch <time> <lines>" header.
+static const uint32_t LogBatchHeaderMax = 64;
+
+struct logBatch_t
+{
+    bool binary;
+    uint32_t length;
+    uint32_t lines;
+    uint32_t startedMs;
+    uint8_t data[LogBatchHeaderMax + LogBatchMaxBytes];
+};
+
+static logBatch_t textBatch = {false};
+static logBatch_t binaryBatch = {true};
+static volatile uint32_t shippedLines = 0;
+static volatile uint32_t publishedBatches = 0;
+static volatile uint32_t textWireBytes = 0;
+static volatile uint32_t textWireLines = 0;
+static volatile uint32_t binaryWireBytes = 0;
+static volatile uint32_t binaryWireLines = 0;
+static volatile uint32_t textCallCycles = 0;
+static volatile uint32_t binaryCallCycles = 0;
+
+static void writeRecordHeader(uint8_t *record, uint8_t kind, uint8_t level, uint32_t sequence, int64_t timeUs)
+{
+    record[0] = kind;
+    record[1] = level;
+    memcpy(record + 2, &sequence, 4);
+    memcpy(record + 6, &timeUs, 8);
+}
+
+static void notifyLogger()
+{
+    if (loggerTaskHandle != nullptr)
+        xTaskNotifyGive(loggerTaskHandle);
+}
+
+class RingLogPrint : public Print
+{
+public:
+    virtual size_t write(uint8_t ch) override
+    {
+        if (ch == '\r')
+            return 1; // ignore CR, handle LF only
+
+        logStaging_t *slot = stagingFor(xTaskGetCurrentTaskHandle(), ch != '\n');
+
+        if (ch == '\n')
+        {
+            if (slot != nullptr)
+            {
+                commitLine(*slot);
+                slot->task = nullptr;
+            }
+            else
+            {
+                // Still uses up a sequence number, so the loss shows up on the host
+                unstagedLines++;
+                nextSequence.fetch_add(1, std::memory_order_relaxed);
+            }
+            return 1;
+        }
+
+        if (slot == nullptr)
+        {
+            unstagedBytes++;
+            return 1;
+        }
+
+        // Leave room for the '\n' and NUL; ship what we have and keep going
+        if (slot->length >= LogStagingLineMax - 2)
+        {
+            commitLine(*slot);
+            splitLines++;
+        }
+
+        if (slot->length == 0)
+        {
+            slot->sequence = nextSequence.fetch_add(1, std::memory_order_relaxed);
+            slot->startedUs = esp_timer_get_time();
+        }
+
+        slot->line[slot->length++] = static_cast<char>(ch);
+        return 1;
+    }
+
+    virtual size_t write(const uint8_t *buf, size_t size) override
+    {
+        for (size_t i = 0; i < size; ++i)
+        {
+            write(buf[i]);
+        }
+        return size;
+    }
+
+private:
+    // Each task writes its own slot, so only claiming a free one needs the lock
+    static logStaging_t *stagingFor(TaskHandle_t task, bool allocate)
+    {
+        int cached = lastStagingSlot;
+        if (staging[cached].task == task)
+            return &staging[cached];
+
+        for (int i = 0; i < LogStagingSlots; i++)
+        {
+            if (staging[i].task == task)
+            {
+                lastStagingSlot = i;
+                return &staging[i];
+            }
+        }
+
+        if (!allocate)
+            return nullptr;
+
+        logStaging_t *slot = nullptr;
+        portENTER_CRITICAL(&stagingMux);
+        for (int i = 0; i < LogStagingSlots; i++)
+        {
+            if (staging[i].task == nullptr)
+            {
+                staging[i].task = task;
+                staging[i].length = 0;
+                lastStagingSlot = i;
+                slot = &staging[i];
+                break;
+            }
+        }
+        portEXIT_CRITICAL(&stagingMux);
+
+        return slot;
+    }
+
+    static void commitLine(logStaging_t &slot)
+    {
+        if (slot.length == 0)
+            return;
+
+        mirrorToCrashLog(LogRecordText, 0, slot.sequence, (const uint8_t *)slot.line, slot.length);
+
+        uint32_t textLength = slot.length;
+        uint32_t length = LogRecordHeaderSize + textLength + 2;
+        uint8_t *record = logRing.reserve(length);
+        slot.length = 0;
+
+        // Dropped lines are counted by the ring
+        if (record == nullptr)
+            return;
+
+        // ArduinoLog has already put the level in the text
+        writeRecordHeader(record, LogRecordText, 0, slot.sequence, slot.startedUs);
+        memcpy(record + LogRecordHeaderSize, slot.line, textLength);
+        record[length - 2] = '\n';
+        record[length - 1] = '\0';
+        logRing.commit(record, length);
+        notifyLogger();
+    }
+};
+
+static RingLogPrint ringPrinter;
+
+void logBinaryRecord(int level, uint32_t formatId, const char *format, const uint8_t *args, size_t argsLength)
+{
+    uint32_t sequence = nextSequence.fetch_add(1, std::memory_order_relaxed);
+    int64_t timeUs = esp_timer_get_time();
+
+    uint8_t body[8];
+    uint32_t formatAddress = (uint32_t)(uintptr_t)format;
+    memcpy(body, &formatId, 4);
+    memcpy(body + 4, &formatAddress, 4);
+    mirrorToCrashLog(LogRecordBinary, (uint8_t)level, sequence, body, sizeof(body), args, argsLength);
+
+    uint32_t length = LogBinaryHeaderSize + argsLength;
+    uint8_t *record = logRing.reserve(length);
+    if (record == nullptr)
+        return;
+
+    writeRecordHeader(record, LogRecordBinary, (uint8_t)level, sequence, timeUs);
+    memcpy(record + LogRecordHeaderSize, body, sizeof(body));
+    memcpy(record + LogBinaryHeaderSize, args, argsLength);
+    logRing.commit(record, length);
+    notifyLogger();
+}
+
+void recordLogCallCycles(bool binary, uint32_t cycles)
+{
+    volatile uint32_t &average = binary ? binaryCallCycles : textCallCycles;
+    average = (average == 0) ? cycles : average - (average >> 3) + (cycles >> 3);
+}
+
+static void flushBatch(logBatch_t &batch)
+{
+    if (batch.lines == 0)
+        return;
+
+    // Besides the wall clock time, which is only right once NTP has synced, the header
+    // carries the boot ID, the running count of dropped records and the uptime in µs to
+    // measure each record's latency against
+    uint8_t header[LogBatchHeaderMax];
+    uint32_t headerLength;
+    uint32_t now = (uint32_t)time(nullptr);
+    uint32_t dropped = getLogDroppedRecords();
+    int64_t uptimeUs = esp_timer_get_time();
+    if (batch.binary)
+    {
+        uint16_t lines = (uint16_t)batch.lines;
+        header[0] = 'A';
+        header[1] = 'L';
+        header[2] = LogBinaryWireVersion;
+        memcpy(header + 3, &now, 4);
+        memcpy(header + 7, &lines, 2);
+        memcpy(header + 9, &bootId, 4);
+        memcpy(header + 13, &dropped, 4);
+        memcpy(header + 17, &uptimeUs, 8);
+        headerLength = 25;
+    }
+    else
+    {
+        headerLength = snprintf((char *)header, sizeof(header), "#batch %lu %lu %08lx %lu %lld\n",
+                                (unsigned long)now, (unsigned long)batch.lines, (unsigned long)bootId,
+                                (unsigned long)dropped, (long long)uptimeUs);
+    }
+
+    uint8_t *frame = batch.data + LogBatchHeaderMax - headerLength;
+    memcpy(frame, header, headerLength);
+
+    // Lines logged while NATS is down are not kept
+    uint32_t frameLength = headerLength + batch.length;
+    if (publishLogBatch((const char *)frame, frameLength, batch.binary))
+    {
+        shippedLines += batch.lines;
+        publishedBatches++;
+        if (batch.binary)
+        {
+            binaryWireBytes += frameLength;
+            binaryWireLines += batch.lines;
+        }
+        else
+        {
+            textWireBytes += frameLength;
+            textWireLines += batch.lines;
+        }
+    }
+    else
+    {
+        unpublishedLines += batch.lines;
+    }
+
+    batch.length = 0;
+    batch.lines = 0;
+}
+
+// Reserves room for a line in a batch, flushing it first if the line would not fit
+static uint8_t *appendToBatch(logBatch_t &batch, uint32_t length)
+{
+    if (batch.length + length > LogBatchMaxBytes)
+        flushBatch(batch);
+
+    if (batch.lines == 0)
+        batch.startedMs = millis();
+
+    uint8_t *line = batch.data + LogBatchHeaderMax + batch.length;
+    batch.length += length;
+    batch.lines++;
+    return line;
+}
+
+static void finishLine(logBatch_t &batch)
+{
+    if (batch.length >= LogBatchFlushBytes)
+        flushBatch(batch);
+}
+
+// Serial's TX buffer drains in the background; never wait for room in it
+static void writeSerial(const uint8_t *data, size_t length)
+{
+    if ((size_t)Serial.availableForWrite() < length)
+    {
+        serialDroppedBytes += length;
+        return;
+    }
+
+    Serial.write(data, length);
+}
+
+// The recovered tail is written once at boot and may be larger than the TX buffer, so it
+// goes out a line at a time, waiting for room up to this long in all
+static const uint32_t CrashLogSerialWaitMs = 1000;
+
+static void writeSerialLines(const uint8_t *data, size_t length)
+{
+    uint32_t startedMs = millis();
+    size_t start = 0;
+    while (start < length)
+    {
+        const uint8_t *newline = (const uint8_t *)memchr(data + start, '\n', length - start);
+        size_t end = newline != nullptr ? newline - data + 1 : length;
+        while ((size_t)Serial.availableForWrite() < end - start && millis() - startedMs < CrashLogSerialWaitMs)
+            vTaskDelay(1);
+
+        writeSerial(data + start, end - start);
+        start = end;
+    }
+}
+
+// length includes the trailing NUL. On the wire each line is prefixed with its sequence
+// number and time: "<sequence> <µs> <line>".
+static void shipTextRecord(const uint8_t *record, uint32_t length)
+{
+    const uint8_t *text = record + LogRecordHeaderSize;
+    uint32_t textLength = length - LogRecordHeaderSize - 1;
+    writeSerial(text, textLength);
+
+    uint32_t sequence;
+    int64_t timeUs;
+    memcpy(&sequence, record + 2, 4);
+    memcpy(&timeUs, record + 6, 8);
+
+    char prefix[32];
+    int prefixLength = snprintf(prefix, sizeof(prefix), "%lu %lld ", (unsigned long)sequence, (long long)timeUs);
+    uint8_t *line = appendToBatch(textBatch, prefixLength + textLength);
+    memcpy(line, prefix, prefixLength);
+    memcpy(line + prefixLength, text, textLength);
+    finishLine(textBatch);
+}
+
+static void shipBinaryRecord(const uint8_t *record, uint32_t length)
+{
+    uint8_t level = record[1];
+    uint32_t formatAddress;
+    memcpy(&formatAddress, record + LogRecordHeaderSize + 4, 4);
+    const uint8_t *args = record + LogBinaryHeaderSize;
+    size_t argsLength = length - LogBinaryHeaderSize;
+
+    // Serial still gets the formatted line, now off the caller's time
+    static const char levels[] = "FEWITV";
+    char line[LogStagingLineMax];
+    line[0] = (level >= 1 && level <= 6) ? levels[level - 1] : '?';
+    line[1] = ':';
+    line[2] = ' ';
+    size_t lineLength = 3 + formatLogRecord((const char *)(uintptr_t)formatAddress, args, argsLength,
+                                            line + 3, sizeof(line) - 4);
+    line[lineLength++] = '\n';
+    writeSerial((const uint8_t *)line, lineLength);
+
+    // Wire record: length byte, then level, format ID, sequence number, time in µs and
+    // arguments
+    uint32_t wireLength = 1 + 17 + argsLength;
+    uint8_t *wire = appendToBatch(binaryBatch, wireLength);
+    wire[0] = (uint8_t)(wireLength - 1);
+    wire[1] = level;
+    memcpy(wire + 2, record + LogRecordHeaderSize, 4);
+    memcpy(wire + 6, record + 2, 12);
+    memcpy(wire + 18, args, argsLength);
+    finishLine(binaryBatch);
+}
+
+// Publishes the previous boot's tail ahead of this boot's batches, in batch-sized pieces
+// split at line ends; returns how long until the next attempt, or portMAX_DELAY once it
+// is gone
+static TickType_t shipRecoveredTail()
+{
+    static size_t shipped = 0;
+
+    size_t length;
+    uint32_t lines;
+    uint8_t *tail = getRecoveredCrashLog(length, lines);
+    if (tail == nullptr)
+        return portMAX_DELAY;
+
+    while (shipped < length)
+    {
+        size_t end = shipped;
+        uint32_t pieceLines = 0;
+        while (end < length)
+        {
+            const uint8_t *newline = (const uint8_t *)memchr(tail + end, '\n', length - end);
+            size_t next = newline != nullptr ? newline - tail + 1 : length;
+            if (pieceLines > 0 && next - shipped > LogBatchMaxBytes)
+                break;
+            end = next;
+            pieceLines++;
+        }
+
+        // The header goes over bytes already queued, or into the room left in front of the
+        // first piece
+        char header[CrashLogHeaderRoom];
+        uint32_t headerLength = snprintf(header, sizeof(header), "#batch %lu %lu\n",
+                                         (unsigned long)time(nullptr), (unsigned long)pieceLines);
+        uint8_t *frame = tail + shipped - headerLength;
+        memcpy(frame, header, headerLength);
+
+        if (!publishLogBatch((const char *)frame, headerLength + end - shipped, false))
+        {
+            if (millis() < CrashLogShipTimeoutMs)
+                return pdMS_TO_TICKS(CrashLogRetryMs);
+            break;
+        }
+
+        shippedLines += pieceLines;
+        publishedBatches++;
+        shipped = end;
+    }
+
+    releaseRecoveredCrashLog();
+    return portMAX_DELAY;
+}
+
+// Flushes batches whose oldest line has waited long enough; returns how long until the
+// next one is due
+static TickType_t flushAgedBatches()
+{
+    TickType_t wait = portMAX_DELAY;
+    uint32_t now = millis();
+
+    for (logBatch_t *batch : {&textBatch, &binaryBatch})
+    {
+        if (batch->lines == 0)
+            continue;
+
+        uint32_t age = now - batch->startedMs;
+        if (age >= LogBatchMaxDelayMs)
+        {
+            flushBatch(*batch);
+            continue;
+        }
+
+        TickType_t remaining = pdMS_TO_TICKS(LogBatchMaxDelayMs - age);
+        if (wait == portMAX_DELAY || remaining < wait)
+            wait = remaining;
+    }
+
+    return wait;
+}
+
+static void loggerTask(void *parameter)
+{
+    // The logger waits for lines indefinitely, so its heartbeat is informational only
+    registerStallWatch("logger", 0);
+
+    // The lines leading up to the last reset go out before anything from this boot
+    size_t tailLength;
+    uint32_t tailLines;
+    const uint8_t *tail = getRecoveredCrashLog(tailLength, tailLines);
+    if (tail != nullptr)
+    {
+        char header[64];
+        int headerLength = snprintf(header, sizeof(header), "Log tail from before the %s reset (%lu lines):\n",
+                                    getResetReasonName(), (unsigned long)tailLines);
+        writeSerial((const uint8_t *)header, min(headerLength, (int)sizeof(header) - 1));
+        writeSerialLines(tail, tailLength);
+    }
+    TickType_t tailRetry = (tail != nullptr) ? 0 : portMAX_DELAY;
+
+    while (true)
+    {
+        // Tried before this pass's lines, so it still goes out first once NATS is up
+        if (tailRetry != portMAX_DELAY)
+            tailRetry = shipRecoveredTail();
+
+        uint32_t length;
+        const uint8_t *record;
+        while ((record = logRing.peek(length)) != nullptr)
+        {
+            stallHeartbeat();
+
+            if (record[0] == LogRecordBinary)
+                shipBinaryRecord(record, length);
+            else
+                shipTextRecord(record, length);
+
+            logRing.release();
+        }
+
+        ulTaskNotifyTake(pdTRUE, min(flushAgedBatches(), tailRetry));
+    }
+}
+
+const char *getLogCategoryName(logCategory_t category)
+{
+    return (category >= 0 && category < LOG_CATEGORY_COUNT) ? categoryNames[category] : "?";
+}
+
+const char *getLogLevelName(int level)
+{
+    return (level >= LOG_LEVEL_SILENT && level <= LOG_LEVEL_VERBOSE) ? levelNames[level] : "?";
+}
+
+// Accepts a level name or its number; -1 if it is neither
+int parseLogLevel(const char *name)
+{
+    if (name == nullptr)
+        return -1;
+
+    for (int level = LOG_LEVEL_SILENT; level <= LOG_LEVEL_VERBOSE; level++)
+    {
+        if (strcasecmp(name, levelNames[level]) == 0)
+            return level;
+    }
+
+    if (name[0] >= '0' && name[0] <= '0' + LOG_LEVEL_VERBOSE && name[1] == 0)
+        return name[0] - '0';
+
+    return -1;
+}
+
+static void persistLogLevel(int category)
+{
+    char key[16];
+    snprintf(key, sizeof(key), "log_%s", categoryNames[category]);
+    preferences.putUChar(key, logLevels[category]);
+}
+
+bool setLogLevel(const char *category, int level)
+{
+    if (category == nullptr || level < LOG_LEVEL_SILENT || level > LOG_LEVEL_VERBOSE)
+        return false;
+
+    bool all = strcmp(category, "all") == 0;
+    bool found = false;
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++)
+    {
+        if (!all && strcmp(category, categoryNames[i]) != 0)
+            continue;
+
+        found = true;
+        if (logLevels[i] != level)
+        {
+            logLevels[i] = level;
+            persistLogLevel(i);
+        }
+    }
+
+    if (found)
+    {
+        LOG_INFO(LOG_SYSTEM, "Log level for %s set to %s", category, getLogLevelName(level));
+    }
+    return found;
+}
+
+bool applyLogLevels(JsonDocument &levels)
+{
+    bool valid = levels.is<JsonObject>();
+    if (valid)
+    {
+        for (JsonPair entry : levels.as<JsonObject>())
+        {
+            int level = entry.value().is<int>() ? entry.value().as<int>() : parseLogLevel(entry.value().as<const char *>());
+            valid &= setLogLevel(entry.key().c_str(), level);
+        }
+    }
+
+    levels.clear();
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++)
+    {
+        levels[categoryNames[i]] = levelNames[logLevels[i]];
+    }
+
+    return valid;
+}
+
+void setBinaryLogging(bool enabled)
+{
+    use_binary_logging = enabled;
+    preferences.putBool("log_binary", enabled);
+}
+
+bool isBinaryLogging()
+{
+    return use_binary_logging;
+}
+
+uint32_t getLogDroppedRecords()
+{
+    return logRing.droppedRecords() + unstagedLines + unpublishedLines;
+}
+
+logStats_t getLogStats()
+{
+    logStats_t stats;
+    stats.droppedLines = logRing.droppedRecords();
+    stats.splitLines = splitLines;
+    stats.unstagedBytes = unstagedBytes;
+    stats.unstagedLines = unstagedLines;
+    stats.unpublishedLines = unpublishedLines;
+    stats.serialDroppedBytes = serialDroppedBytes;
+    stats.shippedLines = shippedLines;
+    stats.publishedBatches = publishedBatches;
+    stats.textWireBytes = textWireBytes;
+    stats.textWireLines = textWireLines;
+    stats.binaryWireBytes = binaryWireBytes;
+    stats.binaryWireLines = binaryWireLines;
+    stats.textCallCycles = textCallCycles;
+    stats.binaryCallCycles = binaryCallCycles;
+    stats.highWaterBytes = logRing.highWaterBytes();
+    stats.capacityBytes = logRing.capacityBytes();
+    return stats;
+}
+
+void logLogStats(lv_timer_t *timer)
+{
+    static uint32_t lastRunMs = 0;
+    static uint32_t lastShippedLines = 0;
+    static uint32_t lastPublishedBatches = 0;
+
+    logStats_t stats = getLogStats();
+    uint32_t now = millis();
+    uint32_t elapsedMs = max(now - lastRunMs, (uint32_t)1);
+
+    // Rates cover the time since the previous run of this job
+    uint32_t linesPerSecond = (uint32_t)((uint64_t)(stats.shippedLines - lastShippedLines) * 1000 / elapsedMs);
+    uint32_t publishesPerMinute = (uint32_t)((uint64_t)(stats.publishedBatches - lastPublishedBatches) * 60000 / elapsedMs);
+    lastRunMs = now;
+    lastShippedLines = stats.shippedLines;
+    lastPublishedBatches = stats.publishedBatches;
+
+    LOG_INFO(LOG_SYSTEM, "Log ring: high water %d of %d bytes, dropped %d lines, split %d lines, unstaged %d lines (%d bytes), serial dropped %d bytes",
+             stats.highWaterBytes, stats.capacityBytes, stats.droppedLines, stats.splitLines, stats.unstagedLines,
+             stats.unstagedBytes, stats.serialDroppedBytes);
+    LOG_INFO(LOG_SYSTEM, "Log shipping: %d lines in %d batches, %d lines/s, %d publishes/min, %d lines unpublished",
+             stats.shippedLines, stats.publishedBatches, linesPerSecond, publishesPerMinute, stats.unpublishedLines);
+    LOG_INFO(LOG_SYSTEM, "Log formats: text %d bytes/line, %d cycles/call; binary %d bytes/line, %d cycles/call",
+             stats.textWireLines ? stats.textWireBytes / stats.textWireLines : 0, stats.textCallCycles,
+             stats.binaryWireLines ? stats.binaryWireBytes / stats.binaryWireLines : 0, stats.binaryCallCycles);
+}
+
+void setupLogging()
+{
+    // The TX buffer has to be sized before the UART driver is installed
+    Serial.setTxBufferSize(LogSerialTxBufferSize);
+    Serial.begin(LOG_SERIAL_BAUD);
+
+    setupCrashLog();
+    bootId = esp_random();
+
+    use_binary_logging = preferences.getBool("log_binary", use_binary_logging);
+
+    for (int i = 0; i < LOG_CATEGORY_COUNT; i++)
+    {
+        char key[16];
+        snprintf(key, sizeof(key), "log_%s", categoryNames[i]);
+        logLevels[i] = min(preferences.getUChar(key, logLevels[i]), (uint8_t)LOG_LEVEL_VERBOSE);
+    }
+
+    Log.begin(LOG_LEVEL_VERBOSE, &ringPrinter);
+
+    xTaskCreatePinnedToCore(
+        loggerTask,
+        "LoggerTask",
+        4096,
+        nullptr,
+        1,
+        &loggerTaskHandle,
+        1);
+}
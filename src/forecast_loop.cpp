@@ -0,0 +1,156 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <lvgl.h>
+#include <ArduinoLog.h>
+#include <esp_timer.h>
+#include "forecast_loop.h"
+#include "forecast_logging.h"
+
+static const uint32_t LoopStatsLogSeconds = 60;
+
+static TaskHandle_t loopTask = nullptr;
+static volatile int64_t wakeRequestedAt = 0;
+
+static loopStats_t stats = {};
+static int64_t windowStartedAt = 0;
+static uint32_t windowWakeups = 0;
+static uint32_t windowEventWakeups = 0;
+static uint32_t windowsSinceLog = 0;
+
+// Monotonic millisecond tick for LVGL, independent of how long the loop sleeps
+static uint32_t loopTickMs()
+{
+    return (uint32_t)(esp_timer_get_time() / 1000);
+}
+
+// LVGL resumes its timer handler when a timer is created, made ready or the screen invalidated
+static void loopTimerResumed(void *data)
+{
+    LV_UNUSED(data);
+    wakeMainLoop();
+}
+
+static void loopNetworkEvent(arduino_event_id_t event, arduino_event_info_t info)
+{
+    wakeMainLoop();
+}
+
+void wakeMainLoop()
+{
+    if (loopTask != nullptr && xTaskGetCurrentTaskHandle() != loopTask)
+    {
+        if (wakeRequestedAt == 0)
+            wakeRequestedAt = esp_timer_get_time();
+        xTaskNotifyGive(loopTask);
+    }
+}
+
+void IRAM_ATTR wakeMainLoopFromISR()
+{
+    if (loopTask == nullptr)
+        return;
+
+    if (wakeRequestedAt == 0)
+        wakeRequestedAt = esp_timer_get_time();
+
+    BaseType_t higherPriorityTaskWoken = pdFALSE;
+    vTaskNotifyGiveFromISR(loopTask, &higherPriorityTaskWoken);
+    if (higherPriorityTaskWoken)
+    {
+        portYIELD_FROM_ISR();
+    }
+}
+
+static void updateStats(int64_t now, bool wokenByEvent, uint32_t sleepMs, int64_t sleptUs)
+{
+    windowWakeups++;
+    if (wokenByEvent)
+    {
+        windowEventWakeups++;
+
+        // Includes any light sleep exit time, which is what power management adds
+        int64_t requestedAt = wakeRequestedAt;
+        if (requestedAt != 0 && now >= requestedAt)
+        {
+            uint32_t latency = (uint32_t)(now - requestedAt);
+            if (latency > stats.maxWakeLatencyUs)
+                stats.maxWakeLatencyUs = latency;
+
+            stats.averageWakeLatencyUs = (stats.averageWakeLatencyUs == 0)
+                                             ? latency
+                                             : stats.averageWakeLatencyUs - (stats.averageWakeLatencyUs >> 4) + (latency >> 4);
+        }
+    }
+    else if (sleepMs > 0)
+    {
+        int64_t oversleepUs = sleptUs - (int64_t)sleepMs * 1000;
+        uint32_t oversleep = oversleepUs > 0 ? (uint32_t)oversleepUs : 0;
+
+        if (oversleep > stats.maxOversleepUs)
+            stats.maxOversleepUs = oversleep;
+
+        stats.averageOversleepUs = (stats.averageOversleepUs == 0)
+                                       ? oversleep
+                                       : stats.averageOversleepUs - (stats.averageOversleepUs >> 4) + (oversleep >> 4);
+    }
+
+    if (now - windowStartedAt < 1000000)
+        return;
+
+    stats.wakeupsPerSecond = windowWakeups;
+    stats.eventWakeupsPerSecond = windowEventWakeups;
+    windowWakeups = 0;
+    windowEventWakeups = 0;
+    windowStartedAt = now;
+
+    if (++windowsSinceLog >= LoopStatsLogSeconds)
+    {
+        windowsSinceLog = 0;
+        LOG_TRACE(LOG_POWER, "Loop: %d wakeups/s (%d by events), oversleep avg %d us max %d us",
+                  stats.wakeupsPerSecond, stats.eventWakeupsPerSecond, stats.averageOversleepUs, stats.maxOversleepUs);
+    }
+}
+
+void waitForNextEvent(uint32_t sleepMs)
+{
+    if (sleepMs > LoopMaxSleepMs)
+        sleepMs = LoopMaxSleepMs;
+
+    stats.lastSleepMs = sleepMs;
+
+    int64_t sleepStartedAt = esp_timer_get_time();
+    bool wokenByEvent = false;
+
+    if (sleepMs == 0)
+    {
+        // Still yield so lower priority tasks on this core get a chance to run
+        taskYIELD();
+    }
+    else
+    {
+        // Round up so the wake never lands before the LVGL deadline
+        TickType_t ticks = (sleepMs + portTICK_PERIOD_MS - 1) / portTICK_PERIOD_MS;
+        wokenByEvent = ulTaskNotifyTake(pdTRUE, ticks) > 0;
+    }
+
+    int64_t now = esp_timer_get_time();
+    updateStats(now, wokenByEvent, sleepMs, now - sleepStartedAt);
+    wakeRequestedAt = 0;
+}
+
+loopStats_t getLoopStats()
+{
+    return stats;
+}
+
+void setupLoop()
+{
+    // setup() and loop() both run on the Arduino loop task
+    loopTask = xTaskGetCurrentTaskHandle();
+    windowStartedAt = esp_timer_get_time();
+
+    lv_tick_set_cb(loopTickMs);
+    lv_timer_handler_set_resume_cb(loopTimerResumed, nullptr);
+
+    WiFi.onEvent(loopNetworkEvent);
+}
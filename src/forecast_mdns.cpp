@@ -0,0 +1,339 @@
+#include <Arduino.h>
+#include <atomic>
+#include <ESPmDNS.h>
+#include "forecast_mdns.h"
+#include "forecast_connectivity.h"
+#include "forecast_events.h"
+#include "forecast_power.h"
+#include "forecast_stall.h"
+#include "forecast_logging.h"
+#include "Backoff.h"
+
+// Found services are queried again a while before their candidates would expire; types
+// with no answer are retried sooner, backing off towards the TTL
+static const uint32_t MdnsRefreshMs = MdnsCacheTtlMs * 3 / 4;
+static const uint32_t MdnsMinRetryMs = 5000;
+
+// A query that nobody answers takes the library's full timeout; only queries are watched,
+// the waits between them are parked
+static const uint32_t MdnsStallThresholdMs = 10000;
+
+struct mdnsService_t
+{
+    char service[16];
+    char proto[8];
+    uint32_t nextQueryMs;
+    Backoff retry{MdnsMinRetryMs, MdnsCacheTtlMs};
+    int count;
+    mdnsCandidate_t candidates[MaxMdnsCandidates];
+};
+
+static mdnsService_t services[MaxMdnsServices];
+static std::atomic<int> serviceCount(0);
+static portMUX_TYPE servicesMux = portMUX_INITIALIZER_UNLOCKED;
+
+static TaskHandle_t mdnsTaskHandle = nullptr;
+static std::atomic<bool> refreshRequested(false);
+
+static volatile uint32_t queries = 0;
+static volatile uint32_t emptyQueries = 0;
+static volatile uint32_t expiredCandidates = 0;
+static volatile uint32_t lastQueryMs = 0;
+static volatile uint32_t maxQueryMs = 0;
+
+static void wakeMdnsTask()
+{
+    if (mdnsTaskHandle != nullptr)
+        xTaskNotifyGive(mdnsTaskHandle);
+}
+
+// Runs on the WiFi event task; addresses may have changed while the network was away
+static void mdnsNetworkChanged(event_t event, const eventData_t &data)
+{
+    if (!data.up)
+        return;
+
+    refreshRequested = true;
+    wakeMdnsTask();
+}
+
+static mdnsCandidate_t *findCandidate(mdnsService_t &entry, const char *address)
+{
+    for (int i = 0; i < entry.count; i++)
+    {
+        if (strcmp(entry.candidates[i].address, address) == 0)
+            return &entry.candidates[i];
+    }
+    return nullptr;
+}
+
+// Candidates are kept sorted, so readers only copy them
+static bool betterCandidate(const mdnsCandidate_t &a, const mdnsCandidate_t &b)
+{
+    if (a.failures != b.failures)
+        return a.failures < b.failures;
+    if (a.lastSuccessMs != b.lastSuccessMs)
+        return (int32_t)(a.lastSuccessMs - b.lastSuccessMs) > 0;
+    return (int32_t)(a.seenMs - b.seenMs) > 0;
+}
+
+static void sortCandidates(mdnsService_t &entry)
+{
+    for (int i = 1; i < entry.count; i++)
+    {
+        mdnsCandidate_t candidate = entry.candidates[i];
+        int j = i;
+        for (; j > 0 && betterCandidate(candidate, entry.candidates[j - 1]); j--)
+            entry.candidates[j] = entry.candidates[j - 1];
+        entry.candidates[j] = candidate;
+    }
+}
+
+// Merges one answer into the cache under the lock; an unknown host takes a free slot, or
+// the place of the worst candidate
+static void mergeCandidate(mdnsService_t &entry, const char *hostname, const char *address, uint16_t port, uint32_t now)
+{
+    mdnsCandidate_t *candidate = findCandidate(entry, address);
+    if (candidate == nullptr)
+    {
+        if (entry.count < MaxMdnsCandidates)
+            candidate = &entry.candidates[entry.count++];
+        else
+            candidate = &entry.candidates[MaxMdnsCandidates - 1];
+
+        memset(candidate, 0, sizeof(*candidate));
+        snprintf(candidate->address, sizeof(candidate->address), "%s", address);
+    }
+
+    snprintf(candidate->hostname, sizeof(candidate->hostname), "%s", hostname);
+    candidate->port = port;
+    candidate->seenMs = now;
+}
+
+static void expireCandidates(mdnsService_t &entry, uint32_t now)
+{
+    int kept = 0;
+    for (int i = 0; i < entry.count; i++)
+    {
+        if (now - entry.candidates[i].seenMs < MdnsCacheTtlMs)
+            entry.candidates[kept++] = entry.candidates[i];
+        else
+            expiredCandidates++;
+    }
+    entry.count = kept;
+}
+
+static void queryService(mdnsService_t &entry)
+{
+    uint32_t started = millis();
+    int found;
+    {
+        PowerLock networkLock(POWER_NETWORK);
+        StallSite site("mdns.query");
+        found = MDNS.queryService(entry.service, entry.proto);
+    }
+
+    uint32_t now = millis();
+    uint32_t elapsed = now - started;
+    queries++;
+    lastQueryMs = elapsed;
+    if (elapsed > maxQueryMs)
+        maxQueryMs = elapsed;
+
+    // Copied out of the library's results before taking the lock
+    struct answer_t
+    {
+        char hostname[32];
+        char address[16];
+        uint16_t port;
+    } answers[MaxMdnsCandidates];
+
+    int count = min(found, MaxMdnsCandidates);
+    for (int i = 0; i < count; i++)
+    {
+        snprintf(answers[i].hostname, sizeof(answers[i].hostname), "%s", MDNS.hostname(i).c_str());
+        snprintf(answers[i].address, sizeof(answers[i].address), "%s", MDNS.IP(i).toString().c_str());
+        answers[i].port = MDNS.port(i);
+    }
+
+    portENTER_CRITICAL(&servicesMux);
+    for (int i = 0; i < count; i++)
+        mergeCandidate(entry, answers[i].hostname, answers[i].address, answers[i].port, now);
+    expireCandidates(entry, now);
+    sortCandidates(entry);
+    portEXIT_CRITICAL(&servicesMux);
+
+    if (count > 0)
+    {
+        entry.retry.reset();
+        entry.nextQueryMs = now + MdnsRefreshMs;
+        LOG_TRACE(LOG_SYSTEM, "mDNS: %d _%s._%s answer(s) in %d ms, first %s at %s:%d", count, entry.service,
+                  entry.proto, elapsed, answers[0].hostname, answers[0].address, answers[0].port);
+    }
+    else
+    {
+        emptyQueries++;
+        entry.nextQueryMs = now + entry.retry.next();
+        LOG_TRACE(LOG_SYSTEM, "mDNS: no _%s._%s answer in %d ms", entry.service, entry.proto, elapsed);
+    }
+}
+
+static void mdnsTask(void *parameter)
+{
+    registerStallWatch("mdns", MdnsStallThresholdMs);
+
+    while (true)
+    {
+        stallHeartbeat();
+
+        bool refresh = refreshRequested.exchange(false);
+        TickType_t wait = portMAX_DELAY;
+        if (networkUp())
+        {
+            int count = serviceCount.load();
+            for (int i = 0; i < count; i++)
+            {
+                if (refresh)
+                    services[i].nextQueryMs = millis();
+                if ((int32_t)(millis() - services[i].nextQueryMs) >= 0)
+                {
+                    // Each query gets the whole threshold to itself
+                    stallHeartbeat();
+                    queryService(services[i]);
+                }
+            }
+
+            // Sleeps until the earliest refresh is due, or something asks for one
+            for (int i = 0; i < count; i++)
+            {
+                int32_t untilMs = (int32_t)(services[i].nextQueryMs - millis());
+                TickType_t ticks = pdMS_TO_TICKS(untilMs > 0 ? untilMs : 0);
+                if (ticks < wait)
+                    wait = ticks;
+            }
+        }
+
+        // Up to the TTL between refreshes, or no deadline at all without the network
+        StallParked parked;
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+void setupMdnsResolver()
+{
+    if (mdnsTaskHandle != nullptr)
+        return;
+
+    eventBus.subscribe(EVENT_NETWORK_CHANGED, mdnsNetworkChanged);
+
+    // Queries block for up to the library's timeout, so they get a task of their own
+    xTaskCreatePinnedToCore(
+        mdnsTask,
+        "MdnsTask",
+        4096,
+        nullptr,
+        1,
+        &mdnsTaskHandle,
+        0);
+}
+
+int watchMdnsService(const char *service, const char *proto)
+{
+    int handle = -1;
+    portENTER_CRITICAL(&servicesMux);
+    int count = serviceCount.load();
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(services[i].service, service) == 0 && strcmp(services[i].proto, proto) == 0)
+            handle = i;
+    }
+
+    if (handle < 0 && count < MaxMdnsServices)
+    {
+        handle = count;
+        snprintf(services[handle].service, sizeof(services[handle].service), "%s", service);
+        snprintf(services[handle].proto, sizeof(services[handle].proto), "%s", proto);
+        services[handle].nextQueryMs = millis();
+        serviceCount = count + 1;
+    }
+    portEXIT_CRITICAL(&servicesMux);
+
+    wakeMdnsTask();
+    return handle;
+}
+
+int getMdnsCandidates(int handle, mdnsCandidate_t *candidates, int maxCandidates)
+{
+    if (handle < 0 || handle >= serviceCount.load())
+        return 0;
+
+    portENTER_CRITICAL(&servicesMux);
+    int count = min(services[handle].count, maxCandidates);
+    memcpy(candidates, services[handle].candidates, count * sizeof(mdnsCandidate_t));
+    portEXIT_CRITICAL(&servicesMux);
+    return count;
+}
+
+void reportMdnsCandidate(int handle, const char *address, bool success)
+{
+    if (handle < 0 || handle >= serviceCount.load())
+        return;
+
+    portENTER_CRITICAL(&servicesMux);
+    mdnsCandidate_t *candidate = findCandidate(services[handle], address);
+    if (candidate != nullptr)
+    {
+        if (success)
+        {
+            uint32_t now = millis();
+            candidate->lastSuccessMs = now != 0 ? now : 1;
+            candidate->failures = 0;
+        }
+        else
+        {
+            candidate->failures++;
+        }
+        sortCandidates(services[handle]);
+    }
+    portEXIT_CRITICAL(&servicesMux);
+}
+
+void refreshMdnsService(int handle)
+{
+    if (handle < 0 || handle >= serviceCount.load())
+        return;
+
+    refreshRequested = true;
+    wakeMdnsTask();
+}
+
+mdnsStats_t getMdnsStats()
+{
+    mdnsStats_t stats;
+    stats.queries = queries;
+    stats.emptyQueries = emptyQueries;
+    stats.expired = expiredCandidates;
+    stats.lastQueryMs = lastQueryMs;
+    stats.maxQueryMs = maxQueryMs;
+    return stats;
+}
+
+void logMdnsStats(lv_timer_t *timer)
+{
+    mdnsStats_t stats = getMdnsStats();
+    LOG_INFO(LOG_SYSTEM, "mDNS: %d queries, %d unanswered, %d candidates expired, last query %d ms, max %d ms",
+             stats.queries, stats.emptyQueries, stats.expired, stats.lastQueryMs, stats.maxQueryMs);
+
+    int count = serviceCount.load();
+    for (int handle = 0; handle < count; handle++)
+    {
+        mdnsCandidate_t candidates[MaxMdnsCandidates];
+        int found = getMdnsCandidates(handle, candidates, MaxMdnsCandidates);
+        for (int i = 0; i < found; i++)
+        {
+            LOG_INFO(LOG_SYSTEM, "mDNS _%s._%s #%d: %s at %s:%d, seen %d s ago, %d failures", services[handle].service,
+                     services[handle].proto, i + 1, candidates[i].hostname, candidates[i].address, candidates[i].port,
+                     (millis() - candidates[i].seenMs) / 1000, candidates[i].failures);
+        }
+    }
+}
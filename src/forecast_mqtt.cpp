@@ -1,287 +1,1136 @@
 #include <Arduino.h>
+#include <atomic>
+#include <esp_timer.h>
+#include <esp_heap_caps.h>
 #include <WiFi.h>
 #include <PubSubClient.h>
-#include <ESPmDNS.h>
 #include <ArduinoJson.h>
 #include <ArduinoLog.h>
 #include "forecast_mqtt.h"
 #include "forecast_preferences.h"
 #include "forecast_weather.h"
 #include "forecast_widgets.h"
+#include "forecast_power.h"
+#include "MQTTDispatcher.h"
+#include "forecast_stall.h"
+#include "forecast_logging.h"
+#include "forecast_connectivity.h"
+#include "forecast_events.h"
+#include "forecast_mdns.h"
+#include "Backoff.h"
 
-#define LCD_BACKLIGHT_PIN 21
+// PubSubClient has to be polled for inbound messages and keepalives
+static const uint32_t MqttPollMs = 50;
 
-WiFiClient wifiClient;
-PubSubClient mqttClient(wifiClient);
-bool mqttConnected = false;
-bool discoveryPublished = false;
+// Failed attempts back off with jitter, so a fleet that lost its broker together does not
+// come back in step
+static const uint32_t MqttMinRetryMs = 1000;
+static const uint32_t MqttMaxRetryMs = 60 * 1000;
 
-void mqttCallback(char *topic, byte *payload, unsigned int length)
+// Connecting is a TCP connect and the MQTT handshake, both bounded by timeouts
+static const uint32_t MqttStallThresholdMs = 20000;
+static const uint16_t MqttSocketTimeoutSeconds = 5;
+
+// The MQTT task is the only user of mqttClient; everyone else queues publishes
+static WiFiClient wifiClient;
+static PubSubClient mqttClient(wifiClient);
+static bool mqttConnected = false;
+static TaskHandle_t mqttTaskHandle = nullptr;
+static std::atomic<bool> reconnectRequested(false);
+static std::atomic<bool> networkChanged(false);
+static Backoff mqttBackoff(MqttMinRetryMs, MqttMaxRetryMs);
+
+// The broker is the configured server or the best one the mDNS resolver has cached.
+// PubSubClient keeps the host pointer it is given, so the host lives here.
+static const uint16_t MqttDefaultPort = 1883;
+static int brokerService = -1;
+static char brokerHost[64];
+static uint16_t brokerPort = MqttDefaultPort;
+static bool brokerDiscovered = false;
+
+// The settings Strings are reassigned on the web server's task, so the MQTT task only
+// reads this copy, taken on that task whenever they change
+struct mqttSettings_t
 {
-    std::string message((char *)payload, length);
-    String topicStr = String(topic);
-    String deviceId = getDeviceIdentifier();
-    JsonDocument doc;
+    char server[64];
+    char user[64];
+    char password[64];
+};
+
+static mqttSettings_t pendingSettings;
+static portMUX_TYPE settingsMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Built once by setupMqtt(), so publishing never concatenates topics
+struct mqttTopics_t
+{
+    char base[32]; // "aura/<device>"
+    char temperature[48];
+    char backlightSet[48];
+    char backlightState[48];
+    char logLevelSet[48];
+    char logLevelState[48];
+    char availability[48]; // "online", or "offline" from the broker as our last will
+};
+
+static mqttTopics_t topics;
+
+static const char *const HomeAssistantStatusTopic = "homeassistant/status";
+
+// Discovery messages are built once per boot into the arena and republished from it on
+// every connect and whenever Home Assistant comes back online
+struct discoveryMessage_t
+{
+    const char *topic;
+    const char *payload;
+    size_t length;
+};
+
+static const int MaxDiscoveryMessages = 4;
+static char discoveryArena[1536];
+static discoveryMessage_t discoveryMessages[MaxDiscoveryMessages];
+static int discoveryCount = 0;
+static std::atomic<bool> rediscoveryRequested(false);
+static volatile uint32_t discoveryArenaUsed = 0;
+static volatile uint32_t discoveryPasses = 0;
+static volatile int32_t discoveryHeapBytes = 0;
+
+// Outbound publishes wait here, one entry per topic; a newer value for a queued topic
+// replaces the old one, so the queue never holds more than MqttOutboxSlots topics
+struct mqttOutbound_t
+{
+    bool used;
+    bool retained;
+    uint32_t sequence; // Queue order of the topic's first pending value
+    int64_t queuedUs;
+    size_t length;
+    char topic[MqttTopicMax];
+    char payload[MqttPayloadMax];
+};
+
+static mqttOutbound_t outbox[MqttOutboxSlots];
+static portMUX_TYPE outboxMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t nextOutboundSequence = 0;
+static volatile uint32_t outboxDepth = 0;
+static volatile uint32_t outboxHighWater = 0;
+static volatile uint32_t coalescedPublishes = 0;
+static volatile uint32_t droppedPublishes = 0;
+static volatile uint32_t failedPublishes = 0;
+static volatile uint32_t sentPublishes = 0;
+static volatile uint32_t publishLatencyUs = 0;
+static volatile uint32_t maxPublishLatencyUs = 0;
+
+static void wakeMqttTask()
+{
+    if (mqttTaskHandle != nullptr)
+        xTaskNotifyGive(mqttTaskHandle);
+}
+
+// Runs on the WiFi event task
+static void mqttNetworkChanged(event_t event, const eventData_t &data)
+{
+    networkChanged = true;
+    wakeMqttTask();
+}
+
+// Routes inbound messages; filled in before the MQTT task starts
+static MQTTDispatcher mqttDispatcher;
+
+// Broker subscriptions for other modules: what they want and what the MQTT task last
+// subscribed, which a connect resets
+struct mqttSubscription_t
+{
+    char wanted[MqttTopicMax];
+    char active[MqttTopicMax];
+};
+
+static mqttSubscription_t subscriptions[MaxMqttSubscriptions];
+static int subscriptionCount = 0;
+static portMUX_TYPE subscriptionsMux = portMUX_INITIALIZER_UNLOCKED;
+static std::atomic<bool> subscriptionsChanged(false);
+
+// Inbound message costs, in CPU cycles; averages are exponential with a weight of 1/8
+static volatile uint32_t inboundMessages = 0;
+static volatile uint32_t unhandledMessages = 0;
+static volatile uint32_t fallbackParses = 0;
+static volatile uint32_t messageCycles = 0;
+static volatile uint32_t maxMessageCycles = 0;
+static volatile uint32_t parseCycles = 0;
+
+static void recordCycles(volatile uint32_t &average, uint32_t cycles)
+{
+    average = (average == 0) ? cycles : average - (average >> 3) + (cycles >> 3);
+}
+
+struct backlightCommand_t
+{
+    bool hasState;
+    bool on;
+    bool hasBrightness;
+    int brightness;
+};
+
+static void skipSpace(const char *&p, const char *end)
+{
+    while (p < end && (*p == ' ' || *p == '\t' || *p == '\r' || *p == '\n'))
+        p++;
+}
+
+// Reads a string without escapes; anything fancier is left to ArduinoJson
+static bool readString(const char *&p, const char *end, std::string_view &value)
+{
+    if (p >= end || *p != '"')
+        return false;
+
+    const char *start = ++p;
+    while (p < end && *p != '"')
+    {
+        if (*p == '\\')
+            return false;
+        p++;
+    }
+    if (p >= end)
+        return false;
+
+    value = std::string_view(start, p - start);
+    p++;
+    return true;
+}
 
-    Log.infoln("Message arrived: %s", message.c_str());
-    Log.infoln(" on topic: %s", topic);
+// Reads the flat object Home Assistant sends for a JSON-schema light, such as
+// {"state":"ON","brightness":128}, without a JsonDocument. Other scalar keys are skipped;
+// false for anything it does not understand.
+static bool parseBacklightCommand(const uint8_t *payload, size_t length, backlightCommand_t &command)
+{
+    const char *p = (const char *)payload;
+    const char *end = p + length;
+    command = {false, false, false, 0};
 
-    deserializeJson(doc, (char *)payload, length);
+    skipSpace(p, end);
+    if (p >= end || *p++ != '{')
+        return false;
 
-    // Handle backlight control commands
-    if (topicStr == ("aura/" + deviceId + "/backlight/set"))
+    skipSpace(p, end);
+    if (p < end && *p == '}')
+        return true;
+
+    while (true)
     {
-        auto state = doc["state"].as<String>();
-        auto brightnessValue = doc["brightness"].as<uint8_t>();
+        std::string_view key;
+        skipSpace(p, end);
+        if (!readString(p, end, key))
+            return false;
+        skipSpace(p, end);
+        if (p >= end || *p++ != ':')
+            return false;
+        skipSpace(p, end);
+        if (p >= end)
+            return false;
 
-        if (state == "ON")
+        if (*p == '"')
         {
-            brightness = constrain(brightnessValue, 1, 255);
+            std::string_view value;
+            if (!readString(p, end, value))
+                return false;
+            if (key == "state")
+            {
+                command.hasState = true;
+                command.on = (value == "ON");
+                if (!command.on && value != "OFF")
+                    command.hasState = false;
+            }
+        }
+        else if (*p == '-' || (*p >= '0' && *p <= '9'))
+        {
+            bool negative = (*p == '-');
+            if (negative)
+                p++;
 
-            analogWrite(LCD_BACKLIGHT_PIN, brightness);
-            preferences.putUInt("brightness", brightness);
+            int value = 0;
+            while (p < end && *p >= '0' && *p <= '9')
+            {
+                value = min(value * 10 + (*p - '0'), 100000);
+                p++;
+            }
+            while (p < end && (*p == '.' || *p == 'e' || *p == 'E' || *p == '+' || *p == '-' || (*p >= '0' && *p <= '9')))
+                p++;
 
-            Log.infoln("Backlight turned ON via MQTT");
-            publishBacklightState();
+            if (key == "brightness")
+            {
+                command.hasBrightness = true;
+                command.brightness = negative ? 0 : value;
+            }
         }
-        else if (state == "OFF")
+        else if (end - p >= 4 && (strncmp(p, "true", 4) == 0 || strncmp(p, "null", 4) == 0))
         {
-            brightness = 0;
-            analogWrite(LCD_BACKLIGHT_PIN, 0);
-            preferences.putUInt("brightness", brightness);
-            Log.infoln("Backlight turned OFF via MQTT");
-            publishBacklightState();
+            p += 4;
+        }
+        else if (end - p >= 5 && strncmp(p, "false", 5) == 0)
+        {
+            p += 5;
+        }
+        else
+        {
+            return false;
         }
-    }
 
-    // mqttDispatcher.dispatch(topic, message);
+        skipSpace(p, end);
+        if (p >= end)
+            return false;
+        if (*p == '}')
+            return true;
+        if (*p++ != ',')
+            return false;
+    }
 }
 
-bool discoverMqttBroker()
+static void handleBacklightSet(std::string_view topic, const uint8_t *payload, size_t length)
 {
-    if (!use_mqtt)
+    uint32_t started = ESP.getCycleCount();
+    backlightCommand_t command;
+    if (!parseBacklightCommand(payload, length, command))
     {
-        return false;
+        // Nested or escaped JSON is still accepted, just not on the fast path
+        fallbackParses++;
+        JsonDocument doc;
+        deserializeJson(doc, payload, length);
+
+        const char *state = doc["state"] | "";
+        command.hasState = (strcmp(state, "ON") == 0 || strcmp(state, "OFF") == 0);
+        command.on = (strcmp(state, "ON") == 0);
+        command.hasBrightness = doc["brightness"].is<int>();
+        command.brightness = doc["brightness"] | 0;
     }
-    
-    if (mqttServer != "")
+    recordCycles(parseCycles, ESP.getCycleCount() - started);
+
+    if (!command.hasState)
     {
-        Log.infoln("MQTT server already configured: %s", mqttServer.c_str());
-        return true;
+        return;
     }
 
-    Log.infoln("Discovering MQTT broker via mDNS...");
-    int n = MDNS.queryService("mqtt", "tcp");
-    if (n == 0)
+    if (command.on)
     {
-        Log.infoln("No MQTT broker found via mDNS");
-        return false;
+        // As before, a missing brightness counts as zero and is raised to the minimum
+        brightness = constrain(command.hasBrightness ? command.brightness : 0, 1, 255);
+
+        setBacklightLevel(brightness);
+        preferences.putUInt("brightness", brightness);
+
+        LOG_INFO(LOG_MQTT, "Backlight turned ON via MQTT");
+        publishBacklightState();
     }
     else
     {
-        mqttServer = MDNS.IP(0).toString();
-        Log.infoln("Discovered MQTT broker: %s at %s", MDNS.hostname(0).c_str(), mqttServer.c_str());
+        brightness = 0;
+        setBacklightLevel(0);
+        preferences.putUInt("brightness", brightness);
+        LOG_INFO(LOG_MQTT, "Backlight turned OFF via MQTT");
+        publishBacklightState();
+    }
+}
+
+// Log level commands, e.g. {"weather":"verbose"}; the state topic echoes every level.
+// Rare enough that a JsonDocument is fine.
+static void handleLogLevelSet(std::string_view topic, const uint8_t *payload, size_t length)
+{
+    JsonDocument doc;
+    deserializeJson(doc, payload, length);
+
+    if (!applyLogLevels(doc))
+    {
+        std::string message((const char *)payload, length);
+        LOG_WARNING(LOG_MQTT, "Ignoring invalid log level in: %s", message.c_str());
+    }
+    publishLogLevels(doc);
+}
+
+// The topic is routed before anything is parsed or copied, and only the handler that
+// matched looks at the payload
+void mqttCallback(char *topic, byte *payload, unsigned int length)
+{
+    uint32_t started = ESP.getCycleCount();
+    inboundMessages++;
+
+    LOG_TRACE(LOG_MQTT, "Message arrived on topic: %s (%d bytes)", topic, length);
+
+    if (mqttDispatcher.dispatch(topic, payload, length) == 0)
+    {
+        unhandledMessages++;
+        LOG_TRACE(LOG_MQTT, "No handler for topic: %s", topic);
+    }
+
+    uint32_t cycles = ESP.getCycleCount() - started;
+    recordCycles(messageCycles, cycles);
+    if (cycles > maxMessageCycles)
+        maxMessageCycles = cycles;
+}
+
+mqttStats_t getMqttStats()
+{
+    mqttStats_t stats;
+    stats.inboundMessages = inboundMessages;
+    stats.unhandledMessages = unhandledMessages;
+    stats.fallbackParses = fallbackParses;
+    stats.messageCycles = messageCycles;
+    stats.maxMessageCycles = maxMessageCycles;
+    stats.parseCycles = parseCycles;
+    stats.outboxDepth = outboxDepth;
+    stats.outboxHighWater = outboxHighWater;
+    stats.coalescedPublishes = coalescedPublishes;
+    stats.droppedPublishes = droppedPublishes;
+    stats.failedPublishes = failedPublishes;
+    stats.sentPublishes = sentPublishes;
+    stats.publishLatencyUs = publishLatencyUs;
+    stats.maxPublishLatencyUs = maxPublishLatencyUs;
+    stats.discoveryPasses = discoveryPasses;
+    stats.discoveryArenaBytes = discoveryArenaUsed;
+    stats.discoveryHeapBytes = discoveryHeapBytes;
+    return stats;
+}
+
+void logMqttStats(lv_timer_t *timer)
+{
+    mqttStats_t stats = getMqttStats();
+    LOG_INFO(LOG_MQTT, "MQTT inbound: %d messages, %d unhandled, %d slow parses; %d cycles per message (max %d), %d per backlight parse",
+             stats.inboundMessages, stats.unhandledMessages, stats.fallbackParses, stats.messageCycles,
+             stats.maxMessageCycles, stats.parseCycles);
+    LOG_INFO(LOG_MQTT, "MQTT outbound: %d sent, %d coalesced, %d dropped, %d failed; queue %d of %d (high water %d); latency %d us (max %d)",
+             stats.sentPublishes, stats.coalescedPublishes, stats.droppedPublishes, stats.failedPublishes,
+             stats.outboxDepth, MqttOutboxSlots, stats.outboxHighWater, stats.publishLatencyUs,
+             stats.maxPublishLatencyUs);
+    static const char *const entityNames[MQTT_ENTITY_COUNT] = {"temperature", "backlight"};
+    for (int entity = 0; entity < MQTT_ENTITY_COUNT; entity++)
+    {
+        mqttEntityStats_t entityStats = getMqttEntityStats((mqttEntity_t)entity);
+        LOG_INFO(LOG_MQTT, "MQTT %s state: %d updates, %d sent (%d heartbeats), %d suppressed, %d deferred",
+                 entityNames[entity], entityStats.updates, entityStats.sent, entityStats.heartbeats,
+                 entityStats.suppressed, entityStats.deferred);
+    }
+    LOG_INFO(LOG_MQTT, "MQTT discovery: %d passes from a %d byte table; heap change during the last pass %d bytes",
+             stats.discoveryPasses, stats.discoveryArenaBytes, stats.discoveryHeapBytes);
+}
+
+// Never queries the network itself; an empty cache only asks the resolver to look again
+static bool chooseMqttBroker(const mqttSettings_t &settings)
+{
+    if (settings.server[0] != 0)
+    {
+        LOG_TRACE(LOG_MQTT, "MQTT server already configured: %s", settings.server);
+        snprintf(brokerHost, sizeof(brokerHost), "%s", settings.server);
+        brokerPort = MqttDefaultPort;
+        brokerDiscovered = false;
         return true;
     }
+
+    mdnsCandidate_t candidate;
+    if (getMdnsCandidates(brokerService, &candidate, 1) == 0)
+    {
+        LOG_INFO(LOG_MQTT, "No MQTT broker found via mDNS yet");
+        refreshMdnsService(brokerService);
+        return false;
+    }
+
+    snprintf(brokerHost, sizeof(brokerHost), "%s", candidate.address);
+    brokerPort = candidate.port != 0 ? candidate.port : MqttDefaultPort;
+    brokerDiscovered = true;
+    LOG_INFO(LOG_MQTT, "Using MQTT broker %s at %s:%d from mDNS", candidate.hostname, brokerHost, brokerPort);
+    return true;
 }
 
-void checkMqttConnection(lv_timer_t *timer)
+int subscribeMqtt(const char *pattern, Handler handler)
 {
-    if (!use_mqtt)
+    if (mqttTaskHandle != nullptr || subscriptionCount >= MaxMqttSubscriptions)
     {
-        return;
+        LOG_ERROR(LOG_MQTT, "Cannot subscribe %s", pattern);
+        return -1;
     }
 
-    if (!mqttClient.connected())
+    mqttDispatcher.registerHandler(pattern, std::move(handler));
+    return subscriptionCount++;
+}
+
+bool setMqttSubscription(int slot, const char *topic)
+{
+    if (slot < 0 || slot >= subscriptionCount || strlen(topic) >= MqttTopicMax)
+        return false;
+
+    portENTER_CRITICAL(&subscriptionsMux);
+    snprintf(subscriptions[slot].wanted, MqttTopicMax, "%s", topic);
+    portEXIT_CRITICAL(&subscriptionsMux);
+
+    subscriptionsChanged = true;
+    wakeMqttTask();
+    return true;
+}
+
+// Runs on the MQTT task while connected
+static void applySubscriptions()
+{
+    for (int i = 0; i < subscriptionCount; i++)
     {
-        Log.infoln("MQTT not connected, attempting to connect...");
+        char wanted[MqttTopicMax];
+        portENTER_CRITICAL(&subscriptionsMux);
+        memcpy(wanted, subscriptions[i].wanted, sizeof(wanted));
+        portEXIT_CRITICAL(&subscriptionsMux);
+
+        char *active = subscriptions[i].active;
+        if (strcmp(wanted, active) == 0)
+            continue;
 
-        if (!discoverMqttBroker())
+        if (active[0] != 0)
+            mqttClient.unsubscribe(active);
+        if (wanted[0] != 0 && !mqttClient.subscribe(wanted))
         {
-            return;
+            // Retried on the next change or connect
+            active[0] = 0;
+            continue;
         }
+        memcpy(active, wanted, MqttTopicMax);
+    }
+}
 
-        mqttClient.setServer(mqttServer.c_str(), 1883);
-        mqttClient.setCallback(mqttCallback);
+// Settings handlers and the UI only post a request; the MQTT task acts on it
+void checkMqttConnection(lv_timer_t *timer)
+{
+    reconnectRequested = true;
+    wakeMqttTask();
+}
 
-        Log.infoln("MQTT client configured to connect to: %s", mqttServer.c_str());
+// Runs on the task that assigns the settings Strings, so they are stable while copied
+static void snapshotMqttSettings()
+{
+    portENTER_CRITICAL(&settingsMux);
+    snprintf(pendingSettings.server, sizeof(pendingSettings.server), "%s", mqttServer.c_str());
+    snprintf(pendingSettings.user, sizeof(pendingSettings.user), "%s", mqttUser.c_str());
+    snprintf(pendingSettings.password, sizeof(pendingSettings.password), "%s", mqttPassword.c_str());
+    portEXIT_CRITICAL(&settingsMux);
+}
 
-        try
-        {
-            if (mqttClient.connect(getDeviceIdentifier().c_str(), mqttUser.c_str(), mqttPassword.c_str()))
-            {
-                Log.infoln("MQTT connected successfully");
-                mqttConnected = true;
+// Runs on the web server's task; it copies the settings and otherwise only posts to the MQTT task
+static void mqttSettingChanged(event_t event, const eventData_t &data)
+{
+    if (data.setting == SETTING_MQTT)
+    {
+        snapshotMqttSettings();
+        checkMqttConnection(nullptr);
+    }
+    else if (data.setting == SETTING_BRIGHTNESS)
+        publishBacklightState();
+}
 
-                // Publish Home Assistant discovery messages
-                publishHomeAssistantDiscovery();
-            }
-            else
-            {
-                Log.errorln("MQTT connection failed, rc=%d", mqttClient.state());
-                mqttConnected = false;
-                discoveryPublished = false; // Reset discovery flag on disconnect
-            }
-        }
-        catch (const std::exception &e)
+bool queueMqttPublish(const char *topic, const char *payload, size_t length, bool retained)
+{
+    if (!use_mqtt)
+    {
+        return false;
+    }
+
+    size_t topicLength = strlen(topic);
+    if (topicLength >= MqttTopicMax || length > MqttPayloadMax)
+    {
+        droppedPublishes++;
+        return false;
+    }
+
+    int64_t now = esp_timer_get_time();
+    bool queued = false;
+    portENTER_CRITICAL(&outboxMux);
+    mqttOutbound_t *empty = nullptr;
+    for (mqttOutbound_t &entry : outbox)
+    {
+        if (entry.used && strcmp(entry.topic, topic) == 0)
         {
-            Log.errorln("MQTT connection exception: %s", e.what());
-            mqttConnected = false;
-            discoveryPublished = false;
+            // The latest value wins; latency still counts from the value it replaced
+            memcpy(entry.payload, payload, length);
+            entry.length = length;
+            entry.retained = retained;
+            coalescedPublishes++;
+            queued = true;
+            break;
         }
-        catch (...)
+        if (!entry.used && empty == nullptr)
         {
-            Log.errorln("MQTT connection failed with unknown exception");
-            mqttConnected = false;
-            discoveryPublished = false;
+            empty = &entry;
         }
     }
+
+    if (!queued && empty != nullptr)
+    {
+        memcpy(empty->topic, topic, topicLength + 1);
+        memcpy(empty->payload, payload, length);
+        empty->length = length;
+        empty->retained = retained;
+        empty->queuedUs = now;
+        empty->sequence = nextOutboundSequence++;
+        empty->used = true;
+        queued = true;
+
+        uint32_t depth = ++outboxDepth;
+        if (depth > outboxHighWater)
+            outboxHighWater = depth;
+    }
+    portEXIT_CRITICAL(&outboxMux);
+
+    if (!queued)
+    {
+        droppedPublishes++;
+        return false;
+    }
+
+    wakeMqttTask();
+    return true;
 }
 
-void setupMqtt()
+// Takes the oldest queued publish into the task's own buffer; false when none is left
+static bool takeOutbound(mqttOutbound_t &taken)
 {
-    // Increase buffer size for Home Assistant discovery messages
-    mqttClient.setBufferSize(1024);
+    bool found = false;
+    portENTER_CRITICAL(&outboxMux);
+    mqttOutbound_t *oldest = nullptr;
+    for (mqttOutbound_t &entry : outbox)
+    {
+        if (entry.used && (oldest == nullptr || (int32_t)(entry.sequence - oldest->sequence) < 0))
+            oldest = &entry;
+    }
 
-    if (discoverMqttBroker())
+    if (oldest != nullptr)
     {
-        checkMqttConnection(nullptr); // Initial connection attempt
+        memcpy(taken.topic, oldest->topic, sizeof(taken.topic));
+        memcpy(taken.payload, oldest->payload, oldest->length);
+        taken.length = oldest->length;
+        taken.retained = oldest->retained;
+        taken.queuedUs = oldest->queuedUs;
+        oldest->used = false;
+        outboxDepth--;
+        found = true;
     }
+    portEXIT_CRITICAL(&outboxMux);
+    return found;
 }
 
-void loopMqtt()
+// Only the fixed header and topic go through PubSubClient's buffer; the payload is written
+// straight to the socket, so it is neither copied again nor limited by the buffer size
+static bool streamPublish(const char *topic, const uint8_t *payload, size_t length, bool retained)
 {
-    if (mqttConnected)
+    if (!mqttClient.beginPublish(topic, length, retained))
+        return false;
+
+    size_t written = mqttClient.write(payload, length);
+    return mqttClient.endPublish() && written == length;
+}
+
+static void drainOutbox()
+{
+    // Static so a full entry is not on the task's stack
+    static mqttOutbound_t entry;
+    while (mqttClient.connected() && takeOutbound(entry))
     {
-        mqttClient.loop();
+        StallSite site("mqtt.publish");
+        if (!streamPublish(entry.topic, (const uint8_t *)entry.payload, entry.length, entry.retained))
+        {
+            failedPublishes++;
+            continue;
+        }
+
+        uint32_t latencyUs = (uint32_t)(esp_timer_get_time() - entry.queuedUs);
+        publishLatencyUs = (publishLatencyUs == 0) ? latencyUs : publishLatencyUs - (publishLatencyUs >> 3) + (latencyUs >> 3);
+        if (latencyUs > maxPublishLatencyUs)
+            maxPublishLatencyUs = latencyUs;
+        sentPublishes++;
     }
 }
 
-void publishHomeAssistantDiscovery()
+// Each entity's state is published under its policy: a change smaller than the deadband
+// is suppressed, changes go out no closer together than the minimum interval (the latest
+// value is sent when it ends), and an unchanged state is resent at the heartbeat interval
+struct publishPolicy_t
 {
-    if (!mqttConnected || discoveryPublished)
+    float deadband;
+    uint32_t minIntervalMs;
+    uint32_t heartbeatMs;
+};
+
+static const publishPolicy_t publishPolicies[MQTT_ENTITY_COUNT] = {
+    {0.1f, 60 * 1000, 30 * 60 * 1000}, // Temperature and feels-like, °C
+    {0.5f, 1000, 30 * 60 * 1000},      // Backlight on/off and brightness, whole steps
+};
+
+struct entityState_t
+{
+    float values[2];
+    float sentValues[2];
+    bool hasValue;
+    bool hasSent;
+    bool pending;  // Changed since the last send
+    bool forced;   // Send at the next pass regardless of the interval
+    bool deferred; // Counted as held back by the minimum interval
+    uint32_t lastSentMs;
+    mqttEntityStats_t stats;
+};
+
+static entityState_t entities[MQTT_ENTITY_COUNT];
+static portMUX_TYPE entitiesMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Records an entity's latest values; cheap and non-blocking, safe from any task
+static void updateEntity(mqttEntity_t entity, float first, float second)
+{
+    entityState_t &state = entities[entity];
+    float deadband = publishPolicies[entity].deadband;
+    bool changed;
+
+    portENTER_CRITICAL(&entitiesMux);
+    state.values[0] = first;
+    state.values[1] = second;
+    state.hasValue = true;
+    state.stats.updates++;
+
+    // NaN compares false, so a missing reading on either side counts as a change
+    changed = !state.hasSent || !(fabsf(first - state.sentValues[0]) < deadband) ||
+              !(fabsf(second - state.sentValues[1]) < deadband);
+
+    if (changed)
+        state.pending = true;
+    else if (!state.pending)
+        state.stats.suppressed++;
+    portEXIT_CRITICAL(&entitiesMux);
+
+    if (changed)
+        wakeMqttTask();
+}
+
+// Sends every entity that has a value at the next pass, e.g. right after discovery
+static void forceEntityPublish()
+{
+    portENTER_CRITICAL(&entitiesMux);
+    for (entityState_t &state : entities)
+        state.forced = state.hasValue;
+    portEXIT_CRITICAL(&entitiesMux);
+    wakeMqttTask();
+}
+
+// JSON has no NaN; ArduinoJson wrote null for a reading that is not there yet
+static const char *formatJsonNumber(float value, char *out, size_t size)
+{
+    if (isnan(value) || isinf(value))
+        return "null";
+
+    snprintf(out, size, "%.2f", value);
+    return out;
+}
+
+// Payloads are formatted on the stack and copied once, into their queue slot
+static void queueEntity(mqttEntity_t entity, const float *values)
+{
+    char payload[64];
+    size_t length;
+    if (entity == MQTT_ENTITY_TEMPERATURE)
     {
-        return;
+        char temperature[16];
+        char feelsLike[16];
+        length = snprintf(payload, sizeof(payload), "{\"temperature\":%s,\"feels_like\":%s}",
+                          formatJsonNumber(values[0], temperature, sizeof(temperature)),
+                          formatJsonNumber(values[1], feelsLike, sizeof(feelsLike)));
+        queueMqttPublish(topics.temperature, payload, length, false);
+    }
+    else
+    {
+        length = snprintf(payload, sizeof(payload), "{\"state\":\"%s\",\"brightness\":%d}",
+                          values[0] != 0 ? "ON" : "OFF", (int)values[1]);
+        queueMqttPublish(topics.backlightState, payload, length, false);
+    }
+}
+
+// Runs on the MQTT task at every poll while connected
+static void applyPublishPolicies()
+{
+    uint32_t now = millis();
+
+    for (int entity = 0; entity < MQTT_ENTITY_COUNT; entity++)
+    {
+        const publishPolicy_t &policy = publishPolicies[entity];
+        entityState_t &state = entities[entity];
+        float values[2];
+        bool send = false;
+
+        portENTER_CRITICAL(&entitiesMux);
+        uint32_t sinceSent = now - state.lastSentMs;
+        if (state.forced || (state.pending && (!state.hasSent || sinceSent >= policy.minIntervalMs)))
+        {
+            send = true;
+        }
+        else if (state.pending)
+        {
+            if (!state.deferred)
+                state.stats.deferred++;
+            state.deferred = true;
+        }
+        else if (state.hasSent && sinceSent >= policy.heartbeatMs)
+        {
+            send = true;
+            state.stats.heartbeats++;
+        }
+
+        if (send)
+        {
+            values[0] = state.values[0];
+            values[1] = state.values[1];
+            state.sentValues[0] = values[0];
+            state.sentValues[1] = values[1];
+            state.hasSent = true;
+            state.pending = false;
+            state.forced = false;
+            state.deferred = false;
+            state.lastSentMs = now;
+            state.stats.sent++;
+        }
+        portEXIT_CRITICAL(&entitiesMux);
+
+        if (send)
+            queueEntity((mqttEntity_t)entity, values);
     }
+}
+
+mqttEntityStats_t getMqttEntityStats(mqttEntity_t entity)
+{
+    portENTER_CRITICAL(&entitiesMux);
+    mqttEntityStats_t stats = entities[entity].stats;
+    portEXIT_CRITICAL(&entitiesMux);
+    return stats;
+}
+
+// Appends a formatted, NUL-terminated string to the discovery arena; nullptr if it is full
+static const char *arenaPrintf(size_t &used, size_t &length, const char *format, ...)
+{
+    va_list args;
+    va_start(args, format);
+    int written = vsnprintf(discoveryArena + used, sizeof(discoveryArena) - used, format, args);
+    va_end(args);
+
+    if (written < 0 || (size_t)written >= sizeof(discoveryArena) - used)
+        return nullptr;
 
+    const char *start = discoveryArena + used;
+    length = written;
+    used += written + 1;
+    return start;
+}
+
+// Builds every entity's discovery topic and payload once per boot, using Home
+// Assistant's abbreviated keys and "~" for the device topic to keep them small
+static void buildHomeAssistantDiscovery()
+{
     String deviceId = getDeviceIdentifier();
-    String baseTopic = "homeassistant";
-    String state_topic = "aura/" + deviceId + "/temperature";
+    const char *id = deviceId.c_str();
+    const char *base = topics.base;
 
-    // Device information for all entities
-    JsonDocument deviceInfo;
-    deviceInfo["identifiers"].add(deviceId);
-    deviceInfo["name"] = "Aura2 Weather Display";
-    deviceInfo["manufacturer"] = "Aura2";
-    deviceInfo["model"] = ESP.getChipModel();
+    char device[160];
+    snprintf(device, sizeof(device),
+             "\"dev\":{\"ids\":[\"%s\"],\"name\":\"Aura2 Weather Display\",\"mf\":\"Aura2\",\"mdl\":\"%s\"}", id,
+             ESP.getChipModel());
+
+    size_t used = 0;
+    size_t length = 0;
+    discoveryMessage_t *message = discoveryMessages;
 
     // Temperature Sensor
-    JsonDocument tempConfig;
-    tempConfig["name"] = "Temperature";
-    tempConfig["state_topic"] = state_topic;
-    tempConfig["unit_of_measurement"] = "°C";
-    tempConfig["device_class"] = "temperature";
-    tempConfig["value_template"] = "{{ value_json.temperature }}";
-    tempConfig["unique_id"] = deviceId + "_temperature";
-    tempConfig["device"] = deviceInfo;
+    message->topic = arenaPrintf(used, length, "homeassistant/sensor/%s_temp/config", id);
+    message->payload = arenaPrintf(used, length,
+                                   "{\"~\":\"%s\",\"name\":\"Temperature\",\"avty_t\":\"~/availability\",\"stat_t\":\"~/temperature\","
+                                   "\"unit_of_meas\":\"°C\",\"dev_cla\":\"temperature\",\"val_tpl\":\"{{ value_json.temperature }}\","
+                                   "\"uniq_id\":\"%s_temperature\",%s}",
+                                   base, id, device);
+    message->length = length;
+    message++;
 
     // Feels Like Temperature Sensor
-    JsonDocument feelsLikeConfig;
-    feelsLikeConfig["name"] = "Feels Like Temperature";
-    feelsLikeConfig["state_topic"] = state_topic;
-    feelsLikeConfig["unit_of_measurement"] = "°C";
-    feelsLikeConfig["device_class"] = "temperature";
-    feelsLikeConfig["value_template"] = "{{ value_json.feels_like }}";
-    feelsLikeConfig["unique_id"] = deviceId + "_feels_like";
-    feelsLikeConfig["device"] = deviceInfo;
-
-    String tempConfigTopic = baseTopic + "/sensor/" + deviceId + "_temp/config";
-    String tempConfigPayload;
-    serializeJson(tempConfig, tempConfigPayload);
-    auto tempPublishResult = mqttClient.publish(tempConfigTopic.c_str(), tempConfigPayload.c_str(), true);
+    message->topic = arenaPrintf(used, length, "homeassistant/sensor/%s_feels_like/config", id);
+    message->payload = arenaPrintf(used, length,
+                                   "{\"~\":\"%s\",\"name\":\"Feels Like Temperature\",\"avty_t\":\"~/availability\","
+                                   "\"stat_t\":\"~/temperature\",\"unit_of_meas\":\"°C\",\"dev_cla\":\"temperature\","
+                                   "\"val_tpl\":\"{{ value_json.feels_like }}\",\"uniq_id\":\"%s_feels_like\",%s}",
+                                   base, id, device);
+    message->length = length;
+    message++;
 
-    String feelsLikeConfigTopic = baseTopic + "/sensor/" + deviceId + "_feels_like/config";
-    String feelsLikeConfigPayload;
-    serializeJson(feelsLikeConfig, feelsLikeConfigPayload);
-    auto feelsLikePublishResult = mqttClient.publish(feelsLikeConfigTopic.c_str(), feelsLikeConfigPayload.c_str(), true);
+    // Backlight Light Entity
+    message->topic = arenaPrintf(used, length, "homeassistant/light/%s_backlight/config", id);
+    message->payload = arenaPrintf(used, length,
+                                   "{\"~\":\"%s\",\"name\":\"Backlight\",\"avty_t\":\"~/availability\",\"cmd_t\":\"~/backlight/set\","
+                                   "\"stat_t\":\"~/backlight/state\",\"schema\":\"json\",\"brightness\":true,\"brightness_scale\":255,"
+                                   "\"uniq_id\":\"%s_backlight\",%s}",
+                                   base, id, device);
+    message->length = length;
+    message++;
 
-    if (tempPublishResult && feelsLikePublishResult)
+    discoveryCount = message - discoveryMessages;
+    discoveryArenaUsed = used;
+    for (int i = 0; i < discoveryCount; i++)
     {
-        Log.infoln("Published Aura2 discovery");
-
-        // Publish initial sensor states
-        publishSensorState();
+        if (discoveryMessages[i].topic == nullptr || discoveryMessages[i].payload == nullptr)
+        {
+            LOG_ERROR(LOG_MQTT, "Home Assistant discovery does not fit in %d bytes", sizeof(discoveryArena));
+            discoveryCount = 0;
+            return;
+        }
     }
+}
 
-    // Backlight Light Entity
-    JsonDocument backlightConfig;
-    backlightConfig["name"] = "Backlight";
-    backlightConfig["command_topic"] = "aura/" + deviceId + "/backlight/set";
-    backlightConfig["state_topic"] = "aura/" + deviceId + "/backlight/state";
-    backlightConfig["schema"] = "json";
-    backlightConfig["brightness"] = true;
-    backlightConfig["unique_id"] = deviceId + "_backlight";
-    backlightConfig["brightness_scale"] = 255;
-    backlightConfig["device"] = deviceInfo;
+// Announces every entity in one pass, then their states
+static void publishHomeAssistantDiscovery()
+{
+    size_t heapBefore = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
 
-    String backlightConfigTopic = baseTopic + "/light/" + deviceId + "_backlight/config";
-    String backlightConfigPayload;
-    serializeJson(backlightConfig, backlightConfigPayload);
+    int published = 0;
+    for (int i = 0; i < discoveryCount; i++)
+    {
+        const discoveryMessage_t &message = discoveryMessages[i];
+        if (streamPublish(message.topic, (const uint8_t *)message.payload, message.length, true))
+            published++;
+    }
+
+    // Other tasks allocate too, so this is an upper bound on what the pass itself took
+    discoveryHeapBytes = (int32_t)(heapBefore - heap_caps_get_free_size(MALLOC_CAP_DEFAULT));
+    discoveryPasses++;
 
-    if (mqttClient.publish(backlightConfigTopic.c_str(), backlightConfigPayload.c_str(), true))
+    if (published < discoveryCount)
+    {
+        LOG_WARNING(LOG_MQTT, "Published %d of %d Home Assistant discovery messages", published, discoveryCount);
+    }
+    else
     {
-        Log.infoln("Published backlight discovery");
+        LOG_INFO(LOG_MQTT, "Home Assistant discovery published for %d entities", discoveryCount);
+    }
 
-        // Subscribe to backlight command topics
-        String backlightSetTopic = "aura/" + deviceId + "/backlight/set";
-        mqttClient.subscribe(backlightSetTopic.c_str());
+    // The states follow straight away, whatever their policies say
+    publishBacklightState();
+    forceEntityPublish();
+}
 
-        // Publish initial backlight state
-        publishBacklightState();
+// Home Assistant announces itself on restart; its retained discovery may be gone
+static void handleHomeAssistantStatus(std::string_view topic, const uint8_t *payload, size_t length)
+{
+    if (std::string_view((const char *)payload, length) == "online")
+    {
+        rediscoveryRequested = true;
     }
+}
 
-    discoveryPublished = true;
-    Log.infoln("Home Assistant discovery messages published");
+// The broker publishes "offline" for us if the connection dies; a clean disconnect does
+// not trigger the will, so it is published by hand first
+static void disconnectMqtt()
+{
+    streamPublish(topics.availability, (const uint8_t *)"offline", 7, true);
+    mqttClient.disconnect();
+    mqttConnected = false;
+    linkDown(LINK_MQTT, false);
 }
 
-void publishSensorState()
+static bool connectMqtt()
 {
-    if (!mqttConnected)
+    PowerLock networkLock(POWER_NETWORK);
+    LOG_INFO(LOG_MQTT, "MQTT not connected, attempting to connect...");
+
+    mqttSettings_t settings;
+    portENTER_CRITICAL(&settingsMux);
+    settings = pendingSettings;
+    portEXIT_CRITICAL(&settingsMux);
+
+    if (!chooseMqttBroker(settings))
     {
-        return;
+        return false;
     }
 
-    String deviceId = getDeviceIdentifier();
-    String topic = "aura/" + deviceId + "/temperature";
+    mqttClient.setServer(brokerHost, brokerPort);
 
-    JsonDocument statePayload;
-    statePayload["temperature"] = temperature_now;
-    statePayload["feels_like"] = feels_like_temperature;
+    LOG_INFO(LOG_MQTT, "MQTT client configured to connect to: %s:%d", brokerHost, brokerPort);
 
-    String payload;
-    serializeJson(statePayload, payload);
+    StallSite site("mqtt.connect");
+    bool connected = mqttClient.connect(getDeviceIdentifier().c_str(), settings.user, settings.password,
+                                        topics.availability, 0, true, "offline");
+
+    // Failures push a discovered broker down the list; it may also have moved
+    if (brokerDiscovered)
+    {
+        reportMdnsCandidate(brokerService, brokerHost, connected);
+        if (!connected)
+            refreshMdnsService(brokerService);
+    }
+
+    if (connected)
+    {
+        LOG_INFO(LOG_MQTT, "MQTT connected successfully");
+        mqttConnected = true;
+        linkUp(LINK_MQTT);
+        streamPublish(topics.availability, (const uint8_t *)"online", 6, true);
+
+        mqttClient.subscribe(topics.logLevelSet);
+        mqttClient.subscribe(topics.backlightSet);
+        mqttClient.subscribe(HomeAssistantStatusTopic);
+
+        // A clean session starts with no subscriptions
+        for (int i = 0; i < subscriptionCount; i++)
+        {
+            subscriptions[i].active[0] = 0;
+        }
+        applySubscriptions();
+
+        publishHomeAssistantDiscovery();
+        return true;
+    }
 
-    mqttClient.publish(topic.c_str(), payload.c_str());
+    LOG_ERROR(LOG_MQTT, "MQTT connection failed, rc=%d", mqttClient.state());
+    return false;
 }
 
-void publishBacklightState()
+static void mqttTask(void *parameter)
 {
-    if (!mqttConnected)
+    registerStallWatch("mqtt", MqttStallThresholdMs);
+    uint32_t nextAttemptMs = millis();
+
+    while (true)
     {
-        return;
+        stallHeartbeat();
+
+        // A settings change takes effect on a fresh connection, attempted straight away
+        if (reconnectRequested.exchange(false))
+        {
+            if (mqttClient.connected())
+            {
+                LOG_INFO(LOG_MQTT, "MQTT settings changed, disconnecting");
+                disconnectMqtt();
+            }
+            mqttBackoff.reset();
+            nextAttemptMs = millis();
+        }
+
+        // The socket is dead once the network drops, so it is closed rather than left to
+        // time out; once the network is back the next attempt starts at once
+        if (networkChanged.exchange(false))
+        {
+            if (!networkUp() && mqttClient.connected())
+            {
+                mqttClient.disconnect();
+            }
+            mqttBackoff.reset();
+            nextAttemptMs = millis();
+        }
+
+        if (mqttConnected && !mqttClient.connected())
+        {
+            LOG_WARNING(LOG_MQTT, "MQTT connection lost, rc=%d", mqttClient.state());
+            mqttConnected = false;
+            linkDown(LINK_MQTT, true);
+        }
+
+        if (use_mqtt && networkUp() && !mqttClient.connected() && (int32_t)(millis() - nextAttemptMs) >= 0)
+        {
+            if (connectMqtt())
+            {
+                mqttBackoff.reset();
+            }
+            else
+            {
+                uint32_t delayMs = mqttBackoff.next();
+                nextAttemptMs = millis() + delayMs;
+                LOG_INFO(LOG_MQTT, "Next MQTT attempt in %d ms", delayMs);
+            }
+        }
+
+        TickType_t wait = portMAX_DELAY;
+        if (mqttClient.connected())
+        {
+            PowerLock networkLock(POWER_NETWORK);
+            {
+                StallSite site("mqtt.loop");
+                mqttClient.loop();
+            }
+
+            // Not from the handler itself: PubSubClient shares one buffer between the
+            // message being handled and anything published
+            if (rediscoveryRequested.exchange(false) && mqttClient.connected())
+            {
+                publishHomeAssistantDiscovery();
+            }
+            if (subscriptionsChanged.exchange(false) && mqttClient.connected())
+            {
+                applySubscriptions();
+            }
+            applyPublishPolicies();
+            drainOutbox();
+            wait = pdMS_TO_TICKS(MqttPollMs);
+        }
+        else if (use_mqtt && networkUp())
+        {
+            // Without the network the task sleeps until the connectivity listener wakes it
+            int32_t untilAttemptMs = (int32_t)(nextAttemptMs - millis());
+            wait = pdMS_TO_TICKS(untilAttemptMs > 0 ? untilAttemptMs : 0);
+        }
+
+        if (wait > pdMS_TO_TICKS(MqttPollMs))
+        {
+            // Idle, or backing off for up to a minute: longer than the stall threshold
+            StallParked parked;
+            ulTaskNotifyTake(pdTRUE, wait);
+        }
+        else
+        {
+            ulTaskNotifyTake(pdTRUE, wait);
+        }
     }
+}
+
+void setupMqtt()
+{
+    // Outbound payloads are streamed past the buffer, so it only needs to hold publish
+    // headers and inbound commands
+    mqttClient.setBufferSize(512);
+    mqttClient.setCallback(mqttCallback);
+    mqttClient.setSocketTimeout(MqttSocketTimeoutSeconds);
 
     String deviceId = getDeviceIdentifier();
-    auto backlightState = getBacklightState();
+    snprintf(topics.base, sizeof(topics.base), "aura/%s", deviceId.c_str());
+    snprintf(topics.temperature, sizeof(topics.temperature), "%s/temperature", topics.base);
+    snprintf(topics.backlightSet, sizeof(topics.backlightSet), "%s/backlight/set", topics.base);
+    snprintf(topics.backlightState, sizeof(topics.backlightState), "%s/backlight/state", topics.base);
+    snprintf(topics.logLevelSet, sizeof(topics.logLevelSet), "%s/log_level/set", topics.base);
+    snprintf(topics.logLevelState, sizeof(topics.logLevelState), "%s/log_level/state", topics.base);
+    snprintf(topics.availability, sizeof(topics.availability), "%s/availability", topics.base);
+
+    mqttDispatcher.registerHandler(topics.backlightSet, handleBacklightSet);
+    mqttDispatcher.registerHandler(topics.logLevelSet, handleLogLevelSet);
+    mqttDispatcher.registerHandler(HomeAssistantStatusTopic, handleHomeAssistantStatus);
+    buildHomeAssistantDiscovery();
+    snapshotMqttSettings();
+    eventBus.subscribe(EVENT_NETWORK_CHANGED, mqttNetworkChanged);
+    eventBus.subscribe(EVENT_SETTING_CHANGED, mqttSettingChanged);
+    brokerService = watchMdnsService("mqtt", "tcp");
+
+    // Owns mqttClient: connects, polls, runs the handlers and sends queued publishes
+    xTaskCreatePinnedToCore(
+        mqttTask,
+        "MqttTask",
+        6144,
+        nullptr,
+        1,
+        &mqttTaskHandle,
+        0);
+}
+
+// Producers only record the latest values; the MQTT task decides when they go out
 
-    // Publish state (ON/OFF)
-    String stateTopic = "aura/" + deviceId + "/backlight/state";
-    JsonDocument statePayload;
-    statePayload["state"] = backlightState.isOn ? "ON" : "OFF";
-    statePayload["brightness"] = backlightState.brightness;
+void publishSensorState()
+{
+    updateEntity(MQTT_ENTITY_TEMPERATURE, temperature_now, feels_like_temperature);
+}
 
-    String payload;
-    serializeJson(statePayload, payload);
+void publishBacklightState()
+{
+    auto backlightState = getBacklightState();
+    updateEntity(MQTT_ENTITY_BACKLIGHT, backlightState.isOn ? 1 : 0, backlightState.brightness);
+}
 
-    mqttClient.publish(stateTopic.c_str(), payload.c_str());
+void publishLogLevels(const JsonDocument &levels)
+{
+    char payload[MqttPayloadMax];
+    size_t length = serializeJson(levels, payload, sizeof(payload));
+    queueMqttPublish(topics.logLevelState, payload, length, true);
 }
@@ -1,15 +1,90 @@
 #include <Arduino.h>
-#include <WiFi.h>
-#include <PubSubClient.h>
-#include <ArduinoJson.h>
+#include <atomic>
+#include "NatsClient.h"
+#include "LogRingBuffer.h"
 #include "forecast_nats.h"
 #include "forecast_preferences.h"
+#include "forecast_power.h"
+#include "forecast_stall.h"
+#include "forecast_logging.h"
+#include "forecast_connectivity.h"
+#include "forecast_events.h"
 
-// Note: ArduinoLog is not used in this file to avoid a circular dependency with logging.
+// LOG_* calls only append to the log ring, and the logger task publishes later, so code
+// here may log even while it is publishing a batch of log lines
 
-WiFiClient natsWifiClient;
-PubSubClient natsClient(natsWifiClient);
-bool natsConnected = false;
+// The NATS task is the only user of natsClient. Everything else talks to it through the
+// outbox, the enabled flag and the pending settings, none of which wait on the network.
+static const size_t NatsWriteBufferSize = 4096;
+static const size_t NatsReadBufferSize = 2048;
+static const uint16_t NatsDefaultPort = 4222;
+static NatsClient natsClient(NatsWriteBufferSize, NatsReadBufferSize);
+
+// The client has to be polled to read and keep the connection alive; queued messages
+// wake the task straight away
+static const uint32_t NatsPollMs = 100;
+static const uint32_t NatsStallThresholdMs = 15000;
+
+// Outbox records are the subject, its NUL, then the payload
+alignas(4) static uint8_t natsOutboxStorage[NatsOutboxSize];
+static LogRingBuffer natsOutbox(natsOutboxStorage, NatsOutboxSize);
+
+static TaskHandle_t natsTaskHandle = nullptr;
+
+// Entries are only ever added; the NATS task subscribes the new ones
+struct natsResponderEntry_t
+{
+    char subject[NatsClient::MaxSubjectLength];
+    natsResponder_t responder;
+    int sid;
+};
+
+static natsResponderEntry_t responders[MaxNatsResponders];
+static std::atomic<int> responderCount(0);
+static portMUX_TYPE respondersMux = portMUX_INITIALIZER_UNLOCKED;
+static char natsReply[NatsReplyMax];
+
+struct natsSettings_t
+{
+    char host[64];
+    uint16_t port;
+    char user[64];
+    char password[64];
+    char name[48];
+};
+
+static natsSettings_t pendingSettings;
+static portMUX_TYPE settingsMux = portMUX_INITIALIZER_UNLOCKED;
+static std::atomic<bool> settingsChanged(false);
+static std::atomic<bool> natsEnabled(false);
+static std::atomic<bool> natsUp(false);
+static std::atomic<bool> networkChanged(false);
+
+// Built once, before the task can connect; the device identifier does not change at runtime
+static String logSubject;
+static String binaryLogSubject;
+
+static volatile uint32_t connectedSinceMs = 0;
+static volatile uint32_t connectedMs = 0;
+static volatile uint32_t failedAttempts = 0;
+static volatile uint32_t disconnects = 0;
+static volatile uint32_t queuedMessages = 0;
+static volatile uint32_t sentMessages = 0;
+static volatile uint32_t droppedMessages = 0;
+static volatile uint32_t answeredRequests = 0;
+
+static void wakeNatsTask()
+{
+    if (natsTaskHandle != nullptr)
+        xTaskNotifyGive(natsTaskHandle);
+}
+
+// Runs on the WiFi event task
+static void natsNetworkChanged(event_t event, const eventData_t &data)
+{
+    networkChanged = true;
+    wakeNatsTask();
+}
 
 void checkNatsConnection(lv_timer_t *timer)
 {
@@ -20,87 +95,323 @@ void checkNatsConnection(lv_timer_t *timer)
     }
 
     setupNats();
+}
 
-    connectNats();
+// Runs on the web server's task
+static void natsSettingChanged(event_t event, const eventData_t &data)
+{
+    if (data.setting == SETTING_NATS)
+        checkNatsConnection(nullptr);
 }
 
 void connectNats()
 {
-    if (!natsConnected)
+    natsEnabled = true;
+    wakeNatsTask();
+}
+
+void disconnectNats()
+{
+    natsEnabled = false;
+    wakeNatsTask();
+}
+
+bool publishNats(const char *subject, const uint8_t *payload, size_t length)
+{
+    if (!natsUp)
+        return false;
+
+    size_t subjectLength = strlen(subject) + 1;
+    uint8_t *record = natsOutbox.reserve(subjectLength + length);
+    if (record == nullptr)
     {
-        try
+        droppedMessages++;
+        return false;
+    }
+
+    memcpy(record, subject, subjectLength);
+    memcpy(record + subjectLength, payload, length);
+    natsOutbox.commit(record, subjectLength + length);
+    queuedMessages++;
+    wakeNatsTask();
+    return true;
+}
+
+bool publishLogBatch(const char *batch, size_t length, bool binary)
+{
+    const String &subject = binary ? binaryLogSubject : logSubject;
+    return publishNats(subject.c_str(), reinterpret_cast<const uint8_t *>(batch), length);
+}
+
+bool respondNats(const char *subject, natsResponder_t responder)
+{
+    if (strlen(subject) >= sizeof(responders[0].subject))
+        return false;
+
+    portENTER_CRITICAL(&respondersMux);
+    int index = responderCount.load();
+    if (index < MaxNatsResponders)
+    {
+        snprintf(responders[index].subject, sizeof(responders[index].subject), "%s", subject);
+        responders[index].responder = responder;
+        responders[index].sid = 0;
+        responderCount = index + 1;
+    }
+    portEXIT_CRITICAL(&respondersMux);
+
+    if (index >= MaxNatsResponders)
+        return false;
+
+    wakeNatsTask();
+    return true;
+}
+
+static void subscribeResponders()
+{
+    int count = responderCount.load();
+    for (int i = 0; i < count; i++)
+    {
+        if (responders[i].sid == 0)
+            responders[i].sid = max(natsClient.subscribe(responders[i].subject), 0);
+    }
+}
+
+// Runs inside natsClient.loop() on the NATS task, so the reply can go straight to the client
+static void handleMessage(const char *subject, const char *replyTo, const uint8_t *payload, size_t length,
+                          void *context)
+{
+    if (replyTo == nullptr)
+        return;
+
+    int count = responderCount.load();
+    for (int i = 0; i < count; i++)
+    {
+        if (strcmp(subject, responders[i].subject) != 0)
+            continue;
+
+        size_t replyLength = responders[i].responder(payload, length, natsReply, sizeof(natsReply));
+        if (replyLength == 0)
+            return;
+
+        const uint8_t *reply = reinterpret_cast<const uint8_t *>(natsReply);
+        if (!natsClient.publish(replyTo, reply, replyLength))
         {
-            if (natsClient.connect(getDeviceIdentifier().c_str(), natsUser.c_str(), natsPassword.c_str()))
+            natsClient.flush();
+            if (!natsClient.publish(replyTo, reply, replyLength))
             {
-                Serial.println("NATS connected successfully");
-                natsConnected = true;
+                LOG_WARNING(LOG_NATS, "NATS reply on %s dropped (%d bytes)", subject, replyLength);
+                return;
+            }
+        }
+
+        answeredRequests++;
+        return;
+    }
+}
+
+static void applySettings()
+{
+    natsSettings_t settings;
+    portENTER_CRITICAL(&settingsMux);
+    settings = pendingSettings;
+    portEXIT_CRITICAL(&settingsMux);
+
+    // Unchanged settings leave a live connection alone
+    natsClient.setServer(settings.host, settings.port);
+    natsClient.setCredentials(settings.user, settings.password, settings.name);
+}
+
+// Hands queued messages to the client. Messages that find the connection down are
+// dropped; ones the write buffer cannot take yet stay queued until it drains.
+static void drainOutbox()
+{
+    uint32_t length;
+    const uint8_t *record;
+    while ((record = natsOutbox.peek(length)) != nullptr)
+    {
+        if (natsClient.connected())
+        {
+            const char *subject = reinterpret_cast<const char *>(record);
+            size_t subjectLength = strlen(subject) + 1;
+            if (!natsClient.publish(subject, record + subjectLength, length - subjectLength))
+            {
+                if (natsClient.pendingBytes() > 0)
+                    break;
+                droppedMessages++;
             }
             else
             {
-                Serial.printf("NATS connection failed, rc=%d\n", natsClient.state());
-                natsConnected = false;
+                sentMessages++;
             }
         }
-        catch (const std::exception &e)
-        {
-            Serial.printf("NATS connection exception: %s\n", e.what());
-            natsConnected = false;
-        }
-        catch (...)
+        else
         {
-            Serial.println("NATS connection failed with unknown exception");
-            natsConnected = false;
+            droppedMessages++;
         }
+
+        natsOutbox.release();
     }
 }
 
-void disconnectNats()
+// Logs transitions and keeps the connection metrics
+static void trackState(NatsClient::State previous, NatsClient::State state)
 {
-    if (natsConnected)
+    uint32_t now = millis();
+    if (state == NatsClient::Connected && previous != NatsClient::Connected)
+    {
+        connectedSinceMs = now;
+        natsUp = true;
+        linkUp(LINK_NATS);
+        LOG_INFO(LOG_NATS, "NATS connected successfully (connection %d)", natsClient.connects());
+    }
+    else if (previous == NatsClient::Connected && state != NatsClient::Connected)
     {
-        natsClient.disconnect();
-        natsConnected = false;
-        Serial.println("NATS disconnected");
+        natsUp = false;
+        connectedMs += now - connectedSinceMs;
+        disconnects++;
+        linkDown(LINK_NATS, state != NatsClient::Idle);
+        if (state == NatsClient::Idle)
+            LOG_INFO(LOG_NATS, "NATS disconnected");
+        else
+            LOG_WARNING(LOG_NATS, "NATS connection lost after %d s: %s", (now - connectedSinceMs) / 1000,
+                        natsClient.lastError());
+    }
+    else if (state == NatsClient::Waiting && previous != NatsClient::Waiting && previous != NatsClient::Idle)
+    {
+        failedAttempts++;
+        LOG_WARNING(LOG_NATS, "NATS connection failed: %s", natsClient.lastError());
     }
 }
 
-void setupNats()
+static void natsTask(void *parameter)
 {
-    if (!use_nats)
+    registerStallWatch("nats", NatsStallThresholdMs);
+    natsClient.setMessageHandler(handleMessage, nullptr);
+
+    while (true)
     {
-        return;
-    }
-    
-    natsClient.setBufferSize(1024);
-    natsClient.setServer(natsServer.c_str(), 1883);
-    Serial.println("NATS client configured to connect to: " + natsServer + " (" + natsUser + ", " + natsPassword + ")");
+        stallHeartbeat();
 
-    connectNats();
+        if (settingsChanged.exchange(false))
+            applySettings();
+        subscribeResponders();
+
+        if (natsEnabled && !natsClient.active())
+            natsClient.connect();
+        else if (!natsEnabled && natsClient.active())
+            natsClient.disconnect();
+
+        // A socket from before the network went away is not worth waiting on, and an
+        // attempt backing off can start as soon as it is back
+        if (networkChanged.exchange(false))
+            natsClient.restart();
+
+        NatsClient::State previous = natsClient.getState();
+        if (natsClient.active())
+        {
+            PowerLock networkLock(POWER_NETWORK);
+            StallSite site("nats.loop");
+            natsClient.loop(millis());
+            trackState(previous, natsClient.getState());
+
+            // Everything queued since the last pass leaves in one send
+            drainOutbox();
+            natsClient.flush();
+        }
+        else
+        {
+            trackState(previous, natsClient.getState());
+            drainOutbox();
+        }
+
+        if (natsClient.active())
+        {
+            ulTaskNotifyTake(pdTRUE, pdMS_TO_TICKS(NatsPollMs));
+        }
+        else
+        {
+            // NATS is off, which is the default; waiting for it is not a stall
+            StallParked parked;
+            ulTaskNotifyTake(pdTRUE, portMAX_DELAY);
+        }
+    }
 }
 
-void loopNats()
+void setupNats()
 {
-    if (natsConnected)
+    if (natsTaskHandle == nullptr)
     {
-        natsClient.loop();
+        logSubject = "aura2.logs." + getDeviceIdentifier();
+        binaryLogSubject = logSubject + ".bin";
+        eventBus.subscribe(EVENT_NETWORK_CHANGED, natsNetworkChanged);
+        eventBus.subscribe(EVENT_SETTING_CHANGED, natsSettingChanged);
+
+        // Next to the WiFi stack, away from rendering and the logger; responders run here
+        xTaskCreatePinnedToCore(
+            natsTask,
+            "NatsTask",
+            6144,
+            nullptr,
+            1,
+            &natsTaskHandle,
+            0);
     }
-}
 
-void publishLogMessage(const char* message)
-{
-    if (!natsConnected)
+    if (!use_nats)
     {
         return;
     }
 
-    JsonDocument logMessage;
-    logMessage["timestamp"] = (uint32_t)time(nullptr);
-    logMessage["message"] = message;
-    logMessage["message_length"] = strlen(message);
+    // The server setting is "host" or "host:port"
+    String host = natsServer;
+    uint16_t port = NatsDefaultPort;
+    int colon = natsServer.lastIndexOf(':');
+    if (colon > 0)
+    {
+        host = natsServer.substring(0, colon);
+        port = natsServer.substring(colon + 1).toInt();
+    }
+
+    portENTER_CRITICAL(&settingsMux);
+    snprintf(pendingSettings.host, sizeof(pendingSettings.host), "%s", host.c_str());
+    pendingSettings.port = port;
+    snprintf(pendingSettings.user, sizeof(pendingSettings.user), "%s", natsUser.c_str());
+    snprintf(pendingSettings.password, sizeof(pendingSettings.password), "%s", natsPassword.c_str());
+    snprintf(pendingSettings.name, sizeof(pendingSettings.name), "%s", getDeviceIdentifier().c_str());
+    portEXIT_CRITICAL(&settingsMux);
+    settingsChanged = true;
+
+    LOG_INFO(LOG_NATS, "NATS client configured to connect to: %s:%d (%s)", host.c_str(), port, natsUser.c_str());
 
-    String logPayload;
-    serializeJson(logMessage, logPayload);
+    connectNats();
+}
 
-    String subject = "aura2/logs/" + getDeviceIdentifier();
-    natsClient.publish(subject.c_str(), logPayload.c_str());
-}
\ No newline at end of file
+natsStats_t getNatsStats()
+{
+    natsStats_t stats;
+    uint32_t now = millis();
+    stats.connected = natsUp;
+    stats.uptimeMs = stats.connected ? now - connectedSinceMs : 0;
+    stats.connectedMs = connectedMs + stats.uptimeMs;
+    stats.connects = natsClient.connects();
+    stats.failedAttempts = failedAttempts;
+    stats.disconnects = disconnects;
+    stats.queuedMessages = queuedMessages;
+    stats.sentMessages = sentMessages;
+    stats.droppedMessages = droppedMessages;
+    stats.outboxHighWaterBytes = natsOutbox.highWaterBytes();
+    stats.requests = answeredRequests;
+    stats.lastError = natsClient.lastError();
+    return stats;
+}
+
+void logNatsStats(lv_timer_t *timer)
+{
+    natsStats_t stats = getNatsStats();
+    LOG_INFO(LOG_NATS, "NATS %s: up %d s, connected %d s in total, %d connects, %d failed attempts, %d disconnects",
+             stats.connected ? "connected" : "down", stats.uptimeMs / 1000, stats.connectedMs / 1000, stats.connects,
+             stats.failedAttempts, stats.disconnects);
+    LOG_INFO(LOG_NATS, "NATS outbox: %d queued, %d sent, %d dropped, high water %d of %d bytes; %d requests answered, last error: %s",
+             stats.queuedMessages, stats.sentMessages, stats.droppedMessages, stats.outboxHighWaterBytes,
+             NatsOutboxSize, stats.requests, stats.lastError[0] != 0 ? stats.lastError : "none");
+}
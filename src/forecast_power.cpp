@@ -0,0 +1,203 @@
+#include <Arduino.h>
+#include <WiFi.h>
+#include <ArduinoLog.h>
+#include <esp_pm.h>
+#include <esp_sleep.h>
+#include <esp_timer.h>
+#include <driver/ledc.h>
+#include "forecast_power.h"
+#include "forecast_loop.h"
+#include "forecast_preferences.h"
+#include "forecast_widgets.h"
+#include "forecast_logging.h"
+
+#define LCD_BACKLIGHT_PIN 21
+
+static const ledc_timer_t BacklightTimer = LEDC_TIMER_3;
+static const ledc_channel_t BacklightChannel = LEDC_CHANNEL_7;
+static const uint32_t BacklightFrequencyHz = 5000;
+
+bool use_light_sleep = true;
+
+static const char *const PowerLockNames[POWER_ACTIVITY_COUNT] = {"render", "flush", "touch", "network"};
+
+#if CONFIG_PM_ENABLE
+static esp_pm_lock_handle_t powerLocks[POWER_ACTIVITY_COUNT] = {};
+#endif
+
+static portMUX_TYPE powerMux = portMUX_INITIALIZER_UNLOCKED;
+static uint32_t activeLocks = 0;
+static int64_t unlockedSince = 0;
+static int64_t unlockedUs = 0;
+static int64_t windowStartedAt = 0;
+static powerStats_t stats = {};
+
+void powerLockAcquire(powerActivity_t activity)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&powerMux);
+    if (activeLocks++ == 0)
+    {
+        unlockedUs += now - unlockedSince;
+    }
+    stats.lockAcquisitions[activity]++;
+    portEXIT_CRITICAL(&powerMux);
+
+#if CONFIG_PM_ENABLE
+    if (powerLocks[activity] != nullptr)
+    {
+        esp_pm_lock_acquire(powerLocks[activity]);
+    }
+#endif
+}
+
+void powerLockRelease(powerActivity_t activity)
+{
+#if CONFIG_PM_ENABLE
+    if (powerLocks[activity] != nullptr)
+    {
+        esp_pm_lock_release(powerLocks[activity]);
+    }
+#endif
+
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&powerMux);
+    if (activeLocks > 0 && --activeLocks == 0)
+    {
+        unlockedSince = now;
+    }
+    portEXIT_CRITICAL(&powerMux);
+}
+
+powerStats_t getPowerStats()
+{
+    return stats;
+}
+
+void logPowerStats(lv_timer_t *timer)
+{
+    int64_t now = esp_timer_get_time();
+
+    portENTER_CRITICAL(&powerMux);
+    int64_t unlocked = unlockedUs;
+    if (activeLocks == 0)
+    {
+        unlocked += now - unlockedSince;
+        unlockedSince = now;
+    }
+    unlockedUs = 0;
+    portEXIT_CRITICAL(&powerMux);
+
+    int64_t window = now - windowStartedAt;
+    windowStartedAt = now;
+    if (window <= 0)
+        return;
+
+    stats.sleepEligiblePercent = (uint32_t)(unlocked * 100 / window);
+
+    auto loopStats = getLoopStats();
+    LOG_INFO(LOG_POWER, "Power: light sleep %s, %d%% sleep eligible, wake latency avg %d us max %d us",
+             stats.lightSleepEnabled ? "on" : "off", stats.sleepEligiblePercent,
+             loopStats.averageWakeLatencyUs, loopStats.maxWakeLatencyUs);
+}
+
+void setBacklightLevel(uint8_t level)
+{
+    ledc_set_duty(LEDC_LOW_SPEED_MODE, BacklightChannel, level);
+    ledc_update_duty(LEDC_LOW_SPEED_MODE, BacklightChannel);
+}
+
+static void setupBacklight()
+{
+    // APB-clocked LEDC stops in light sleep; the RTC 8 MHz clock keeps running if left powered
+    ledc_timer_config_t timerConfig = {};
+    timerConfig.speed_mode = LEDC_LOW_SPEED_MODE;
+    timerConfig.duty_resolution = LEDC_TIMER_8_BIT;
+    timerConfig.timer_num = BacklightTimer;
+    timerConfig.freq_hz = BacklightFrequencyHz;
+    timerConfig.clk_cfg = LEDC_USE_RTC8M_CLK;
+
+    if (ledc_timer_config(&timerConfig) != ESP_OK)
+    {
+        LOG_ERROR(LOG_POWER, "Backlight LEDC timer configuration failed");
+        return;
+    }
+
+    ledc_channel_config_t channelConfig = {};
+    channelConfig.gpio_num = LCD_BACKLIGHT_PIN;
+    channelConfig.speed_mode = LEDC_LOW_SPEED_MODE;
+    channelConfig.channel = BacklightChannel;
+    channelConfig.timer_sel = BacklightTimer;
+    channelConfig.duty = getBacklightState().isOn ? brightness : 0;
+    channelConfig.hpoint = 0;
+
+    if (ledc_channel_config(&channelConfig) != ESP_OK)
+    {
+        LOG_ERROR(LOG_POWER, "Backlight LEDC channel configuration failed");
+        return;
+    }
+
+    esp_sleep_pd_config(ESP_PD_DOMAIN_RTC8M, ESP_PD_OPTION_ON);
+}
+
+static bool configurePowerManagement(bool lightSleep)
+{
+#if CONFIG_PM_ENABLE
+#if ESP_IDF_VERSION_MAJOR >= 5
+    esp_pm_config_t config = {};
+#else
+    esp_pm_config_esp32_t config = {};
+#endif
+    config.max_freq_mhz = getCpuFrequencyMhz();
+    config.min_freq_mhz = 80; // Lowest frequency that keeps WiFi running
+    config.light_sleep_enable = lightSleep;
+
+    esp_err_t err = esp_pm_configure(&config);
+    if (err != ESP_OK)
+    {
+        LOG_WARNING(LOG_POWER, "esp_pm_configure(light_sleep=%T) failed: %s", lightSleep, esp_err_to_name(err));
+        return false;
+    }
+
+    for (int i = 0; i < POWER_ACTIVITY_COUNT; i++)
+    {
+        if (powerLocks[i] == nullptr)
+        {
+            esp_pm_lock_create(ESP_PM_CPU_FREQ_MAX, 0, PowerLockNames[i], &powerLocks[i]);
+        }
+    }
+
+    return true;
+#else
+    LOG_WARNING(LOG_POWER, "Power management is not enabled in this SDK configuration");
+    return false;
+#endif
+}
+
+void setupPower()
+{
+    use_light_sleep = preferences.getBool("light_sleep", use_light_sleep);
+
+    setupBacklight();
+
+    // Modem sleep lets the radio doze between DTIM beacons while staying associated
+    WiFi.setSleep(WIFI_PS_MIN_MODEM);
+
+    // Touch IRQ is active low and must be able to end a light sleep
+    esp_sleep_enable_gpio_wakeup();
+
+    stats.lightSleepEnabled = use_light_sleep && configurePowerManagement(true);
+    if (!stats.lightSleepEnabled)
+    {
+        // Automatic light sleep needs tickless idle; fall back to frequency scaling only
+        configurePowerManagement(false);
+    }
+
+    int64_t now = esp_timer_get_time();
+    unlockedSince = now;
+    windowStartedAt = now;
+
+    LOG_INFO(LOG_POWER, "Power management ready, light sleep %s", stats.lightSleepEnabled ? "enabled" : "disabled");
+}
@@ -0,0 +1,308 @@
+#include <Arduino.h>
+#include <ArduinoLog.h>
+#include <esp_timer.h>
+#include "forecast_scheduler.h"
+#include "forecast_loop.h"
+#include "forecast_stall.h"
+#include "forecast_logging.h"
+
+// UI jobs due together yield back to rendering once they have used this much time
+static const int64_t UiJobBudgetUs = 20 * 1000;
+static const uint32_t BackgroundJobStackSize = 8192;
+static const int64_t NoRelease = INT64_MAX;
+
+struct job_t
+{
+    jobDefinition_t definition;
+    int64_t releaseAt; // esp_timer time the job is next due
+    jobStats_t stats;
+};
+
+static job_t jobs[MaxJobs];
+static volatile int jobCount = 0;
+static portMUX_TYPE jobMux = portMUX_INITIALIZER_UNLOCKED;
+
+static lv_timer_t *uiSchedulerTimer = nullptr;
+static TaskHandle_t uiJobTask = nullptr;
+static TaskHandle_t backgroundTasks[portNUM_PROCESSORS] = {};
+static const char *volatile activeUiJob = nullptr;
+static const char *volatile activeBackgroundJobs[portNUM_PROCESSORS] = {};
+
+// Picks the highest priority due job of a class, or reports when the next one is due
+static int nextDueJob(jobClass_t jobClass, BaseType_t core, int64_t now, int64_t &nextRelease)
+{
+    int best = -1;
+    nextRelease = NoRelease;
+
+    portENTER_CRITICAL(&jobMux);
+    for (int i = 0; i < jobCount; i++)
+    {
+        const job_t &job = jobs[i];
+        if (job.definition.jobClass != jobClass)
+            continue;
+        if (jobClass == JOB_BACKGROUND && job.definition.core != core)
+            continue;
+
+        if (job.releaseAt > now)
+        {
+            if (job.releaseAt < nextRelease)
+                nextRelease = job.releaseAt;
+            continue;
+        }
+
+        if (best < 0 || job.definition.priority > jobs[best].definition.priority ||
+            (job.definition.priority == jobs[best].definition.priority && job.releaseAt < jobs[best].releaseAt))
+        {
+            best = i;
+        }
+    }
+    portEXIT_CRITICAL(&jobMux);
+
+    return best;
+}
+
+static void runJob(job_t &job, int64_t startedAt)
+{
+    portENTER_CRITICAL(&jobMux);
+    int64_t releasedAt = job.releaseAt;
+    portEXIT_CRITICAL(&jobMux);
+
+    job.definition.callback(nullptr);
+
+    int64_t finishedAt = esp_timer_get_time();
+    uint32_t duration = (uint32_t)(finishedAt - startedAt);
+    int64_t period = (int64_t)job.definition.periodMs * 1000;
+
+    portENTER_CRITICAL(&jobMux);
+    jobStats_t &stats = job.stats;
+    stats.runs++;
+    stats.lastDurationUs = duration;
+    if (duration > stats.maxDurationUs)
+        stats.maxDurationUs = duration;
+    stats.averageDurationUs = (stats.runs == 1)
+                                  ? duration
+                                  : stats.averageDurationUs - (stats.averageDurationUs >> 3) + (duration >> 3);
+
+    if (finishedAt - releasedAt > (int64_t)job.definition.deadlineMs * 1000)
+        stats.missedDeadlines++;
+
+    // Stay on the period grid, skipping releases that were missed entirely. A runJobNow()
+    // that arrived while the job was running has moved releaseAt and is kept.
+    if (job.releaseAt == releasedAt)
+    {
+        int64_t next = releasedAt + period;
+        while (next <= finishedAt)
+            next += period;
+        job.releaseAt = next;
+    }
+    portEXIT_CRITICAL(&jobMux);
+}
+
+static uint32_t msUntil(int64_t releaseAt, int64_t now)
+{
+    if (releaseAt == NoRelease)
+        return LoopMaxSleepMs;
+    if (releaseAt <= now)
+        return 0;
+    return (uint32_t)((releaseAt - now + 999) / 1000);
+}
+
+static void runUiJobs(lv_timer_t *timer)
+{
+    int64_t startedAt = esp_timer_get_time();
+    int64_t now = startedAt;
+    int64_t nextRelease = NoRelease;
+
+    uiJobTask = xTaskGetCurrentTaskHandle();
+
+    while (true)
+    {
+        now = esp_timer_get_time();
+        int jobId = nextDueJob(JOB_UI, 0, now, nextRelease);
+        if (jobId < 0)
+            break;
+
+        if (now - startedAt > UiJobBudgetUs)
+        {
+            // Let LVGL render a frame before running the rest
+            nextRelease = now;
+            break;
+        }
+
+        activeUiJob = jobs[jobId].definition.name;
+        runJob(jobs[jobId], now);
+        activeUiJob = nullptr;
+    }
+
+    lv_timer_set_period(timer, msUntil(nextRelease, now));
+}
+
+static void backgroundJobTask(void *parameter)
+{
+    BaseType_t core = (BaseType_t)(intptr_t)parameter;
+
+    // Background jobs legitimately idle for minutes, so this watch only reports heartbeat age
+    registerStallWatch(pcTaskGetName(nullptr), 0);
+
+    while (true)
+    {
+        int64_t now = esp_timer_get_time();
+        int64_t nextRelease;
+        int jobId = nextDueJob(JOB_BACKGROUND, core, now, nextRelease);
+        if (jobId >= 0)
+        {
+            activeBackgroundJobs[core] = jobs[jobId].definition.name;
+            runJob(jobs[jobId], now);
+            activeBackgroundJobs[core] = nullptr;
+            stallHeartbeat();
+            continue;
+        }
+
+        stallHeartbeat();
+
+        TickType_t wait = (nextRelease == NoRelease) ? portMAX_DELAY : pdMS_TO_TICKS(msUntil(nextRelease, now));
+        ulTaskNotifyTake(pdTRUE, wait);
+    }
+}
+
+static void wakeJobRunner(const job_t &job)
+{
+    if (job.definition.jobClass == JOB_UI)
+    {
+        if (uiSchedulerTimer != nullptr)
+            lv_timer_ready(uiSchedulerTimer);
+    }
+    else if (backgroundTasks[job.definition.core] != nullptr)
+    {
+        xTaskNotifyGive(backgroundTasks[job.definition.core]);
+    }
+}
+
+int scheduleJob(const jobDefinition_t &definition, bool runNow)
+{
+    if (definition.callback == nullptr || definition.periodMs == 0)
+    {
+        LOG_ERROR(LOG_JOBS, "Invalid job definition: %s", definition.name);
+        return -1;
+    }
+
+    if (definition.jobClass == JOB_BACKGROUND && (definition.core < 0 || definition.core >= portNUM_PROCESSORS))
+    {
+        LOG_ERROR(LOG_JOBS, "Invalid core %d for job %s", definition.core, definition.name);
+        return -1;
+    }
+
+    if (jobCount >= MaxJobs)
+    {
+        LOG_ERROR(LOG_JOBS, "Job table full, cannot schedule %s", definition.name);
+        return -1;
+    }
+
+    int64_t now = esp_timer_get_time();
+
+    // Fill the slot before publishing it through jobCount so runners never see a partial job
+    int jobId = jobCount;
+    job_t &job = jobs[jobId];
+    job.definition = definition;
+    job.releaseAt = runNow ? now : now + (int64_t)definition.periodMs * 1000;
+    job.stats = {};
+    job.stats.name = definition.name;
+    job.stats.jobClass = definition.jobClass;
+
+    portENTER_CRITICAL(&jobMux);
+    jobCount = jobId + 1;
+    portEXIT_CRITICAL(&jobMux);
+
+    if (definition.jobClass == JOB_UI)
+    {
+        if (uiSchedulerTimer == nullptr)
+        {
+            uiSchedulerTimer = lv_timer_create(runUiJobs, 0, nullptr);
+        }
+    }
+    else if (backgroundTasks[definition.core] == nullptr)
+    {
+        char taskName[16];
+        snprintf(taskName, sizeof(taskName), "JobsCore%d", (int)definition.core);
+        xTaskCreatePinnedToCore(
+            backgroundJobTask,
+            taskName,
+            BackgroundJobStackSize,
+            (void *)(intptr_t)definition.core,
+            1,
+            &backgroundTasks[definition.core],
+            definition.core);
+    }
+
+    wakeJobRunner(job);
+    return jobId;
+}
+
+int findJob(const char *name)
+{
+    for (int i = 0; i < jobCount; i++)
+    {
+        if (strcmp(jobs[i].definition.name, name) == 0)
+            return i;
+    }
+    return -1;
+}
+
+void runJobNow(int jobId)
+{
+    if (jobId < 0 || jobId >= jobCount)
+        return;
+
+    portENTER_CRITICAL(&jobMux);
+    jobs[jobId].releaseAt = esp_timer_get_time();
+    portEXIT_CRITICAL(&jobMux);
+
+    wakeJobRunner(jobs[jobId]);
+}
+
+const char *getActiveJobName(TaskHandle_t task)
+{
+    if (task == nullptr)
+        return nullptr;
+
+    if (task == uiJobTask)
+        return activeUiJob;
+
+    for (int core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        if (task == backgroundTasks[core])
+            return activeBackgroundJobs[core];
+    }
+
+    return nullptr;
+}
+
+int getJobCount()
+{
+    return jobCount;
+}
+
+bool getJobStats(int jobId, jobStats_t &stats)
+{
+    if (jobId < 0 || jobId >= jobCount)
+        return false;
+
+    portENTER_CRITICAL(&jobMux);
+    stats = jobs[jobId].stats;
+    portEXIT_CRITICAL(&jobMux);
+    return true;
+}
+
+void logJobStats(lv_timer_t *timer)
+{
+    for (int i = 0; i < getJobCount(); i++)
+    {
+        jobStats_t stats;
+        if (!getJobStats(i, stats))
+            continue;
+
+        LOG_INFO(LOG_JOBS, "Job %s (%s): runs %d, last %d us, avg %d us, max %d us, missed %d",
+                 stats.name, stats.jobClass == JOB_UI ? "ui" : "background", stats.runs,
+                 stats.lastDurationUs, stats.averageDurationUs, stats.maxDurationUs, stats.missedDeadlines);
+    }
+}
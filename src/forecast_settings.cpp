@@ -11,8 +11,9 @@
 #include "forecast_widgets.h"
 #include "forecast_mqtt.h"
 #include "forecast_nats.h"
-
-#define LCD_BACKLIGHT_PIN 21
+#include "forecast_power.h"
+#include "forecast_logging.h"
+#include "forecast_events.h"
 
 struct SpiRamAllocator : ArduinoJson::Allocator {
   void* allocate(size_t size) override {
@@ -30,7 +31,7 @@ struct SpiRamAllocator : ArduinoJson::Allocator {
 
 void initializeSettingsScreen()
 {
-  Log.infoln("Initializing settings screen...");
+  LOG_INFO(LOG_SETTINGS, "Initializing settings screen...");
   String ipv4LabelText = "http://" + WiFi.localIP().toString();
   String mdnsLabelText = "http://" + getDeviceIdentifier() + ".local";
 
@@ -62,6 +63,7 @@ String getUseMQTT() { return use_mqtt ? "checked" : ""; }
 String getMqttUsername() { return mqttUser; }
 String getMqttPassword() { return mqttPassword; }
 String getUseNATS() { return use_nats ? "checked" : ""; }
+String getUseFleetWeather() { return use_fleet_weather ? "checked" : ""; }
 String getNatsServer() { return natsServer; }
 String getNatsUser() { return natsUser; }
 String getNatsPassword() { return natsPassword; }
@@ -86,6 +88,7 @@ static const TemplateEntry templateTable[] = {
     {"NATS_USER", getNatsUser},
     {"NATS_PASSWORD", getNatsPassword},
     {"USE_NATS_CHECKED", getUseNATS},
+    {"FLEET_WEATHER_CHECKED", getUseFleetWeather},
     {nullptr, nullptr} // Sentinel
 };
 
@@ -105,18 +108,18 @@ String templateProcessor(const String &var)
 
 void setupWebserver()
 {
-  Log.infoln("Setting up settings web server...");
+  LOG_INFO(LOG_SETTINGS, "Setting up settings web server...");
 
   // LittleFS is already initialized in main.cpp, we just verify its existence
   if (!LittleFS.exists("/"))
   {
-    Log.warningln("LittleFS not accessible in setupWebserver");
+    LOG_WARNING(LOG_SETTINGS, "LittleFS not accessible in setupWebserver");
   }
 
   // Verify required files exist
   if (!LittleFS.exists("/index.html"))
   {
-    Log.warningln("WARNING: /index.html not found");
+    LOG_WARNING(LOG_SETTINGS, "WARNING: /index.html not found");
   }
 
   // Static files (index.html, etc.)
@@ -138,8 +141,7 @@ void setupWebserver()
       DeserializationError error = deserializeJson(doc, (const char*)data);
       
       if (error) {
-        Log.error("JSON parse error: ");
-        Log.errorln(error.c_str());
+        LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
         request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
         return;
       }
@@ -147,15 +149,15 @@ void setupWebserver()
       int brightnessValue = doc["value"];
       brightnessValue = constrain(brightnessValue, 0, 255);
       
-      Serial.printf("Setting brightness to: %d\n", brightnessValue);
+      LOG_INFO(LOG_SETTINGS, "Setting brightness to: %d", brightnessValue);
       
       // Apply brightness to LCD backlight
-      analogWrite(LCD_BACKLIGHT_PIN, brightnessValue);
+      setBacklightLevel(brightnessValue);
       
       // Save to preferences for persistence
       preferences.putUInt("brightness", brightnessValue);
       brightness = brightnessValue;
-      publishBacklightState();
+      publishSettingChanged(SETTING_BRIGHTNESS);
       
       request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -166,8 +168,7 @@ void setupWebserver()
     DeserializationError error = deserializeJson(doc, (const char*)data);
     
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -179,13 +180,13 @@ void setupWebserver()
     
     bool format24 = doc["format24"];
     
-    Log.infoln("Setting clock format to: %s", format24 ? "24h" : "12h");
+    LOG_INFO(LOG_SETTINGS, "Setting clock format to: %s", format24 ? "24h" : "12h");
     
     show_24hour_clock = format24;
     preferences.putBool("show_24hour", format24);
 
-    // Trigger clock update to refresh display
-    updateClock(nullptr);
+    // The loop task refreshes the clock
+    publishSettingChanged(SETTING_CLOCK_FORMAT);
     
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -196,8 +197,7 @@ void setupWebserver()
     DeserializationError error = deserializeJson(doc, (const char*)data);
     
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -209,13 +209,13 @@ void setupWebserver()
 
     bool useF = doc["useF"];
     
-    Log.infoln("Setting temperature format to: %s", useF ? "Fahrenheit" : "Celsius");
+    LOG_INFO(LOG_SETTINGS, "Setting temperature format to: %s", useF ? "Fahrenheit" : "Celsius");
     
     use_fahrenheit = useF;
     preferences.putBool("use_fahrenheit", useF);
     
-    // Trigger weather update to refresh temperature display
-    updateWeather(nullptr);
+    // The loop task redraws temperatures in the new unit
+    publishSettingChanged(SETTING_TEMPERATURE_UNIT);
     
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -226,8 +226,7 @@ void setupWebserver()
     DeserializationError error = deserializeJson(doc, (const char*)data);
     
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -239,11 +238,11 @@ void setupWebserver()
     
     bool enabled = doc["enabled"];
     
-    Log.infoln("Setting dim at time to: %s", enabled ? "enabled" : "disabled");
+    LOG_INFO(LOG_SETTINGS, "Setting dim at time to: %s", enabled ? "enabled" : "disabled");
     
     dim_at_time = enabled;
     preferences.putBool("dim_at_time", enabled);
-    checkDimTime(nullptr);
+    publishSettingChanged(SETTING_DIM_SCHEDULE);
     
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -254,8 +253,7 @@ void setupWebserver()
     DeserializationError error = deserializeJson(doc, (const char*)data);
     
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -273,11 +271,11 @@ void setupWebserver()
       return;
     }
     
-    Log.infoln("Setting dim start time to: %s", startTime.c_str());
+    LOG_INFO(LOG_SETTINGS, "Setting dim start time to: %s", startTime.c_str());
     
     dim_start_time = startTime;
     preferences.putString("dim_start_time", startTime);
-    checkDimTime(nullptr);
+    publishSettingChanged(SETTING_DIM_SCHEDULE);
     
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -288,8 +286,7 @@ void setupWebserver()
     DeserializationError error = deserializeJson(doc, (const char*)data);
     
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -307,10 +304,11 @@ void setupWebserver()
       return;
     }
     
-    Log.infoln("Setting dim end time to: %s", endTime.c_str());
+    LOG_INFO(LOG_SETTINGS, "Setting dim end time to: %s", endTime.c_str());
     
     dim_end_time = endTime;
     preferences.putString("dim_end_time", endTime);
+    publishSettingChanged(SETTING_DIM_SCHEDULE);
     
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -320,8 +318,7 @@ void setupWebserver()
     JsonDocument doc;
     DeserializationError error = deserializeJson(doc, (const char*)data);
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -333,11 +330,11 @@ void setupWebserver()
     
     bool enabled = doc["enabled"];
     
-    Log.infoln("Setting use DST to: %s", enabled ? "enabled" : "disabled");
+    LOG_INFO(LOG_SETTINGS, "Setting use DST to: %s", enabled ? "enabled" : "disabled");
     
     use_dst = enabled;
     preferences.putBool("use_dst", enabled);
-    updateClock(nullptr);
+    publishSettingChanged(SETTING_DAYLIGHT_SAVING);
     
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -347,8 +344,7 @@ void setupWebserver()
     JsonDocument doc;
     DeserializationError error = deserializeJson(doc, (const char*)data);
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -360,11 +356,37 @@ void setupWebserver()
     
     bool enabled = doc["enabled"];
     
-    Log.infoln("Setting use MQTT to: %s", enabled ? "enabled" : "disabled");
+    LOG_INFO(LOG_SETTINGS, "Setting use MQTT to: %s", enabled ? "enabled" : "disabled");
     
     use_mqtt = enabled;
     preferences.putBool("use_mqtt", enabled);
-    checkMqttConnection(nullptr);
+    publishSettingChanged(SETTING_MQTT);
+    
+    request->send(200, "application/json", "{\"status\":\"ok\"}"); });
+
+  // Handle fleet weather sharing setting with POST
+  server.on("/setFleetWeather", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+            {
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, (const char*)data);
+    if (error) {
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
+      request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+      return;
+    }
+    
+    if (!doc["enabled"].is<bool>()) {
+      request->send(400, "application/json", "{\"error\":\"enabled must be a boolean value\"}");
+      return;
+    }
+    
+    bool enabled = doc["enabled"];
+    
+    LOG_INFO(LOG_SETTINGS, "Setting fleet weather sharing to: %s", enabled ? "enabled" : "disabled");
+    
+    use_fleet_weather = enabled;
+    preferences.putBool("fleet_weather", enabled);
+    publishSettingChanged(SETTING_FLEET_WEATHER);
     
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -374,8 +396,7 @@ void setupWebserver()
     JsonDocument doc;
     DeserializationError error = deserializeJson(doc, (const char*)data);
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -387,11 +408,11 @@ void setupWebserver()
 
     String username = doc["username"].as<String>();
 
-    Log.infoln("Setting MQTT username: %s", username.c_str());
+    LOG_INFO(LOG_SETTINGS, "Setting MQTT username: %s", username.c_str());
 
     mqttUser = username;
     preferences.putString("mqtt_user", username);
-    checkMqttConnection(nullptr);
+    publishSettingChanged(SETTING_MQTT);
 
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -401,8 +422,7 @@ void setupWebserver()
     JsonDocument doc;
     DeserializationError error = deserializeJson(doc, (const char*)data);
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -414,11 +434,11 @@ void setupWebserver()
 
     String password = doc["password"].as<String>();
 
-    Log.infoln("Setting MQTT password.");
+    LOG_INFO(LOG_SETTINGS, "Setting MQTT password.");
 
     mqttPassword = password;
     preferences.putString("mqtt_password", password);
-    checkMqttConnection(nullptr);
+    publishSettingChanged(SETTING_MQTT);
 
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -428,8 +448,7 @@ void setupWebserver()
     JsonDocument doc;
     DeserializationError error = deserializeJson(doc, (const char*)data);
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -441,11 +460,11 @@ void setupWebserver()
     
     bool enabled = doc["enabled"];
     
-    Log.infoln("Setting use NATS to: %s", enabled ? "enabled" : "disabled");
+    LOG_INFO(LOG_SETTINGS, "Setting use NATS to: %s", enabled ? "enabled" : "disabled");
     
     use_nats = enabled;
     preferences.putBool("use_nats", enabled);
-    checkNatsConnection(nullptr);
+    publishSettingChanged(SETTING_NATS);
     
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -455,8 +474,7 @@ void setupWebserver()
     JsonDocument doc;
     DeserializationError error = deserializeJson(doc, (const char*)data);
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -467,11 +485,11 @@ void setupWebserver()
     }
 
     String server = doc["server"].as<String>();
-    Log.infoln("Setting NATS server: %s", server.c_str());
+    LOG_INFO(LOG_SETTINGS, "Setting NATS server: %s", server.c_str());
 
     natsServer = server;
     preferences.putString("nats_server", server);
-    checkNatsConnection(nullptr);
+    publishSettingChanged(SETTING_NATS);
 
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -481,8 +499,7 @@ void setupWebserver()
     JsonDocument doc;
     DeserializationError error = deserializeJson(doc, (const char*)data);
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -494,11 +511,11 @@ void setupWebserver()
 
     String username = doc["username"].as<String>();
 
-    Log.infoln("Setting NATS username: %s", username.c_str());
+    LOG_INFO(LOG_SETTINGS, "Setting NATS username: %s", username.c_str());
 
     natsUser = username;
     preferences.putString("nats_user", username);
-    checkNatsConnection(nullptr);
+    publishSettingChanged(SETTING_NATS);
 
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
@@ -508,8 +525,7 @@ void setupWebserver()
     JsonDocument doc;
     DeserializationError error = deserializeJson(doc, (const char*)data);
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
@@ -521,14 +537,47 @@ void setupWebserver()
 
     String password = doc["password"].as<String>();
 
-    Log.infoln("Setting NATS password.");
+    LOG_INFO(LOG_SETTINGS, "Setting NATS password.");
 
     natsPassword = password;
     preferences.putString("nats_password", password);
-    checkNatsConnection(nullptr);
+    publishSettingChanged(SETTING_NATS);
     
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
+  // Current log level of every category
+  server.on("/logLevels", HTTP_GET, [](AsyncWebServerRequest *request)
+            {
+    JsonDocument levels;
+    applyLogLevels(levels);
+
+    String response;
+    serializeJson(levels, response);
+    request->send(200, "application/json", response); });
+
+  // Handle log level changes with POST, applied in order, e.g. {"all":"warning","weather":"verbose"}
+  server.on("/setLogLevels", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
+            {
+    JsonDocument doc;
+    DeserializationError error = deserializeJson(doc, (const char*)data, len);
+    
+    if (error) {
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
+      request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
+      return;
+    }
+
+    if (!applyLogLevels(doc)) {
+      request->send(400, "application/json", "{\"error\":\"Unknown log category or level\"}");
+      return;
+    }
+
+    publishLogLevels(doc);
+
+    String response;
+    serializeJson(doc, response);
+    request->send(200, "application/json", response); });
+
   // Handle location updates with POST
   server.on("/setLocation", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
             {
@@ -536,14 +585,13 @@ void setupWebserver()
     DeserializationError error = deserializeJson(doc, (const char*)data);
     
     if (error) {
-      Log.error("JSON parse error: ");
-      Log.errorln(error.c_str());
+      LOG_ERROR(LOG_SETTINGS, "JSON parse error: %s", error.c_str());
       request->send(400, "application/json", "{\"error\":\"Invalid JSON\"}");
       return;
     }
     
     if (!doc["latitude"].is<float>() || !doc["longitude"].is<float>()) {
-      Log.errorln("Latitude and longitude must be float values");
+      LOG_ERROR(LOG_SETTINGS, "Latitude and longitude must be float values");
       request->send(400, "application/json", "{\"error\":\"Latitude and longitude must be float values\"}");
       return;
     }
@@ -553,12 +601,12 @@ void setupWebserver()
     
     // Validate coordinates
     if (lat < -90 || lat > 90 || lon < -180 || lon > 180) {
-      Log.errorln("Invalid coordinates");
+      LOG_ERROR(LOG_SETTINGS, "Invalid coordinates");
       request->send(400, "application/json", "{\"error\":\"Invalid coordinates\"}");
       return;
     }
     
-    Log.infoln("Setting location to: %.6f, %.6f", lat, lon);
+    LOG_INFO(LOG_SETTINGS, "Setting location to: %F, %F", lat, lon);
     
     weather_latitude = lat;
     weather_longitude = lon;
@@ -567,8 +615,9 @@ void setupWebserver()
     preferences.putFloat("weather_lat", lat);
     preferences.putFloat("weather_lon", lon);
 
-    Log.infoln("Performing reverse geocoding...");
+    LOG_INFO(LOG_SETTINGS, "Performing reverse geocoding...");
     
+    PowerLock networkLock(POWER_NETWORK);
     WiFiClient wifiClient;
     HTTPClient http;
     String url = String("https://api.bigdatacloud.net/data/reverse-geocode-client?latitude=") + String(lat) + "&longitude=" + String(lon) + "&localityLanguage=en";
@@ -579,7 +628,7 @@ void setupWebserver()
     int httpResponseCode = http.GET();
     if (httpResponseCode == 200) {
       String payload = http.getString();
-      Log.infoln("Reverse geocode response: %s", payload.c_str());
+      LOG_INFO(LOG_SETTINGS, "Reverse geocode response: %s", payload.c_str());
       
       // Parse the response
       JsonDocument geoDoc;
@@ -590,25 +639,23 @@ void setupWebserver()
         preferences.putString("weather_city", weather_city);
         preferences.putString("weather_region", weather_region);
 
-        Log.infoln("Resolved location: %s, %s", weather_city.c_str(), weather_region.c_str());
+        LOG_INFO(LOG_SETTINGS, "Resolved location: %s, %s", weather_city.c_str(), weather_region.c_str());
       } else {
-        Log.error("Reverse geocode JSON parse error: ");
-        Log.errorln(geoError.c_str());
+        LOG_ERROR(LOG_SETTINGS, "Reverse geocode JSON parse error: %s", geoError.c_str());
       }
     } else {
-      Log.error("Reverse geocode HTTP error: ");
-      Log.errorln(String(httpResponseCode).c_str());
+      LOG_ERROR(LOG_SETTINGS, "Reverse geocode HTTP error: %d", httpResponseCode);
     }
     http.end();
 
-    updateWeather(nullptr);
+    publishSettingChanged(SETTING_LOCATION);
     
     request->send(200, "application/json", "{\"status\":\"ok\"}"); });
 
   // Handle IP-based location detection with POST
   server.on("/detectLocation", HTTP_POST, [](AsyncWebServerRequest *request) {}, NULL, [](AsyncWebServerRequest *request, uint8_t *data, size_t len, size_t index, size_t total)
             {
-    Log.infoln("Detecting location via IP geolocation...");
+    LOG_INFO(LOG_SETTINGS, "Detecting location via IP geolocation...");
     
     try
     {
@@ -620,26 +667,27 @@ void setupWebserver()
       
       // Scope HTTPClient to release buffer immediately after reading
       {
+        PowerLock networkLock(POWER_NETWORK);
         HTTPClient http;
         auto rc = http.begin("https://ipapi.co/json/");
-        Serial.printf("HTTP begin result: %d\n", rc);
+        LOG_TRACE(LOG_SETTINGS, "HTTP begin result: %d", rc);
         http.addHeader("User-Agent", "Aura-ESP32/1.0");
         http.setTimeout(10000);
 
-        Serial.println("Sending request to ipapi.co...");
+        LOG_TRACE(LOG_SETTINGS, "Sending request to ipapi.co...");
         httpResponseCode = http.GET();
-        Serial.printf("Received HTTP response code: %d\n", httpResponseCode);
+        LOG_INFO(LOG_SETTINGS, "Received HTTP response code: %d", httpResponseCode);
         auto httpSize = http.getSize();
-        Serial.printf("Response size: %d\n", httpSize);
+        LOG_TRACE(LOG_SETTINGS, "Response size: %d", httpSize);
         
         if (httpResponseCode == 200) {
-          Serial.println("Reading response payload...");
+          LOG_TRACE(LOG_SETTINGS, "Reading response payload...");
           payload = http.getString();
           payloadLength = strlen(payload.c_str());
-          Serial.printf("Geolocation response: %s (%d bytes)\n", payload.c_str(), payloadLength);
+          LOG_TRACE(LOG_SETTINGS, "Geolocation response: %s (%d bytes)", payload.c_str(), payloadLength);
         } else if (httpResponseCode == 301 || httpResponseCode == 302) {
           String location = http.getLocation();
-          Log.infoln("Redirect to: %s", location.c_str());
+          LOG_INFO(LOG_SETTINGS, "Redirect to: %s", location.c_str());
         }
       }
       
@@ -669,7 +717,7 @@ void setupWebserver()
           if (lat >= -90 && lat <= 90 && lon >= -180 && lon <= 180) {
             char locationMsg[128];
             snprintf(locationMsg, sizeof(locationMsg), "Location detected: %.6f, %.6f (%s, %s)", lat, lon, city.c_str(), region.c_str());
-            Log.infoln(locationMsg);
+            LOG_INFO(LOG_SETTINGS, "%s", locationMsg);
             
             // Update global variables
             weather_latitude = lat;
@@ -688,7 +736,7 @@ void setupWebserver()
             preferences.putString("utc_offset", utcOffset);
             
             // Trigger weather update with new location
-            updateWeather(nullptr);
+            publishSettingChanged(SETTING_LOCATION);
             
             // Return success with location data
             JsonDocument response;
@@ -705,23 +753,23 @@ void setupWebserver()
             request->send(400, "application/json", "{\"error\":\"Invalid coordinates received\"}");
           }
         } else {
-          Log.errorln("Geolocation JSON parse error: %s", error.c_str());
+          LOG_ERROR(LOG_SETTINGS, "Geolocation JSON parse error: %s", error.c_str());
           request->send(500, "application/json", "{\"error\":\"Failed to parse location data\"}");
         }
       } else if (httpResponseCode == 301 || httpResponseCode == 302) {
         request->send(500, "application/json", "{\"error\":\"Service moved - please update firmware\"}");
       } else {
-        Log.errorln("HTTP error: %d", httpResponseCode);
+        LOG_ERROR(LOG_SETTINGS, "HTTP error: %d", httpResponseCode);
         request->send(500, "application/json", "{\"error\":\"Geolocation service unavailable\"}");
       }
     }
     catch (const std::exception& e)
     {
-      Log.errorln("Exception during geolocation: %s", e.what());
+      LOG_ERROR(LOG_SETTINGS, "Exception during geolocation: %s", e.what());
       request->send(500, "application/json", "{\"error\":\"Exception during geolocation\"}");
     }
   });
 
   server.begin();
-  Log.infoln("Web server started on port 80");
+  LOG_INFO(LOG_SETTINGS, "Web server started on port 80");
 }
@@ -0,0 +1,396 @@
+#include <Arduino.h>
+#include <Preferences.h>
+#include <ArduinoLog.h>
+#include <esp_idf_version.h>
+#include <esp_debug_helpers.h>
+#include "forecast_stall.h"
+#include "forecast_scheduler.h"
+#include "forecast_logging.h"
+
+#if __has_include(<esp_private/freertos_debug.h>)
+#include <esp_private/freertos_debug.h>
+#define STALL_HAS_SNAPSHOT 1
+#elif __has_include(<freertos/task_snapshot.h>)
+#include <freertos/task_snapshot.h>
+#define STALL_HAS_SNAPSHOT 1
+#endif
+
+#if __has_include(<xtensa_context.h>)
+#include <xtensa_context.h>
+#define STALL_HAS_XTENSA_FRAMES 1
+#elif __has_include(<freertos/xtensa_context.h>)
+#include <freertos/xtensa_context.h>
+#define STALL_HAS_XTENSA_FRAMES 1
+#endif
+
+#if defined(STALL_HAS_SNAPSHOT) && defined(STALL_HAS_XTENSA_FRAMES)
+#define STALL_BACKTRACE_SUPPORTED 1
+#endif
+
+#if ESP_IDF_VERSION_MAJOR >= 5
+#define taskRunningOnCore(core) xTaskGetCurrentTaskHandleForCore(core)
+#else
+#define taskRunningOnCore(core) xTaskGetCurrentTaskHandleForCPU(core)
+#endif
+
+static const uint32_t StallMonitorMaxSleepMs = 1000;
+static const uint32_t StallRecoveryPollMs = 250;
+static const uint32_t StallSuspendWaitMs = 20;
+
+struct stallWatch_t
+{
+    const char *name;
+    TaskHandle_t task;
+    uint32_t thresholdMs;
+    volatile uint32_t lastBeatMs;
+    volatile bool parked;
+    const char *volatile site;
+    bool stalled;
+    uint32_t stalledSince;
+    int reportSlot;
+};
+
+static stallWatch_t watches[MaxStallWatches];
+static volatile int watchCount = 0;
+static portMUX_TYPE stallMux = portMUX_INITIALIZER_UNLOCKED;
+
+// Reports live in their own namespace so they survive settings resets and reboots
+static Preferences stallPreferences;
+static stallReport_t reports[MaxStallReports];
+static uint32_t lastReportSequence = 0;
+static stallStats_t stats = {};
+
+static int findWatch(TaskHandle_t task)
+{
+    for (int i = 0; i < watchCount; i++)
+    {
+        if (watches[i].task == task)
+            return i;
+    }
+    return -1;
+}
+
+int registerStallWatch(const char *name, uint32_t thresholdMs)
+{
+    TaskHandle_t task = xTaskGetCurrentTaskHandle();
+    int watch = findWatch(task);
+
+    portENTER_CRITICAL(&stallMux);
+    if (watch < 0 && watchCount < MaxStallWatches)
+    {
+        watch = watchCount;
+        watches[watch] = {};
+        watches[watch].task = task;
+        watchCount = watch + 1;
+    }
+    if (watch >= 0)
+    {
+        watches[watch].name = name;
+        watches[watch].thresholdMs = thresholdMs;
+        watches[watch].lastBeatMs = millis();
+    }
+    portEXIT_CRITICAL(&stallMux);
+
+    return watch;
+}
+
+void stallHeartbeat()
+{
+    int watch = findWatch(xTaskGetCurrentTaskHandle());
+    if (watch >= 0)
+    {
+        watches[watch].lastBeatMs = millis();
+    }
+}
+
+int32_t getHeartbeatAge(int watch, const char **name)
+{
+    if (watch < 0 || watch >= watchCount)
+        return -1;
+
+    if (name != nullptr)
+        *name = watches[watch].name;
+
+    return (int32_t)(millis() - watches[watch].lastBeatMs);
+}
+
+StallSite::StallSite(const char *site) : watch(findWatch(xTaskGetCurrentTaskHandle())), previous(nullptr)
+{
+    if (watch >= 0)
+    {
+        previous = watches[watch].site;
+        watches[watch].site = site;
+    }
+}
+
+StallSite::~StallSite()
+{
+    if (watch >= 0)
+    {
+        watches[watch].site = previous;
+    }
+}
+
+StallParked::StallParked() : watch(findWatch(xTaskGetCurrentTaskHandle()))
+{
+    if (watch >= 0)
+    {
+        watches[watch].parked = true;
+    }
+}
+
+// The beat lands before the flag clears, so the monitor never sees the age of the wait
+StallParked::~StallParked()
+{
+    if (watch >= 0)
+    {
+        watches[watch].lastBeatMs = millis();
+        watches[watch].parked = false;
+    }
+}
+
+static uint32_t processBacktracePc(uint32_t pc)
+{
+    // Windowed call return addresses carry the window size in the top two bits
+    if (pc & 0x80000000)
+    {
+        pc = (pc & 0x3fffffff) | 0x40000000;
+    }
+    return pc - 3;
+}
+
+static uint8_t captureBacktrace(TaskHandle_t task, uint32_t *backtrace)
+{
+#ifdef STALL_BACKTRACE_SUPPORTED
+    // A task running on the other core has no saved context, so park it while we read its stack
+    bool suspended = false;
+    for (BaseType_t core = 0; core < portNUM_PROCESSORS; core++)
+    {
+        if (taskRunningOnCore(core) == task)
+        {
+            vTaskSuspend(task);
+            suspended = true;
+
+            uint32_t waitStarted = millis();
+            while (taskRunningOnCore(core) == task && millis() - waitStarted < StallSuspendWaitMs)
+            {
+                vTaskDelay(1);
+            }
+        }
+    }
+
+    TaskSnapshot_t snapshot = {};
+    vTaskGetSnapshot(task, &snapshot);
+
+    esp_backtrace_frame_t frame = {};
+    const XtExcFrame *exceptionFrame = (const XtExcFrame *)snapshot.pxTopOfStack;
+    if (exceptionFrame->exit != 0)
+    {
+        // Preempted: full interrupt frame
+        frame.pc = exceptionFrame->pc;
+        frame.sp = exceptionFrame->a1;
+        frame.next_pc = exceptionFrame->a0;
+    }
+    else
+    {
+        // Blocked: solicited frame from a voluntary yield
+        const XtSolFrame *solicitedFrame = (const XtSolFrame *)snapshot.pxTopOfStack;
+        frame.pc = solicitedFrame->pc;
+        frame.sp = solicitedFrame->a1;
+        frame.next_pc = solicitedFrame->a0;
+    }
+
+    uint8_t depth = 0;
+    backtrace[depth++] = processBacktracePc(frame.pc);
+    while (depth < StallBacktraceDepth && frame.next_pc != 0 && esp_backtrace_get_next_frame(&frame))
+    {
+        backtrace[depth++] = processBacktracePc(frame.pc);
+    }
+
+    if (suspended)
+    {
+        vTaskResume(task);
+    }
+
+    return depth;
+#else
+    return 0;
+#endif
+}
+
+static void saveReports()
+{
+    stallPreferences.putBytes("reports", reports, sizeof(reports));
+}
+
+static void logReport(const stallReport_t &report)
+{
+    char backtrace[StallBacktraceDepth * 11 + 1] = "";
+    size_t used = 0;
+    for (uint8_t i = 0; i < report.depth && used < sizeof(backtrace); i++)
+    {
+        used += snprintf(backtrace + used, sizeof(backtrace) - used, " 0x%08x", (unsigned)report.backtrace[i]);
+    }
+
+    LOG_WARNING(LOG_JOBS, "Stall #%d on %s: %d ms in job %s at %s, backtrace:%s",
+                report.sequence, report.task, report.durationMs,
+                report.job[0] ? report.job : "-", report.site[0] ? report.site : "-", backtrace);
+}
+
+static void beginStall(stallWatch_t &watch, uint32_t lastBeat)
+{
+    watch.stalled = true;
+    watch.stalledSince = lastBeat;
+
+    uint32_t sequence = ++lastReportSequence;
+    watch.reportSlot = sequence % MaxStallReports;
+
+    stallReport_t &report = reports[watch.reportSlot];
+    report = {};
+    report.sequence = sequence;
+    report.uptimeSeconds = millis() / 1000;
+    strlcpy(report.task, watch.name ? watch.name : "?", sizeof(report.task));
+
+    const char *job = getActiveJobName(watch.task);
+    strlcpy(report.job, job ? job : "", sizeof(report.job));
+
+    const char *site = watch.site;
+    strlcpy(report.site, site ? site : "", sizeof(report.site));
+
+    report.depth = captureBacktrace(watch.task, report.backtrace);
+
+    // Persist now in case the stall ends in a watchdog reset
+    saveReports();
+    logReport(report);
+}
+
+static void endStall(stallWatch_t &watch, uint32_t lastBeat)
+{
+    watch.stalled = false;
+
+    uint32_t duration = lastBeat - watch.stalledSince;
+    stallReport_t &report = reports[watch.reportSlot];
+    report.durationMs = duration;
+    saveReports();
+
+    stats.stalls++;
+    stats.totalStallMs += duration;
+    stats.lastStallMs = duration;
+    if (duration > stats.maxStallMs)
+        stats.maxStallMs = duration;
+
+    logReport(report);
+}
+
+static void stallMonitorTask(void *parameter)
+{
+    while (true)
+    {
+        uint32_t now = millis();
+        uint32_t sleepMs = StallMonitorMaxSleepMs;
+
+        for (int i = 0; i < watchCount; i++)
+        {
+            stallWatch_t &watch = watches[i];
+            if (watch.thresholdMs == 0 || watch.parked)
+                continue;
+
+            uint32_t lastBeat = watch.lastBeatMs;
+            uint32_t age = now - lastBeat;
+
+            if (!watch.stalled)
+            {
+                if (age >= watch.thresholdMs)
+                {
+                    beginStall(watch, lastBeat);
+                    sleepMs = min(sleepMs, StallRecoveryPollMs);
+                }
+                else
+                {
+                    sleepMs = min(sleepMs, watch.thresholdMs - age);
+                }
+            }
+            else if (lastBeat != watch.stalledSince)
+            {
+                endStall(watch, lastBeat);
+            }
+            else
+            {
+                sleepMs = min(sleepMs, StallRecoveryPollMs);
+            }
+        }
+
+        vTaskDelay(pdMS_TO_TICKS(max(sleepMs, (uint32_t)10)));
+    }
+}
+
+stallStats_t getStallStats()
+{
+    return stats;
+}
+
+int getStallReports(stallReport_t *out, int maxReports)
+{
+    int count = 0;
+
+    // Oldest first
+    for (uint32_t sequence = lastReportSequence >= MaxStallReports ? lastReportSequence - MaxStallReports + 1 : 1;
+         sequence <= lastReportSequence && count < maxReports; sequence++)
+    {
+        const stallReport_t &report = reports[sequence % MaxStallReports];
+        if (report.sequence == sequence)
+        {
+            out[count++] = report;
+        }
+    }
+
+    return count;
+}
+
+void logStallStats(lv_timer_t *timer)
+{
+    LOG_INFO(LOG_JOBS, "Stalls: %d, total %d ms, max %d ms, last %d ms",
+             stats.stalls, stats.totalStallMs, stats.maxStallMs, stats.lastStallMs);
+
+    for (int i = 0; i < watchCount; i++)
+    {
+        const char *name;
+        int32_t age = getHeartbeatAge(i, &name);
+        LOG_VERBOSE(LOG_JOBS, "Heartbeat %s: %d ms ago", name, age);
+    }
+}
+
+void setupStallMonitor()
+{
+    stallPreferences.begin("aura2_stall", false);
+    if (stallPreferences.getBytesLength("reports") == sizeof(reports))
+    {
+        stallPreferences.getBytes("reports", reports, sizeof(reports));
+    }
+
+    for (const auto &report : reports)
+    {
+        if (report.sequence > lastReportSequence)
+            lastReportSequence = report.sequence;
+    }
+
+    if (lastReportSequence > 0)
+    {
+        LOG_INFO(LOG_JOBS, "Retained stall reports from previous runs:");
+        stallReport_t retained[MaxStallReports];
+        int count = getStallReports(retained, MaxStallReports);
+        for (int i = 0; i < count; i++)
+        {
+            logReport(retained[i]);
+        }
+    }
+
+    xTaskCreatePinnedToCore(
+        stallMonitorTask,
+        "StallMonitor",
+        4096,
+        nullptr,
+        3,
+        nullptr,
+        0);
+}
@@ -0,0 +1,368 @@
+#include <Arduino.h>
+#include <SPI.h>
+#include <XPT2046_Touchscreen.h>
+#include <ArduinoLog.h>
+#include <esp_timer.h>
+#include <driver/gpio.h>
+#include "forecast_touch.h"
+#include "forecast_preferences.h"
+#include "forecast_loop.h"
+#include "forecast_power.h"
+#include "forecast_logging.h"
+
+#define XPT2046_IRQ 36  // T_IRQ
+#define XPT2046_MOSI 32 // T_DIN
+#define XPT2046_MISO 39 // T_OUT
+#define XPT2046_CLK 25  // T_CLK
+#define XPT2046_CS 33   // T_CS
+
+static const uint16_t TouchRawLimit = 4095;            // 12-bit ADC
+static const int32_t TouchJitterPixels = 2;            // Movement smaller than this is held as the previous point
+static const uint8_t TouchFilterShift = 2;             // IIR weight of 1/4 per new sample
+static const uint8_t TouchFixedShift = 4;              // Fractional bits kept in the IIR state
+static const uint32_t TouchCalibrationSaveMs = 60 * 1000; // Limit NVS writes from auto calibration
+static const uint32_t TouchPollMs = LV_DEF_REFR_PERIOD;   // LVGL's own read period, which scroll throw is tuned to
+
+SPIClass touchscreenSpi = SPIClass(VSPI);
+
+// The IRQ pin is serviced here instead of by the library so presses can be timestamped
+XPT2046_Touchscreen touchscreen(XPT2046_CS);
+
+uint32_t touchSampleIntervalMs = 10;
+
+static touchCalibration_t calibration = {200, 3700, 240, 3800};
+static bool calibrationDirty = false;
+static uint32_t calibrationSavedAt = 0;
+
+static int32_t touchWidth = 320;
+static int32_t touchHeight = 240;
+
+struct touchFilter_t
+{
+    uint16_t rawX[3];
+    uint16_t rawY[3];
+    uint8_t next;  // Slot the next raw sample replaces
+    uint8_t count; // Samples since the press began, saturating; only priming reads it
+    int32_t x; // Fixed point, TouchFixedShift fractional bits
+    int32_t y;
+};
+
+static lv_indev_t *touchIndev = nullptr;
+static touchFilter_t filter = {};
+static bool touchPressed = false;
+static uint32_t lastSampleAt = 0;
+static lv_point_t lastPoint = {0, 0};
+
+// 0 = armed, >0 = IRQ time of a press not yet seen by LVGL, -1 = latency recorded
+static volatile int64_t touchIrqAt = 0;
+static touchStats_t stats = {};
+
+// The IRQ is level triggered so it can end a light sleep; the handler masks it until the
+// pen lifts, or it would fire for as long as a finger is down
+static volatile bool touchIrqMasked = false;
+
+static void IRAM_ATTR touchIrqHandler()
+{
+    gpio_intr_disable((gpio_num_t)XPT2046_IRQ);
+    touchIrqMasked = true;
+
+    if (touchIrqAt == 0)
+    {
+        touchIrqAt = esp_timer_get_time();
+    }
+
+    wakeMainLoopFromISR();
+}
+
+static void rearmTouchIrq()
+{
+    if (touchIrqMasked && digitalRead(XPT2046_IRQ) == HIGH)
+    {
+        touchIrqMasked = false;
+        gpio_intr_enable((gpio_num_t)XPT2046_IRQ);
+    }
+}
+
+static uint16_t median3(uint16_t a, uint16_t b, uint16_t c)
+{
+    if (a > b)
+        std::swap(a, b);
+    if (b > c)
+        std::swap(b, c);
+    return (a > b) ? a : b;
+}
+
+static void resetFilter()
+{
+    filter.count = 0;
+    filter.next = 0;
+}
+
+// Widen the calibration when a filtered sample lands outside it; persisted on release
+static void updateCalibration(uint16_t rawX, uint16_t rawY)
+{
+    if (rawX > TouchRawLimit || rawY > TouchRawLimit)
+        return;
+
+    if (rawX < calibration.minimumX)
+    {
+        calibration.minimumX = rawX;
+        calibrationDirty = true;
+    }
+    if (rawX > calibration.maximumX)
+    {
+        calibration.maximumX = rawX;
+        calibrationDirty = true;
+    }
+    if (rawY < calibration.minimumY)
+    {
+        calibration.minimumY = rawY;
+        calibrationDirty = true;
+    }
+    if (rawY > calibration.maximumY)
+    {
+        calibration.maximumY = rawY;
+        calibrationDirty = true;
+    }
+}
+
+// Median of the last three raw samples rejects single-sample spikes, the IIR smooths the rest
+static void filterSample(uint16_t rawX, uint16_t rawY, int32_t &x, int32_t &y)
+{
+    filter.rawX[filter.next] = rawX;
+    filter.rawY[filter.next] = rawY;
+    filter.next = (filter.next + 1) % 3;
+
+    if (filter.count < 3)
+    {
+        // Prime the window with the first sample so the median is valid immediately
+        for (uint8_t i = filter.count + 1; i < 3; i++)
+        {
+            filter.rawX[i] = rawX;
+            filter.rawY[i] = rawY;
+        }
+    }
+
+    uint16_t medianX = median3(filter.rawX[0], filter.rawX[1], filter.rawX[2]);
+    uint16_t medianY = median3(filter.rawY[0], filter.rawY[1], filter.rawY[2]);
+    updateCalibration(medianX, medianY);
+
+    int32_t mappedX = map(medianX, calibration.minimumX, calibration.maximumX, 0, touchWidth - 1);
+    int32_t mappedY = map(medianY, calibration.minimumY, calibration.maximumY, 0, touchHeight - 1);
+
+    if (filter.count == 0)
+    {
+        filter.x = mappedX << TouchFixedShift;
+        filter.y = mappedY << TouchFixedShift;
+    }
+    else
+    {
+        filter.x += ((mappedX << TouchFixedShift) - filter.x) >> TouchFilterShift;
+        filter.y += ((mappedY << TouchFixedShift) - filter.y) >> TouchFilterShift;
+    }
+
+    if (filter.count < 255)
+        filter.count++;
+
+    x = constrain(filter.x >> TouchFixedShift, 0, touchWidth - 1);
+    y = constrain(filter.y >> TouchFixedShift, 0, touchHeight - 1);
+}
+
+static void saveCalibration()
+{
+    preferences.putUShort("touch_min_x", calibration.minimumX);
+    preferences.putUShort("touch_max_x", calibration.maximumX);
+    preferences.putUShort("touch_min_y", calibration.minimumY);
+    preferences.putUShort("touch_max_y", calibration.maximumY);
+
+    calibrationDirty = false;
+    calibrationSavedAt = millis();
+
+    LOG_INFO(LOG_TOUCH, "Touch calibration saved: x %d-%d, y %d-%d",
+             calibration.minimumX, calibration.maximumX, calibration.minimumY, calibration.maximumY);
+}
+
+static void touchReleased()
+{
+    touchPressed = false;
+    powerLockRelease(POWER_TOUCH);
+    resetFilter();
+    touchIrqAt = 0;
+
+    if (calibrationDirty && (calibrationSavedAt == 0 || millis() - calibrationSavedAt >= TouchCalibrationSaveMs))
+    {
+        saveCalibration();
+    }
+
+    LOG_TRACE(LOG_TOUCH, "Touch released at x %d y %d", lastPoint.x, lastPoint.y);
+}
+
+void touchpadRead(lv_indev_t *indev, lv_indev_data_t *data)
+{
+    uint32_t now = millis();
+
+    // Answer reads arriving faster than the sample interval from the previous sample
+    if (lastSampleAt != 0 && now - lastSampleAt < touchSampleIntervalMs)
+    {
+        stats.rateLimited++;
+        data->point = lastPoint;
+        data->state = touchPressed ? LV_INDEV_STATE_PRESSED : LV_INDEV_STATE_RELEASED;
+        return;
+    }
+    lastSampleAt = now;
+    rearmTouchIrq();
+
+    // T_IRQ idles high, so an idle panel costs a GPIO read instead of an SPI transaction
+    if (!touchPressed && digitalRead(XPT2046_IRQ) == HIGH)
+    {
+        data->point = lastPoint;
+        data->state = LV_INDEV_STATE_RELEASED;
+        return;
+    }
+
+    stats.samples++;
+
+    if (!touchscreen.touched())
+    {
+        if (touchPressed)
+        {
+            touchReleased();
+        }
+
+        data->point = lastPoint;
+        data->state = LV_INDEV_STATE_RELEASED;
+        return;
+    }
+
+    TS_Point p = touchscreen.getPoint();
+
+    int32_t x, y;
+    filterSample(p.x, p.y, x, y);
+
+    if (!touchPressed)
+    {
+        touchPressed = true;
+        powerLockAcquire(POWER_TOUCH);
+        stats.presses++;
+        lastPoint.x = x;
+        lastPoint.y = y;
+
+        LOG_TRACE(LOG_TOUCH, "Touch pressed at x %d y %d (raw %d, %d)", x, y, p.x, p.y);
+    }
+    else if (abs(x - lastPoint.x) >= TouchJitterPixels || abs(y - lastPoint.y) >= TouchJitterPixels)
+    {
+        lastPoint.x = x;
+        lastPoint.y = y;
+    }
+    else
+    {
+        stats.jitterRejected++;
+    }
+
+    LOG_VERBOSE(LOG_TOUCH, "Touch x %d y %d", lastPoint.x, lastPoint.y);
+
+    data->point = lastPoint;
+    data->state = LV_INDEV_STATE_PRESSED;
+}
+
+// A press the IRQ announced, one in progress, or a scroll still coasting after release
+static bool touchNeedsReading()
+{
+    return touchIrqMasked || touchPressed || lv_indev_get_scroll_obj(touchIndev) != nullptr;
+}
+
+uint32_t readTouch()
+{
+    if (touchIndev == nullptr || !touchNeedsReading())
+        return LV_NO_TIMER_READY;
+
+    // A new press is read at once; after that, at LVGL's own pace
+    uint32_t period = (touchIrqMasked && !touchPressed) ? touchSampleIntervalMs : TouchPollMs;
+    uint32_t elapsed = millis() - lastSampleAt;
+    if (lastSampleAt != 0 && elapsed < period)
+        return period - elapsed;
+
+    lv_indev_read(touchIndev);
+    return touchNeedsReading() ? TouchPollMs : LV_NO_TIMER_READY;
+}
+
+// Measures how long a press takes from the controller IRQ to LVGL acting on it
+static void touchPressedEvent(lv_event_t *e)
+{
+    int64_t irqAt = touchIrqAt;
+    if (irqAt <= 0)
+        return;
+
+    touchIrqAt = -1;
+
+    uint32_t latencyUs = (uint32_t)(esp_timer_get_time() - irqAt);
+    stats.lastLatencyUs = latencyUs;
+    if (latencyUs > stats.maxLatencyUs)
+        stats.maxLatencyUs = latencyUs;
+
+    // Running average over roughly the last eight presses
+    stats.averageLatencyUs = (stats.averageLatencyUs == 0)
+                                 ? latencyUs
+                                 : stats.averageLatencyUs - (stats.averageLatencyUs >> 3) + (latencyUs >> 3);
+
+    LOG_TRACE(LOG_TOUCH, "Touch latency %d us (avg %d us, max %d us)", latencyUs, stats.averageLatencyUs, stats.maxLatencyUs);
+}
+
+touchCalibration_t getTouchCalibration()
+{
+    return calibration;
+}
+
+void setTouchCalibration(const touchCalibration_t &newCalibration)
+{
+    if (newCalibration.minimumX >= newCalibration.maximumX || newCalibration.minimumY >= newCalibration.maximumY ||
+        newCalibration.maximumX > TouchRawLimit || newCalibration.maximumY > TouchRawLimit)
+    {
+        LOG_WARNING(LOG_TOUCH, "Ignoring invalid touch calibration");
+        return;
+    }
+
+    calibration = newCalibration;
+    saveCalibration();
+}
+
+touchStats_t getTouchStats()
+{
+    return stats;
+}
+
+void setupTouch()
+{
+    calibration.minimumX = preferences.getUShort("touch_min_x", calibration.minimumX);
+    calibration.maximumX = preferences.getUShort("touch_max_x", calibration.maximumX);
+    calibration.minimumY = preferences.getUShort("touch_min_y", calibration.minimumY);
+    calibration.maximumY = preferences.getUShort("touch_max_y", calibration.maximumY);
+    touchSampleIntervalMs = preferences.getUInt("touch_rate_ms", touchSampleIntervalMs);
+
+    if (calibration.minimumX >= calibration.maximumX || calibration.minimumY >= calibration.maximumY)
+    {
+        calibration = {200, 3700, 240, 3800};
+    }
+
+    touchscreenSpi.begin(XPT2046_CLK, XPT2046_MISO, XPT2046_MOSI, XPT2046_CS); // Start second SPI bus for touchscreen
+    touchscreen.begin(touchscreenSpi);                                         // Touchscreen init
+    touchscreen.setRotation(1);                                                // Inverted landscape orientation to match screen
+
+    pinMode(XPT2046_IRQ, INPUT);
+    attachInterrupt(digitalPinToInterrupt(XPT2046_IRQ), touchIrqHandler, ONLOW);
+
+    // Let a press end an automatic light sleep. Unlike EXT1, which moves the pad to the RTC
+    // mux on every sleep, GPIO wakeup leaves it where the ISR and digitalRead() see it.
+    gpio_wakeup_enable((gpio_num_t)XPT2046_IRQ, GPIO_INTR_LOW_LEVEL);
+
+    touchWidth = lv_display_get_horizontal_resolution(lv_display_get_default());
+    touchHeight = lv_display_get_vertical_resolution(lv_display_get_default());
+
+    // Read from the loop through readTouch() instead of LVGL's read timer, so an idle
+    // panel does not wake the loop every LV_DEF_REFR_PERIOD
+    touchIndev = lv_indev_create();
+    lv_indev_set_type(touchIndev, LV_INDEV_TYPE_POINTER);
+    lv_indev_set_read_cb(touchIndev, touchpadRead);
+    lv_indev_set_mode(touchIndev, LV_INDEV_MODE_EVENT);
+    lv_indev_add_event_cb(touchIndev, touchPressedEvent, LV_EVENT_PRESSED, nullptr);
+}
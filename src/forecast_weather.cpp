@@ -7,6 +7,12 @@
 #include "forecast_widgets.h"
 #include "forecast_preferences.h"
 #include "forecast_mqtt.h"
+#include "forecast_power.h"
+#include "forecast_stall.h"
+#include "forecast_logging.h"
+#include "forecast_fleet.h"
+#include "forecast_events.h"
+#include "forecast_scheduler.h"
 #include "ui/ui.h"
 
 float temperature_now = 0.0;
@@ -262,129 +268,223 @@ String hourOfDay(int hour)
     }
 }
 
-void updateWeather(lv_timer_t *timer)
+// The forecast on screen, kept so it can be redrawn without fetching it again; loop task only
+static forecast_t currentForecast;
+static bool hasForecast = false;
+
+// The weather job fetches on a background task and hands each new forecast to the loop
+// task here, announced through uiMailbox
+static portMUX_TYPE forecastMux = portMUX_INITIALIZER_UNLOCKED;
+static forecast_t pendingForecast;
+static bool forecastPending = false;
+
+// The newest forecast handed over; weather job only
+static uint32_t handedOverAt = 0;
+static bool handedOver = false;
+
+static int weatherJob = -1;
+
+static float toDisplayUnit(float celsius)
+{
+    return use_fahrenheit ? celsius * 9.0 / 5.0 + 32.0 : celsius;
+}
+
+static bool parseForecast(JsonDocument &doc, forecast_t &forecast)
+{
+    JsonArray times = doc["daily"]["time"].as<JsonArray>();
+    JsonArray tmin = doc["daily"]["temperature_2m_min"].as<JsonArray>();
+    JsonArray tmax = doc["daily"]["temperature_2m_max"].as<JsonArray>();
+    JsonArray weather_codes = doc["daily"]["weather_code"].as<JsonArray>();
+    JsonArray hours = doc["hourly"]["time"].as<JsonArray>();
+    JsonArray hourly_temps = doc["hourly"]["temperature_2m"].as<JsonArray>();
+    JsonArray precipitation_probabilities = doc["hourly"]["precipitation_probability"].as<JsonArray>();
+    JsonArray hourly_weather_codes = doc["hourly"]["weather_code"].as<JsonArray>();
+    JsonArray hourly_is_day = doc["hourly"]["is_day"].as<JsonArray>();
+
+    if (times.size() < ForecastDays || hours.size() < ForecastHours)
+    {
+        return false;
+    }
+
+    time_t now = time(nullptr);
+    forecast.fetchedAt = now > 1600000000 ? (uint32_t)now : 0;
+    forecast.temperature = doc["current"]["temperature_2m"].as<float>();
+    forecast.feelsLike = doc["current"]["apparent_temperature"].as<float>();
+    forecast.code = doc["current"]["weather_code"].as<int>();
+    forecast.isDay = doc["current"]["is_day"].as<int>();
+
+    for (int i = 0; i < ForecastDays; i++)
+    {
+        const char *date = times[i] | "2000-01-01"; // "YYYY-MM-DD"
+        forecastDay_t &day = forecast.days[i];
+        day.year = atoi(date + 0);
+        day.month = atoi(date + 5);
+        day.day = atoi(date + 8);
+        day.minimum = tmin[i].as<float>();
+        day.maximum = tmax[i].as<float>();
+        day.code = weather_codes[i].as<int>();
+    }
+
+    for (int i = 0; i < ForecastHours; i++)
+    {
+        const char *date = hours[i] | "2000-01-01T00:00"; // "YYYY-MM-DDTHH:MM"
+        forecastHour_t &hour = forecast.hours[i];
+        hour.hour = atoi(date + 11);
+        hour.temperature = hourly_temps[i].as<float>();
+        hour.precipitation = precipitation_probabilities[i].as<int>();
+        hour.code = hourly_weather_codes[i].as<int>();
+        hour.isDay = hourly_is_day[i].as<int>();
+    }
+
+    return true;
+}
+
+static void renderForecast(const forecast_t &forecast)
 {
     auto strings = get_strings(LANG_EN);
+    char unit = use_fahrenheit ? 'F' : 'C';
+    lv_label_set_text_fmt(objects.current_temperature_label, "%.0f°%c", toDisplayUnit(forecast.temperature), unit);
+    lv_label_set_text_fmt(objects.feels_temperature_label, "%.0f°%c", toDisplayUnit(forecast.feelsLike), unit);
+    lv_img_set_src(objects.current_conditions_image, chooseImage(forecast.code, forecast.isDay));
+
+    if (display_seven_day_forecast)
+    {
+        lv_label_set_text(objects.forecast_type_label, strings->seven_day_forecast);
+
+        for (int i = 0; i < ForecastDays; i++)
+        {
+            const forecastDay_t &day = forecast.days[i];
+            int dow = dayOfWeek(day.year, day.month, day.day);
+            const char *dayStr = (i == 0) ? strings->today : strings->weekdays[dow];
+
+            lv_label_set_text_fmt(forecast_datetime_label[i], "%s", dayStr);
+            lv_label_set_text_fmt(forecast_temp_label[i], "%.0f°%c", toDisplayUnit(day.maximum), unit);
+            lv_label_set_text_fmt(forecast_precip_low_label[i], "%.0f°%c", toDisplayUnit(day.minimum), unit);
+            lv_img_set_src(forecast_visibility_image[i], chooseIcon(day.code, (i == 0) ? forecast.isDay : 1));
+        }
+    }
+    else
+    {
+        lv_label_set_text(objects.forecast_type_label, strings->hourly_forecast);
+
+        for (int i = 0; i < ForecastHours; i++)
+        {
+            const forecastHour_t &hour = forecast.hours[i];
+            if (i == 0)
+            {
+                lv_label_set_text(forecast_datetime_label[i], strings->now);
+            }
+            else
+            {
+                lv_label_set_text(forecast_datetime_label[i], hourOfDay(hour.hour).c_str());
+            }
+            lv_label_set_text_fmt(forecast_temp_label[i], "%.0f°%c", toDisplayUnit(hour.temperature), unit);
+            lv_label_set_text_fmt(forecast_precip_low_label[i], "%d%%", hour.precipitation);
+            lv_img_set_src(forecast_visibility_image[i], chooseIcon(hour.code, hour.isDay));
+        }
+    }
+}
+
+// Shows a forecast that just arrived, fetched here or shared by another device; runs on the
+// loop task
+static void applyForecast(const forecast_t &forecast)
+{
+    currentForecast = forecast;
+    hasForecast = true;
+
+    temperature_now = forecast.temperature;
+    feels_like_temperature = forecast.feelsLike;
+    publishSensorState();
+
+    renderForecast(forecast);
+}
+
+static void forecastReady(event_t event, const eventData_t &data)
+{
+    forecast_t forecast;
+    portENTER_CRITICAL(&forecastMux);
+    bool pending = forecastPending;
+    if (pending)
+        forecast = pendingForecast;
+    forecastPending = false;
+    portEXIT_CRITICAL(&forecastMux);
+
+    if (pending)
+        applyForecast(forecast);
+}
+
+// A newer forecast replaces one the loop has not taken yet
+static void handOverForecast(const forecast_t &forecast)
+{
+    portENTER_CRITICAL(&forecastMux);
+    pendingForecast = forecast;
+    forecastPending = true;
+    portEXIT_CRITICAL(&forecastMux);
+
+    handedOverAt = forecast.fetchedAt;
+    handedOver = true;
+    eventBus.publish(EVENT_FORECAST_READY);
+}
+
+static void requestWeatherUpdate()
+{
+    if (weatherJob < 0)
+        weatherJob = findJob("weather");
+    runJobNow(weatherJob);
+}
+
+// The weather job; runs on a background task and never touches LVGL
+void updateWeather(lv_timer_t *timer)
+{
+    // In fleet mode the lease holder fetches and everyone else renders what it shares
+    forecast_t shared;
+    if (takeSharedForecast(shared) && (!handedOver || (int32_t)(shared.fetchedAt - handedOverAt) > 0))
+    {
+        LOG_INFO(LOG_WEATHER, "Showing the forecast shared by the fleet");
+        handOverForecast(shared);
+    }
+
+    if (!fleetShouldFetch())
+    {
+        return;
+    }
+
     auto latitude = String(weather_latitude);
     auto longitude = String(weather_longitude);
 
     String url = String("http://api.open-meteo.com/v1/forecast?latitude=") + latitude + "&longitude=" + longitude + "&current=temperature_2m,apparent_temperature,is_day,weather_code" + "&daily=temperature_2m_min,temperature_2m_max,weather_code" + "&hourly=temperature_2m,precipitation_probability,is_day,weather_code" + "&forecast_hours=7" + "&timezone=auto";
 
+    PowerLock networkLock(POWER_NETWORK);
+
     HTTPClient http;
     http.begin(url);
 
-    Log.infoln("Fetching weather data for lat=%s, lon=%s", latitude.c_str(), longitude.c_str());
+    LOG_INFO(LOG_WEATHER, "Fetching weather data for lat=%s, lon=%s", latitude.c_str(), longitude.c_str());
+    StallSite site("weather.http");
     auto status = http.GET();
     if (status == HTTP_CODE_OK)
     {
-        Log.infoln("Updated weather from open-meteo: %s", url.c_str());
+        LOG_INFO(LOG_WEATHER, "Updated weather from open-meteo: %s", url.c_str());
 
         String payload = http.getString();
         JsonDocument doc;
+        forecast_t forecast;
 
-        if (deserializeJson(doc, payload) == DeserializationError::Ok)
+        if (deserializeJson(doc, payload) == DeserializationError::Ok && parseForecast(doc, forecast))
         {
-            float t_now = doc["current"]["temperature_2m"].as<float>();
-            float t_ap = doc["current"]["apparent_temperature"].as<float>();
-            int code_now = doc["current"]["weather_code"].as<int>();
-            int is_day = doc["current"]["is_day"].as<int>();
-
-            temperature_now = t_now;
-            feels_like_temperature = t_ap;
-            
-            if (use_fahrenheit)
-            {
-                t_now = t_now * 9.0 / 5.0 + 32.0;
-                t_ap = t_ap * 9.0 / 5.0 + 32.0;
-            }
-
-            char unit = use_fahrenheit ? 'F' : 'C';
-            lv_label_set_text_fmt(objects.current_temperature_label, "%.0f°%c", t_now, unit);
-            lv_label_set_text_fmt(objects.feels_temperature_label, "%.0f°%c", t_ap, unit);
-            lv_img_set_src(objects.current_conditions_image, chooseImage(code_now, is_day));
-
-            if (display_seven_day_forecast)
-            {
-                lv_label_set_text(objects.forecast_type_label, strings->seven_day_forecast);
-
-                JsonArray times = doc["daily"]["time"].as<JsonArray>();
-                JsonArray tmin = doc["daily"]["temperature_2m_min"].as<JsonArray>();
-                JsonArray tmax = doc["daily"]["temperature_2m_max"].as<JsonArray>();
-                JsonArray weather_codes = doc["daily"]["weather_code"].as<JsonArray>();
-
-                for (int i = 0; i < 7; i++)
-                {
-                    const char *date = times[i];
-                    int year = atoi(date + 0);
-                    int mon = atoi(date + 5);
-                    int dayd = atoi(date + 8);
-                    int dow = dayOfWeek(year, mon, dayd);
-                    const char *dayStr = (i == 0) ? strings->today : strings->weekdays[dow];
-
-                    float mn = tmin[i].as<float>();
-                    float mx = tmax[i].as<float>();
-                    if (use_fahrenheit)
-                    {
-                        mn = mn * 9.0 / 5.0 + 32.0;
-                        mx = mx * 9.0 / 5.0 + 32.0;
-                    }
-
-                    lv_label_set_text_fmt(forecast_datetime_label[i], "%s", dayStr);
-                    lv_label_set_text_fmt(forecast_temp_label[i], "%.0f°%c", mx, unit);
-                    lv_label_set_text_fmt(forecast_precip_low_label[i], "%.0f°%c", mn, unit);
-                    lv_img_set_src(forecast_visibility_image[i], chooseIcon(weather_codes[i].as<int>(), (i == 0) ? is_day : 1));
-                }
-            }
-            else
-            {
-                lv_label_set_text(objects.forecast_type_label, strings->hourly_forecast);
-
-                JsonArray hours = doc["hourly"]["time"].as<JsonArray>();
-                JsonArray hourly_temps = doc["hourly"]["temperature_2m"].as<JsonArray>();
-                JsonArray precipitation_probabilities = doc["hourly"]["precipitation_probability"].as<JsonArray>();
-                JsonArray hourly_weather_codes = doc["hourly"]["weather_code"].as<JsonArray>();
-                JsonArray hourly_is_day = doc["hourly"]["is_day"].as<JsonArray>();
-
-                for (int i = 0; i < 7; i++)
-                {
-                    const char *date = hours[i]; // "YYYY-MM-DD"
-                    int hour = atoi(date + 11);
-                    int minute = atoi(date + 14);
-                    String hour_name = hourOfDay(hour);
-
-                    float precipitation_probability = precipitation_probabilities[i].as<float>();
-                    float temp = hourly_temps[i].as<float>();
-                    if (use_fahrenheit)
-                    {
-                        temp = temp * 9.0 / 5.0 + 32.0;
-                    }
-
-                    if (i == 0)
-                    {
-                        lv_label_set_text(forecast_datetime_label[i], strings->now);
-                    }
-                    else
-                    {
-                        lv_label_set_text(forecast_datetime_label[i], hour_name.c_str());
-                    }
-                    lv_label_set_text_fmt(forecast_temp_label[i], "%.0f°%c", temp, unit);
-                    lv_label_set_text_fmt(forecast_precip_low_label[i], "%.0f%%", precipitation_probability);
-                    lv_img_set_src(forecast_visibility_image[i], chooseIcon(hourly_weather_codes[i].as<int>(), hourly_is_day[i].as<int>()));
-                }
-            }
+            handOverForecast(forecast);
+            shareForecast(forecast);
         }
         else
         {
-            Log.errorln("JSON parse failed on result from %s", url.c_str());
+            LOG_ERROR(LOG_WEATHER, "JSON parse failed on result from %s", url.c_str());
         }
     }
     else
     {
-        Log.errorln("HTTP GET failed at %s with status %d", url.substring(0, 50).c_str(), status);
+        LOG_ERROR(LOG_WEATHER, "HTTP GET failed at %s with status %d", url.substring(0, 50).c_str(), status);
     }
     http.end();
-
-    publishSensorState();
 }
 
 void toggleSevenDayForecast()
@@ -392,5 +492,33 @@ void toggleSevenDayForecast()
     display_seven_day_forecast = !display_seven_day_forecast;
     preferences.putBool("display_7day", display_seven_day_forecast);
 
-    updateWeather(nullptr);
+    // Redraw what is already known rather than fetch it again
+    if (hasForecast)
+    {
+        renderForecast(currentForecast);
+        return;
+    }
+
+    requestWeatherUpdate();
+}
+
+// Runs on the loop task through uiMailbox. A unit change only needs a redraw; a new
+// location needs a fetch, which the weather job does.
+static void weatherSettingChanged(event_t event, const eventData_t &data)
+{
+    if (data.setting == SETTING_TEMPERATURE_UNIT && hasForecast)
+    {
+        // Not applyForecast(): the readings are not new, so MQTT is not told again
+        renderForecast(currentForecast);
+    }
+    else if (data.setting == SETTING_TEMPERATURE_UNIT || data.setting == SETTING_LOCATION)
+    {
+        requestWeatherUpdate();
+    }
+}
+
+void setupWeather()
+{
+    eventBus.subscribe(EVENT_SETTING_CHANGED, weatherSettingChanged, &uiMailbox);
+    eventBus.subscribe(EVENT_FORECAST_READY, forecastReady, &uiMailbox);
 }
@@ -3,27 +3,31 @@
 #include <ArduinoJson.h>
 #include <lvgl.h>
 #include <TFT_eSPI.h>
-#include <XPT2046_Touchscreen.h>
 #include <Preferences.h>
 #include <WiFiManager.h>
 #include <ESPmDNS.h>
 #include <ArduinoLog.h>
 #include <FS.h>
 #include <LittleFS.h>
-#include <string> // Added for std::string
 #include "ui/ui.h"
 #include "forecast_weather.h"
 #include "forecast_widgets.h"
 #include "forecast_settings.h"
 #include "forecast_mqtt.h"
 #include "forecast_nats.h"
+#include "forecast_diagnostics.h"
+#include "forecast_connectivity.h"
+#include "forecast_mdns.h"
+#include "forecast_fleet.h"
+#include "forecast_events.h"
+#include "forecast_touch.h"
+#include "forecast_loop.h"
+#include "forecast_power.h"
+#include "forecast_scheduler.h"
+#include "forecast_stall.h"
+#include "forecast_logging.h"
 #include "main.h"
 
-#define XPT2046_IRQ 36  // T_IRQ
-#define XPT2046_MOSI 32 // T_DIN
-#define XPT2046_MISO 39 // T_OUT
-#define XPT2046_CLK 25  // T_CLK
-#define XPT2046_CS 33   // T_CS
 #define LCD_BACKLIGHT_PIN 21
 
 // Display configuration - matches EEZ Studio project settings
@@ -38,9 +42,6 @@ lv_obj_t *forecast_precip_low_label[7];
 lv_obj_t *forecast_temp_label[7];
 
 TFT_eSPI tft = TFT_eSPI();
-SPIClass touchscreenSpi = SPIClass(VSPI);
-XPT2046_Touchscreen touchscreen(XPT2046_CS, XPT2046_IRQ);
-uint16_t touchScreenMinimumX = 200, touchScreenMaximumX = 3700, touchScreenMinimumY = 240, touchScreenMaximumY = 3800;
 
 // Forecast preferences
 Preferences preferences;
@@ -64,124 +65,19 @@ String utc_offset = "-0600";
 bool use_dst = true;
 bool use_mqtt = false;
 bool use_nats = false;
+bool use_fleet_weather = false;
 String natsServer = "";
 String natsUser = "";
 String natsPassword = "";
 
-// Logging configuration
-static const int LogLineMax = 1024;
-static const int LogQueueLength = 50;
-QueueHandle_t logQueue;
-
-class QueueLogPrint : public Print
-{
-public:
-  QueueLogPrint(QueueHandle_t q) : queue(q)
-  {
-    buffer.reserve(128);
-  }
-
-  virtual size_t write(uint8_t ch) override
-  {
-    if (ch == '\r')
-      return 1; // ignore CR, handle LF only
-
-    if (ch == '\n')
-    {
-      enqueueLine();  // flush on newline
-      buffer.clear(); 
-      return 1;
-    }
-
-    // If adding this char would exceed max payload, flush first
-    if (buffer.size() + 1 >= static_cast<size_t>(LogLineMax - 1))
-    {
-      enqueueLine();
-      buffer.clear();
-    }
-
-    buffer.push_back(static_cast<char>(ch));
-    return 1;
-  }
-
-  virtual size_t write(const uint8_t *buf, size_t size) override
-  {
-    for (size_t i = 0; i < size; ++i)
-    {
-      write(buf[i]);
-    }
-    return size;
-  }
-
-private:
-  void enqueueLine()
-  {
-    if (buffer.empty())
-      return;
-
-    // Prepare payload: up to LogLineMax-2 chars + '\n' + '\0'
-    char tmp[LogLineMax];
-    size_t len = buffer.size();
-    if (len > static_cast<size_t>(LogLineMax - 2))
-    {
-      len = static_cast<size_t>(LogLineMax - 2);
-    }
-    memcpy(tmp, buffer.data(), len);
-    tmp[len] = '\n';
-    tmp[len + 1] = '\0';
-
-    // Non-blocking send (drop if full)
-    xQueueSend(queue, tmp, 0);
-  }
-
-  QueueHandle_t queue;
-  std::string buffer;
-};
-
-void loggerTask(void *parameter)
-{
-  char line[LogLineMax];
-
-  while (true)
-  {
-    if (xQueueReceive(logQueue, line, portMAX_DELAY))
-    {
-      // Write to Serial
-      Serial.print(line);
-
-      publishLogMessage(line);
-    }
-  }
-}
-
-void setupLogging()
-{
-  setupNats();
-
-  logQueue = xQueueCreate(LogQueueLength, LogLineMax);
-
-  QueueLogPrint *queuePrinter = new QueueLogPrint(logQueue);
-  Log.begin(LOG_LEVEL_VERBOSE, queuePrinter);
-
-  xTaskCreatePinnedToCore(
-      loggerTask,
-      "LoggerTask",
-      4096,
-      nullptr,
-      1,
-      nullptr,
-      1);
-}
-
 void logHeapStats(const char* tag = "HEAP")
 {
   size_t freeHeap = ESP.getFreeHeap();
   size_t maxBlock = ESP.getMaxAllocHeap();
   size_t freeDefault = heap_caps_get_free_size(MALLOC_CAP_DEFAULT);
   size_t largestDefault = heap_caps_get_largest_free_block(MALLOC_CAP_DEFAULT);
-  Serial.printf("[%s] freeHeap=%u maxBlock=%u freeDefault=%u largestDefault=%u\n",
-             tag, (unsigned)freeHeap, (unsigned)maxBlock,
-             (unsigned)freeDefault, (unsigned)largestDefault);
+  LOG_INFO(LOG_SYSTEM, "[%s] freeHeap=%d maxBlock=%d freeDefault=%d largestDefault=%d",
+           tag, (int)freeHeap, (int)maxBlock, (int)freeDefault, (int)largestDefault);
 }
 
 uint64_t getChipId()
@@ -249,13 +145,13 @@ void checkDimTime(lv_timer_t *timer)
 {
   auto goDim = []()
   {
-    analogWrite(LCD_BACKLIGHT_PIN, 0);
+    setBacklightLevel(0);
     dimModeActive = true;
     publishBacklightState();
   };
   auto restoreBrightness = [=]()
   {
-    analogWrite(LCD_BACKLIGHT_PIN, brightness);
+    setBacklightLevel(brightness);
     dimModeActive = false;
     publishBacklightState();
   };
@@ -310,17 +206,37 @@ void updateClock(lv_timer_t *timer)
   lv_label_set_text(objects.current_city_label, weather_city.c_str());
 }
 
+// Runs on the loop task through uiMailbox
+static void displaySettingChanged(event_t event, const eventData_t &data)
+{
+  switch (data.setting)
+  {
+  case SETTING_CLOCK_FORMAT:
+  case SETTING_DAYLIGHT_SAVING:
+  case SETTING_LOCATION:
+    updateClock(nullptr);
+    break;
+  case SETTING_DIM_SCHEDULE:
+    checkDimTime(nullptr);
+    break;
+  default:
+    break;
+  }
+}
+
 // LVGL log callback
 void logPrint(lv_log_level_t level, const char *buf)
 {
   LV_UNUSED(level);
-  Log.infoln(buf);
-  Serial.flush();
+  LOG_INFO(LOG_LVGL, "%s", buf);
 }
 
 // Display flushing callback - TFT_eSPI implementation
 void displayFlush(lv_display_t *display, const lv_area_t *area, uint8_t *color_p)
 {
+  PowerLock flushLock(POWER_FLUSH);
+  StallSite site("display.flush");
+
   uint32_t w = (area->x2 - area->x1 + 1);
   uint32_t h = (area->y2 - area->y1 + 1);
 
@@ -335,52 +251,21 @@ void displayFlush(lv_display_t *display, const lv_area_t *area, uint8_t *color_p
 void forceDisplayUpdate()
 {
   delay(100);
-  lv_tick_inc(100);
   lv_timer_handler();
 }
 
-void touchpadRead(lv_indev_t *indev, lv_indev_data_t *data)
-{
-  if (touchscreen.touched())
-  {
-    TS_Point p = touchscreen.getPoint();
-    // Some very basic auto calibration so it doesn't go out of range
-    if (p.x < touchScreenMinimumX)
-      touchScreenMinimumX = p.x;
-    if (p.x > touchScreenMaximumX)
-      touchScreenMaximumX = p.x;
-    if (p.y < touchScreenMinimumY)
-      touchScreenMinimumY = p.y;
-    if (p.y > touchScreenMaximumY)
-      touchScreenMaximumY = p.y;
-    // Map this to the pixel position
-    data->point.x = map(p.x, touchScreenMinimumX, touchScreenMaximumX, 1, screenWidth);  /* Touchscreen X calibration */
-    data->point.y = map(p.y, touchScreenMinimumY, touchScreenMaximumY, 1, screenHeight); /* Touchscreen Y calibration */
-    data->state = LV_INDEV_STATE_PRESSED;
-
-    Serial.print("Touch x ");
-    Serial.print(data->point.x);
-    Serial.print(" y ");
-    Serial.println(data->point.y);
-  }
-  else
-  {
-    data->state = LV_INDEV_STATE_RELEASED;
-  }
-}
-
 WiFiManager wifiManager;
 bool saveConfigCalledShouldReboot = false;
 
 void saveConfigCallback()
 {
-  Serial.println("***** saveConfigCallback called *****");
+  LOG_INFO(LOG_SYSTEM, "***** saveConfigCallback called *****");
   saveConfigCalledShouldReboot = true;
 }
 
 bool isWiFiConfigValid()
 {
-  Serial.println("Testing WiFi connection to: " + WiFi.SSID());
+  LOG_INFO(LOG_SYSTEM, "Testing WiFi connection to: %s", WiFi.SSID().c_str());
 
   // Try to connect with timeout
   WiFi.begin(); // Use saved credentials
@@ -391,18 +276,16 @@ bool isWiFiConfigValid()
   {
     delay(500);
     attempts++;
-    Serial.print(".");
   }
-  Serial.println();
 
   bool connected = (WiFi.status() == WL_CONNECTED);
   if (connected)
   {
-    Serial.println("WiFi connection test successful");
+    LOG_INFO(LOG_SYSTEM, "WiFi connection test successful after %d attempts", attempts);
   }
   else
   {
-    Serial.println("WiFi connection test failed - status: " + String(WiFi.status()));
+    LOG_WARNING(LOG_SYSTEM, "WiFi connection test failed - status: %d", WiFi.status());
   }
 
   return connected;
@@ -412,7 +295,7 @@ void updateWiFiSplashStatus(const String &status, uint16_t color = TFT_GREEN)
 {
   forceDisplayUpdate();
 
-  Serial.println(status);
+  LOG_INFO(LOG_SYSTEM, "%s", status.c_str());
   lv_label_set_text(objects.startup_status_label, status.c_str());
   lv_obj_set_style_text_color(objects.startup_status_label, lv_color_hex(color), LV_PART_MAIN | LV_STATE_DEFAULT);
 
@@ -421,14 +304,14 @@ void updateWiFiSplashStatus(const String &status, uint16_t color = TFT_GREEN)
 
 void showWiFiSplashScreen()
 {
-  Serial.println("Showing WiFi configuration splash screen...");
+  LOG_INFO(LOG_SYSTEM, "Showing WiFi configuration splash screen...");
 
   String deviceIdLabelText = getDeviceIdentifier();
   lv_label_set_text(objects.device_id_label, deviceIdLabelText.c_str());
 
   if (!isWiFiConfigValid())
   {
-    Serial.println("WiFi configuration is not valid, starting AP mode");
+    LOG_INFO(LOG_SYSTEM, "WiFi configuration is not valid, starting AP mode");
 
     lv_obj_add_flag(objects.no_config_needed, LV_OBJ_FLAG_HIDDEN);
     lv_obj_clear_flag(objects.config_needed, LV_OBJ_FLAG_HIDDEN);
@@ -438,7 +321,7 @@ void showWiFiSplashScreen()
   }
   else
   {
-    Serial.println("WiFi configuration is valid, connecting to WiFi");
+    LOG_INFO(LOG_SYSTEM, "WiFi configuration is valid, connecting to WiFi");
     
     lv_obj_add_flag(objects.config_needed, LV_OBJ_FLAG_HIDDEN);
     lv_obj_clear_flag(objects.no_config_needed, LV_OBJ_FLAG_HIDDEN);
@@ -451,32 +334,30 @@ void showWiFiSplashScreen()
 
   forceDisplayUpdate();
 
-  Serial.println("WiFi splash screen displayed");
+  LOG_INFO(LOG_SYSTEM, "WiFi splash screen displayed");
 }
 
 // WiFiManager callback functions for splash screen updates
 void onWiFiManagerAPStarted(WiFiManager *wifiManager)
 {
   updateWiFiSplashStatus("Hotspot ready. Connect now", TFT_YELLOW);
-  Log.infoln("AP Mode started");
+  LOG_INFO(LOG_SYSTEM, "AP Mode started");
 }
 
 void onWiFiManagerConnected()
 {
   updateWiFiSplashStatus("WiFi connected. Loading...", TFT_GREEN);
-  Log.infoln("WiFi connected via WiFiManager");
+  LOG_INFO(LOG_SYSTEM, "WiFi connected via WiFiManager");
 }
 
 void setupWifi()
 {
-  Serial.println("Connecting to WiFi...");
+  LOG_INFO(LOG_SYSTEM, "Connecting to WiFi...");
 
   // Check if already connected
   if (WiFi.status() == WL_CONNECTED)
   {
-    Serial.println("Already connected to WiFi");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
+    LOG_INFO(LOG_SYSTEM, "Already connected to WiFi, IP address: %s", WiFi.localIP().toString().c_str());
     return;
   }
 
@@ -497,7 +378,7 @@ void setupWifi()
   if (!wifiManager.autoConnect(getDeviceIdentifier().c_str()))
   {
     updateWiFiSplashStatus("WiFi setup timeout...", TFT_RED);
-    Serial.println("Failed to connect and hit timeout");
+    LOG_ERROR(LOG_SYSTEM, "Failed to connect and hit timeout");
     delay(3000);
     // Reset and try again
     ESP.restart();
@@ -506,22 +387,19 @@ void setupWifi()
   {
     // Connected successfully
     updateWiFiSplashStatus("WiFi connected successfully...", TFT_GREEN);
-    Serial.println("WiFi connected");
-    Serial.print("IP address: ");
-    Serial.println(WiFi.localIP());
+    LOG_INFO(LOG_SYSTEM, "WiFi connected, IP address: %s", WiFi.localIP().toString().c_str());
     delay(2000); // Show success message briefly
   }
 
   if (saveConfigCalledShouldReboot)
   {
     updateWiFiSplashStatus("Rebooting to apply config...", TFT_YELLOW);
-    Serial.println("Rebooting to apply new configuration...");
+    LOG_INFO(LOG_SYSTEM, "Rebooting to apply new configuration...");
     delay(2000);
     ESP.restart();
   }
 
-  Serial.print("Connected to WiFi: ");
-  Serial.println(WiFi.localIP());
+  LOG_INFO(LOG_SYSTEM, "Connected to WiFi: %s", WiFi.localIP().toString().c_str());
 }
 
 void setupUi()
@@ -567,18 +445,21 @@ void setupUi()
 
 void setupTimers()
 {
-  // Set up LVGL timers for periodic updates
-  auto clock_timer = lv_timer_create(updateClock, 10 * 1000, NULL);            // Update clock every 10 seconds
-  auto weather_timer = lv_timer_create(updateWeather, 10 * 60 * 1000, NULL);   // Update weather every 10 minutes
-  auto dim_timer = lv_timer_create(checkDimTime, 1 * 60 * 1000, NULL);         // Check dim time every minute
-  auto mqtt_timer = lv_timer_create(checkMqttConnection, 5 * 60 * 1000, NULL); // Check MQTT connection every 5 minutes
-  auto nats_timer = lv_timer_create(checkNatsConnection, 5 * 60 * 1000, NULL); // Check NATS connection every 5 minute
-
-  lv_timer_ready(clock_timer);   // Initial clock update
-  lv_timer_ready(weather_timer); // Initial weather update
-  lv_timer_ready(dim_timer);     // Initial dim time check
-  lv_timer_ready(mqtt_timer);    // Initial MQTT connection check
-  lv_timer_ready(nats_timer);    // Initial NATS connection check
+  // UI jobs run inside lv_timer_handler(); background jobs run on their own task so
+  // blocking network calls stay out of the render loop. Fields: name, callback, class,
+  // priority, period, deadline, core. Jobs passed true run immediately.
+  scheduleJob({"clock", updateClock, JOB_UI, 3, 10 * 1000, 1000, 1}, true);                          // Update clock every 10 seconds
+  scheduleJob({"dim", checkDimTime, JOB_UI, 2, 1 * 60 * 1000, 5 * 1000, 1}, true);                   // Check dim time every minute
+  scheduleJob({"weather", updateWeather, JOB_BACKGROUND, 1, 10 * 60 * 1000, 30 * 1000, 0}, true);    // Update weather every 10 minutes
+  scheduleJob({"power_stats", logPowerStats, JOB_BACKGROUND, 0, 1 * 60 * 1000, 5 * 1000, 0});         // Log power statistics every minute
+  scheduleJob({"job_stats", logJobStats, JOB_BACKGROUND, 0, 10 * 60 * 1000, 5 * 1000, 0});            // Log job statistics every 10 minutes
+  scheduleJob({"stall_stats", logStallStats, JOB_BACKGROUND, 0, 10 * 60 * 1000, 5 * 1000, 0});        // Log stall statistics every 10 minutes
+  scheduleJob({"log_stats", logLogStats, JOB_BACKGROUND, 0, 10 * 60 * 1000, 5 * 1000, 0});            // Log logging statistics every 10 minutes
+  scheduleJob({"nats_stats", logNatsStats, JOB_BACKGROUND, 0, 10 * 60 * 1000, 5 * 1000, 0});          // Log NATS statistics every 10 minutes
+  scheduleJob({"mqtt_stats", logMqttStats, JOB_BACKGROUND, 0, 10 * 60 * 1000, 5 * 1000, 0});          // Log MQTT statistics every 10 minutes
+  scheduleJob({"link_stats", logLinkStats, JOB_BACKGROUND, 0, 10 * 60 * 1000, 5 * 1000, 0});          // Log reconnect statistics every 10 minutes
+  scheduleJob({"mdns_stats", logMdnsStats, JOB_BACKGROUND, 0, 10 * 60 * 1000, 5 * 1000, 0});          // Log mDNS cache statistics every 10 minutes
+  scheduleJob({"fleet_stats", logFleetStats, JOB_BACKGROUND, 0, 10 * 60 * 1000, 5 * 1000, 0});        // Log fleet weather statistics every 10 minutes
 }
 
 void setupClock()
@@ -591,14 +472,14 @@ void setupClock()
   // Convert to seconds for configTime()
   long offsetSeconds = (offsetHours * 3600) + (offsetMinutes * 60);
 
-  Log.infoln("Setting up NTP with timezone: %s", time_zone.c_str());
-  Log.infoln("UTC offset: %s%s", utc_offset.c_str(), use_dst ? " (DST active)" : " (Standard time)");
-  Log.infoln("Effective offset: %d seconds", offsetSeconds);
+  LOG_INFO(LOG_SYSTEM, "Setting up NTP with timezone: %s", time_zone.c_str());
+  LOG_INFO(LOG_SYSTEM, "UTC offset: %s%s", utc_offset.c_str(), use_dst ? " (DST active)" : " (Standard time)");
+  LOG_INFO(LOG_SYSTEM, "Effective offset: %d seconds", offsetSeconds);
 
   // Initialize NTP time synchronization with offset
   configTime(offsetSeconds, 0, "pool.ntp.org", "time.nist.gov");
 
-  Log.infoln("Initializing NTP time synchronization");
+  LOG_INFO(LOG_SYSTEM, "Initializing NTP time synchronization");
 
   // Wait for time to be set
   struct tm timeinfo;
@@ -606,21 +487,21 @@ void setupClock()
   const int retry_count = 10;
   while (!getLocalTime(&timeinfo) && retry < retry_count)
   {
-    Log.infoln("Failed to obtain time, retrying");
+    LOG_INFO(LOG_SYSTEM, "Failed to obtain time, retrying");
     delay(2000);
     retry++;
   }
 
   if (retry < retry_count)
   {
-    Log.infoln("Time synchronized successfully");
+    LOG_INFO(LOG_SYSTEM, "Time synchronized successfully");
     char buf[64];
     strftime(buf, 64, "%c", &timeinfo);
-    Log.infoln("Current time: %s", buf);
+    LOG_INFO(LOG_SYSTEM, "Current time: %s", buf);
   }
   else
   {
-    Log.infoln("Failed to synchronize time after retries");
+    LOG_INFO(LOG_SYSTEM, "Failed to synchronize time after retries");
   }
 
   updateClock(NULL); // Initial clock update
@@ -628,50 +509,56 @@ void setupClock()
 
 void setupMdns()
 {
-  Log.infoln("Setting up mDNS responder...");
+  LOG_INFO(LOG_SYSTEM, "Setting up mDNS responder...");
+  StallSite site("mdns.begin");
   while (!MDNS.begin(getDeviceIdentifier().c_str()))
   {
-    Log.infoln("Error setting up MDNS responder...");
+    LOG_INFO(LOG_SYSTEM, "Error setting up MDNS responder...");
     delay(1000);
   }
-  Log.infoln("mDNS responder started");
+  LOG_INFO(LOG_SYSTEM, "mDNS responder started");
 
   MDNS.addService("http", "tcp", 80);
   MDNS.enableArduino();
+
+  // Browsing for services happens on the resolver's own task
+  setupMdnsResolver();
 }
 
 void setupLittleFS()
 {
   if (!LittleFS.begin(false, "/littlefs"))
   {
-    Serial.println("LittleFS mount failed");
+    LOG_ERROR(LOG_SYSTEM, "LittleFS mount failed");
   }
   else
   {
-    Serial.println("LittleFS mounted successfully to /littlefs");
-    Serial.printf("Total: %u bytes, Used: %u bytes\n", (uint32_t)LittleFS.totalBytes(), (uint32_t)LittleFS.usedBytes());
+    LOG_INFO(LOG_SYSTEM, "LittleFS mounted successfully to /littlefs");
+    LOG_INFO(LOG_SYSTEM, "Total: %d bytes, Used: %d bytes", (int)LittleFS.totalBytes(), (int)LittleFS.usedBytes());
 
     // Test file access via VFS (how LVGL does it)
     FILE *f = fopen("/littlefs/index.html", "r");
     if (f)
     {
-      Serial.println("VFS test: Successfully opened /littlefs/index.html via fopen");
+      LOG_INFO(LOG_SYSTEM, "VFS test: Successfully opened /littlefs/index.html via fopen");
       fclose(f);
     }
     else
     {
-      Serial.println("VFS test: FAILED to open /littlefs/index.html via fopen");
+      LOG_ERROR(LOG_SYSTEM, "VFS test: FAILED to open /littlefs/index.html via fopen");
     }
   }
 }
 
 void setup()
 {
-  Serial.begin(115200);
-  Serial.println("Aura2 Starting...");
+  preferences.begin("aura2", false);
+
+  // Everything after this logs through the logger task, which owns Serial
+  setupLogging();
+  LOG_INFO(LOG_SYSTEM, "Aura2 Starting...");
 
   // Load saved preferences early so all systems use current data
-  preferences.begin("aura2", false);
   display_seven_day_forecast = preferences.getBool("display_7day", display_seven_day_forecast);
   mqttServer = preferences.getString("mqtt_server", mqttServer);
   mqttUser = preferences.getString("mqtt_user", mqttUser);
@@ -691,6 +578,7 @@ void setup()
   use_dst = preferences.getBool("use_dst", use_dst);
   use_mqtt = preferences.getBool("use_mqtt", use_mqtt);
   use_nats = preferences.getBool("use_nats", use_nats);
+  use_fleet_weather = preferences.getBool("fleet_weather", use_fleet_weather);
   natsServer = preferences.getString("nats_server", natsServer);
   natsUser = preferences.getString("nats_user", natsUser);
   natsPassword = preferences.getString("nats_password", natsPassword);
@@ -700,7 +588,7 @@ void setup()
 
   auto tft_width = tft.width();
   auto tft_height = tft.height();
-  Serial.println("TFT initialized. Width: " + String(tft_width) + " Height: " + String(tft_height));
+  LOG_INFO(LOG_SYSTEM, "TFT initialized. Width: %d Height: %d", tft_width, tft_height);
 
   tft.fillScreen(TFT_BLACK);
 
@@ -717,17 +605,15 @@ void setup()
 
   tft_width = tft.width();
   tft_height = tft.height();
-  Serial.println("TFT after rotation. Width: " + String(tft_width) + " Height: " + String(tft_height));
-
-  // Initialize the touchscreen
-  touchscreenSpi.begin(XPT2046_CLK, XPT2046_MISO, XPT2046_MOSI, XPT2046_CS); // Start second SPI bus for touchscreen
-  touchscreen.begin(touchscreenSpi);                                         // Touchscreen init
-  touchscreen.setRotation(1);                                                // Inverted landscape orientation to match screen
+  LOG_INFO(LOG_SYSTEM, "TFT after rotation. Width: %d Height: %d", tft_width, tft_height);
 
   // Initialize LVGL
   lv_init();
   lv_log_register_print_cb(logPrint);
 
+  // Drive LVGL from esp_timer and let the loop sleep until the next deadline
+  setupLoop();
+
   // Create display (LVGL 9.x API)
   lv_display_t *display = lv_display_create(screenWidth, screenHeight);
 
@@ -737,48 +623,62 @@ void setup()
   // Set display flush callback
   lv_display_set_flush_cb(display, displayFlush);
 
-  // Set up touch input device
-  lv_indev_t *indev_touchpad = lv_indev_create();
-  lv_indev_set_type(indev_touchpad, LV_INDEV_TYPE_POINTER);
-  lv_indev_set_read_cb(indev_touchpad, touchpadRead);
+  // Set up touch input device with the persisted calibration
+  setupTouch();
 
   // Set up everything else
   setupUi();
+  setupConnectivity();
   setupWifi();
   setupLittleFS();
-  setupLogging();
+  setupNats();
+  setupDiagnostics();
+  setupPower();
+  setupStallMonitor();
   setupMdns();
+  setupFleetWeather();
   setupMqtt();
   setupClock();
+
+  // Settings changes from the web server reach the screen through the loop task
+  setupWeather();
+  eventBus.subscribe(EVENT_SETTING_CHANGED, displaySettingChanged, &uiMailbox);
   setupWebserver();
   setupTimers();
 
   loadScreen(SCREEN_ID_WEATHER);
-  updateWeather(NULL);
 
-  Log.infoln("UI initialized and ready");
-  Log.infoln("Setup complete");
+  LOG_INFO(LOG_SYSTEM, "UI initialized and ready");
+  LOG_INFO(LOG_SYSTEM, "Setup complete");
+
+  // Watch loop() only from here: setup() runs on the same task and may legitimately take
+  // longer than the threshold, e.g. while WiFiManager waits for credentials
+  registerStallWatch("loop", LoopStallThresholdMs);
 }
 
 void loop()
 {
-  const uint32_t delayMs = 10;
+  // Tell the stall monitor the loop is still turning
+  stallHeartbeat();
 
-  // CRITICAL: Tell LVGL how much time has passed
-  lv_tick_inc(delayMs);
+  uint32_t idleMs;
+  {
+    PowerLock renderLock(POWER_RENDER);
+    StallSite site("lvgl");
 
-  // Handle LVGL tasks
-  lv_timer_handler();
+    // Run what other tasks handed to the UI, such as settings changes
+    uiMailbox.dispatch();
 
-  // Handle EEZ Studio UI updates
-  ui_tick();
+    // Pass LVGL a touch read if the IRQ fired or a press is in progress
+    uint32_t touchMs = readTouch();
 
-  // Handle MQTT tasks
-  loopMqtt();
+    // Handle LVGL tasks; returns how long until the next LVGL timer is due
+    idleMs = min(lv_timer_handler(), touchMs);
 
-  // Handle NATS tasks
-  loopNats();
+    // Handle EEZ Studio UI updates
+    ui_tick();
+  }
 
-  // Small delay to prevent watchdog issues
-  delay(delayMs);
+  // Sleep until the next LVGL deadline, a network event or a touch
+  waitForNextEvent(idleMs);
 }
@@ -0,0 +1,223 @@
+#include <unity.h>
+#include <cmath>
+#include <cstring>
+#include "FleetForecast.h"
+
+static forecast_t sample;
+
+void setUp()
+{
+    memset(&sample, 0, sizeof(sample));
+    sample.fetchedAt = 1760000000;
+    sample.temperature = 18.5f;
+    sample.feelsLike = -3.2f;
+    sample.code = 61;
+    sample.isDay = 1;
+    for (int i = 0; i < ForecastDays; i++)
+    {
+        sample.days[i] = {(uint16_t)2025, (uint8_t)10, (uint8_t)(9 + i), -1.5f + i, 12.2f + i, (uint8_t)(i * 10)};
+    }
+    for (int i = 0; i < ForecastHours; i++)
+    {
+        sample.hours[i] = {(uint8_t)((22 + i) % 24), 7.1f - i, (uint8_t)(i * 15), (uint8_t)(i + 1), (uint8_t)(i < 2)};
+    }
+}
+
+void tearDown()
+{
+}
+
+static void test_forecast_round_trip()
+{
+    uint8_t wire[ForecastWireMax];
+    size_t length = encodeForecast(sample, "aura-1a2b3c", wire, sizeof(wire));
+    TEST_ASSERT_TRUE(length > 0);
+
+    forecast_t decoded;
+    char publisher[ForecastPublisherMax + 1];
+    TEST_ASSERT_TRUE(decodeForecast(wire, length, decoded, publisher, sizeof(publisher)));
+    TEST_ASSERT_EQUAL_STRING("aura-1a2b3c", publisher);
+
+    TEST_ASSERT_EQUAL_UINT32(sample.fetchedAt, decoded.fetchedAt);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, sample.temperature, decoded.temperature);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, sample.feelsLike, decoded.feelsLike);
+    TEST_ASSERT_EQUAL(sample.code, decoded.code);
+    TEST_ASSERT_EQUAL(sample.isDay, decoded.isDay);
+    for (int i = 0; i < ForecastDays; i++)
+    {
+        TEST_ASSERT_EQUAL(sample.days[i].year, decoded.days[i].year);
+        TEST_ASSERT_EQUAL(sample.days[i].month, decoded.days[i].month);
+        TEST_ASSERT_EQUAL(sample.days[i].day, decoded.days[i].day);
+        TEST_ASSERT_FLOAT_WITHIN(0.05f, sample.days[i].minimum, decoded.days[i].minimum);
+        TEST_ASSERT_FLOAT_WITHIN(0.05f, sample.days[i].maximum, decoded.days[i].maximum);
+        TEST_ASSERT_EQUAL(sample.days[i].code, decoded.days[i].code);
+    }
+    for (int i = 0; i < ForecastHours; i++)
+    {
+        TEST_ASSERT_EQUAL(sample.hours[i].hour, decoded.hours[i].hour);
+        TEST_ASSERT_FLOAT_WITHIN(0.05f, sample.hours[i].temperature, decoded.hours[i].temperature);
+        TEST_ASSERT_EQUAL(sample.hours[i].precipitation, decoded.hours[i].precipitation);
+        TEST_ASSERT_EQUAL(sample.hours[i].code, decoded.hours[i].code);
+        TEST_ASSERT_EQUAL(sample.hours[i].isDay, decoded.hours[i].isDay);
+    }
+}
+
+static void test_publisher_is_cut_to_fit()
+{
+    char longId[64];
+    memset(longId, 'x', sizeof(longId) - 1);
+    longId[sizeof(longId) - 1] = 0;
+
+    uint8_t wire[ForecastWireMax];
+    size_t length = encodeForecast(sample, longId, wire, sizeof(wire));
+    TEST_ASSERT_EQUAL(ForecastWireMax, length);
+
+    forecast_t decoded;
+    char publisher[8];
+    TEST_ASSERT_TRUE(decodeForecast(wire, length, decoded, publisher, sizeof(publisher)));
+    TEST_ASSERT_EQUAL_STRING("xxxxxxx", publisher);
+}
+
+static void test_out_of_range_temperatures_are_clamped()
+{
+    sample.temperature = NAN;
+    sample.feelsLike = 5000.0f;
+    sample.days[0].minimum = -5000.0f;
+
+    uint8_t wire[ForecastWireMax];
+    size_t length = encodeForecast(sample, "a", wire, sizeof(wire));
+    forecast_t decoded;
+    char publisher[4];
+    TEST_ASSERT_TRUE(decodeForecast(wire, length, decoded, publisher, sizeof(publisher)));
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 0.0f, decoded.temperature);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, 3276.7f, decoded.feelsLike);
+    TEST_ASSERT_FLOAT_WITHIN(0.05f, -3276.7f, decoded.days[0].minimum);
+}
+
+static void test_short_buffer_encodes_nothing()
+{
+    uint8_t wire[ForecastWireMax];
+    size_t needed = encodeForecast(sample, "aura", wire, sizeof(wire));
+    TEST_ASSERT_EQUAL(0, encodeForecast(sample, "aura", wire, needed - 1));
+}
+
+static void test_truncated_or_foreign_payloads_are_rejected()
+{
+    uint8_t wire[ForecastWireMax];
+    size_t length = encodeForecast(sample, "aura", wire, sizeof(wire));
+    forecast_t decoded;
+    char publisher[8];
+
+    for (size_t cut = 0; cut < length; cut++)
+    {
+        TEST_ASSERT_FALSE(decodeForecast(wire, cut, decoded, publisher, sizeof(publisher)));
+    }
+
+    wire[0] = ForecastWireVersion + 1;
+    TEST_ASSERT_FALSE(decodeForecast(wire, length, decoded, publisher, sizeof(publisher)));
+}
+
+static void test_lease_payloads()
+{
+    ForecastLease lease(60);
+    TEST_ASSERT_TRUE(lease.observe("aura-a 1000", 11));
+    TEST_ASSERT_EQUAL_STRING("aura-a", lease.holder());
+    TEST_ASSERT_EQUAL_UINT32(1000, lease.expiresAt());
+
+    // Garbage leaves the known lease alone
+    TEST_ASSERT_FALSE(lease.observe("aura-b", 6));
+    TEST_ASSERT_FALSE(lease.observe(" 1000", 5));
+    TEST_ASSERT_FALSE(lease.observe("aura-b soon", 11));
+    TEST_ASSERT_FALSE(lease.observe("aura-b 10x", 10));
+    TEST_ASSERT_EQUAL_STRING("aura-a", lease.holder());
+
+    // An empty retained message clears it
+    TEST_ASSERT_TRUE(lease.observe("", 0));
+    TEST_ASSERT_EQUAL_STRING("", lease.holder());
+    TEST_ASSERT_FALSE(lease.valid(0));
+}
+
+static void test_lease_expires()
+{
+    ForecastLease lease(60);
+    lease.setSelf("aura-b");
+    TEST_ASSERT_TRUE(lease.shouldFetch(1000));
+
+    lease.observe("aura-a 1060", 11);
+    TEST_ASSERT_TRUE(lease.valid(1059));
+    TEST_ASSERT_FALSE(lease.shouldFetch(1059));
+    TEST_ASSERT_FALSE(lease.valid(1060));
+    TEST_ASSERT_TRUE(lease.shouldFetch(1060));
+}
+
+static void test_lease_survives_clock_wrap()
+{
+    ForecastLease lease(60);
+    lease.setSelf("aura-b");
+    lease.observe("aura-a 20", 9);
+    TEST_ASSERT_TRUE(lease.valid(0xfffffff0u));
+    TEST_ASSERT_FALSE(lease.shouldFetch(0xfffffff0u));
+}
+
+static void test_takeover_when_holder_stops()
+{
+    ForecastLease a(60), b(60);
+    a.setSelf("aura-a");
+    b.setSelf("aura-b");
+
+    char payload[48];
+    size_t length = a.claim(1000, payload, sizeof(payload));
+    TEST_ASSERT_EQUAL_STRING("aura-a 1060", payload);
+    TEST_ASSERT_TRUE(a.held(1000));
+    b.observe(payload, length);
+    TEST_ASSERT_FALSE(b.shouldFetch(1030));
+
+    // Renewals keep it
+    length = a.claim(1050, payload, sizeof(payload));
+    b.observe(payload, length);
+    TEST_ASSERT_FALSE(b.shouldFetch(1100));
+
+    // a stops renewing; once the lease runs out b claims and a, back again, defers
+    TEST_ASSERT_TRUE(b.shouldFetch(1110));
+    length = b.claim(1110, payload, sizeof(payload));
+    a.observe(payload, length);
+    TEST_ASSERT_TRUE(b.held(1111));
+    TEST_ASSERT_FALSE(a.held(1111));
+    TEST_ASSERT_FALSE(a.shouldFetch(1111));
+}
+
+static void test_racing_claims_settle_on_the_last_delivered()
+{
+    ForecastLease a(60), b(60);
+    a.setSelf("aura-a");
+    b.setSelf("aura-b");
+
+    char claimA[48], claimB[48];
+    size_t lengthA = a.claim(1000, claimA, sizeof(claimA));
+    size_t lengthB = b.claim(1001, claimB, sizeof(claimB));
+
+    // The broker delivers a's claim, then b's, to both; b's is the retained one
+    a.observe(claimA, lengthA);
+    b.observe(claimA, lengthA);
+    a.observe(claimB, lengthB);
+    b.observe(claimB, lengthB);
+
+    TEST_ASSERT_FALSE(a.shouldFetch(1002));
+    TEST_ASSERT_TRUE(b.shouldFetch(1002));
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_forecast_round_trip);
+    RUN_TEST(test_publisher_is_cut_to_fit);
+    RUN_TEST(test_out_of_range_temperatures_are_clamped);
+    RUN_TEST(test_short_buffer_encodes_nothing);
+    RUN_TEST(test_truncated_or_foreign_payloads_are_rejected);
+    RUN_TEST(test_lease_payloads);
+    RUN_TEST(test_lease_expires);
+    RUN_TEST(test_lease_survives_clock_wrap);
+    RUN_TEST(test_takeover_when_holder_stops);
+    RUN_TEST(test_racing_claims_settle_on_the_last_delivered);
+    return UNITY_END();
+}
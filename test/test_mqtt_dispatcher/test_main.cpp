@@ -0,0 +1,258 @@
+#include <unity.h>
+#include <chrono>
+#include <cstdio>
+#include <sstream>
+#include <string>
+#include <vector>
+#include "MQTTDispatcher.h"
+
+static std::vector<std::string> calls;
+
+static Handler record(const char* name)
+{
+    return [name](std::string_view topic, const uint8_t*, size_t)
+    {
+        calls.push_back(std::string(name) + " " + std::string(topic));
+    };
+}
+
+static int dispatch(const MQTTDispatcher& dispatcher, const char* topic)
+{
+    return dispatcher.dispatch(topic, nullptr, 0);
+}
+
+void setUp()
+{
+    calls.clear();
+}
+
+void tearDown()
+{
+}
+
+static void test_exact_topic()
+{
+    MQTTDispatcher dispatcher;
+    dispatcher.registerHandler("aura/kitchen/backlight/set", record("backlight"));
+
+    TEST_ASSERT_EQUAL(1, dispatch(dispatcher, "aura/kitchen/backlight/set"));
+    TEST_ASSERT_EQUAL(0, dispatch(dispatcher, "aura/kitchen/backlight"));
+    TEST_ASSERT_EQUAL(0, dispatch(dispatcher, "aura/kitchen/backlight/set/now"));
+    TEST_ASSERT_EQUAL(0, dispatch(dispatcher, "aura/hall/backlight/set"));
+    TEST_ASSERT_EQUAL(1, (int)calls.size());
+    TEST_ASSERT_EQUAL_STRING("backlight aura/kitchen/backlight/set", calls[0].c_str());
+}
+
+static void test_plus_matches_one_level()
+{
+    MQTTDispatcher dispatcher;
+    dispatcher.registerHandler("aura/fleet/weather/+/lease", record("lease"));
+
+    TEST_ASSERT_EQUAL(1, dispatch(dispatcher, "aura/fleet/weather/51.50,-0.12/lease"));
+    TEST_ASSERT_EQUAL(1, dispatch(dispatcher, "aura/fleet/weather//lease"));
+    TEST_ASSERT_EQUAL(0, dispatch(dispatcher, "aura/fleet/weather/lease"));
+    TEST_ASSERT_EQUAL(0, dispatch(dispatcher, "aura/fleet/weather/51.50/-0.12/lease"));
+}
+
+static void test_hash_matches_the_rest()
+{
+    MQTTDispatcher dispatcher;
+    dispatcher.registerHandler("aura/#", record("aura"));
+
+    TEST_ASSERT_EQUAL(1, dispatch(dispatcher, "aura/kitchen"));
+    TEST_ASSERT_EQUAL(1, dispatch(dispatcher, "aura/kitchen/backlight/set"));
+    TEST_ASSERT_EQUAL(0, dispatch(dispatcher, "homeassistant/status"));
+}
+
+static void test_hash_matches_its_parent()
+{
+    MQTTDispatcher dispatcher;
+    dispatcher.registerHandler("a/#", record("a"));
+    dispatcher.registerHandler("a/+/#", record("a+"));
+
+    TEST_ASSERT_EQUAL(1, dispatch(dispatcher, "a"));
+    TEST_ASSERT_EQUAL(2, dispatch(dispatcher, "a/b"));
+    TEST_ASSERT_EQUAL(0, dispatch(dispatcher, "ab"));
+}
+
+static void test_system_topics_need_their_own_pattern()
+{
+    MQTTDispatcher dispatcher;
+    dispatcher.registerHandler("#", record("all"));
+    dispatcher.registerHandler("+/broker/uptime", record("plus"));
+    dispatcher.registerHandler("$SYS/#", record("sys"));
+
+    TEST_ASSERT_EQUAL(1, dispatch(dispatcher, "$SYS/broker/uptime"));
+    TEST_ASSERT_EQUAL_STRING("sys $SYS/broker/uptime", calls[0].c_str());
+
+    // Only the first level is special
+    TEST_ASSERT_EQUAL(1, dispatch(dispatcher, "aura/$state"));
+    TEST_ASSERT_EQUAL(2, dispatch(dispatcher, "x/broker/uptime"));
+}
+
+static void test_every_match_fires_once()
+{
+    MQTTDispatcher dispatcher;
+    dispatcher.registerHandler("homeassistant/status", record("first"));
+    dispatcher.registerHandler("homeassistant/status", record("second"));
+    dispatcher.registerHandler("homeassistant/+", record("plus"));
+    dispatcher.registerHandler("#", record("all"));
+
+    TEST_ASSERT_EQUAL(4, dispatch(dispatcher, "homeassistant/status"));
+    TEST_ASSERT_EQUAL(4, (int)calls.size());
+    TEST_ASSERT_EQUAL_STRING("first homeassistant/status", calls[0].c_str());
+    TEST_ASSERT_EQUAL_STRING("second homeassistant/status", calls[1].c_str());
+}
+
+static void test_payload_is_passed_through()
+{
+    MQTTDispatcher dispatcher;
+    const uint8_t payload[] = {'4', '2'};
+    const uint8_t* seen = nullptr;
+    size_t seenLength = 0;
+    dispatcher.registerHandler("aura/+/backlight/set", [&](std::string_view, const uint8_t* data, size_t length)
+    {
+        seen = data;
+        seenLength = length;
+    });
+
+    TEST_ASSERT_EQUAL(1, dispatcher.dispatch("aura/kitchen/backlight/set", payload, sizeof(payload)));
+    TEST_ASSERT_TRUE(seen == payload);
+    TEST_ASSERT_EQUAL(2, (int)seenLength);
+}
+
+// The dispatcher this one replaced: every pattern split and compared on each message
+class LinearDispatcher
+{
+public:
+    using Handler = std::function<void(const std::string&, const std::string&)>;
+
+    void registerHandler(const std::string& topicPattern, const Handler handler)
+    {
+        handlers.push_back({split(topicPattern), handler});
+    }
+
+    void dispatch(const std::string& topic, const std::string& payload) const
+    {
+        auto topicLevels = split(topic);
+        for (const auto& [patternLevels, handler] : handlers)
+        {
+            if (match(patternLevels, topicLevels))
+            {
+                handler(topic, payload);
+            }
+        }
+    }
+
+private:
+    std::vector<std::pair<std::vector<std::string>, Handler>> handlers;
+
+    static std::vector<std::string> split(const std::string& topic)
+    {
+        std::vector<std::string> result;
+        std::stringstream ss(topic);
+        std::string item;
+        while (std::getline(ss, item, '/'))
+        {
+            result.push_back(item);
+        }
+        return result;
+    }
+
+    static bool match(const std::vector<std::string>& pattern, const std::vector<std::string>& topic)
+    {
+        size_t i = 0;
+        for (; i < pattern.size(); ++i)
+        {
+            if (i >= topic.size())
+            {
+                return pattern[i] == "#";
+            }
+            if (pattern[i] == "#")
+            {
+                return true;
+            }
+            if (pattern[i] == "+")
+            {
+                continue;
+            }
+            if (pattern[i] != topic[i])
+            {
+                return false;
+            }
+        }
+        return i == topic.size();
+    }
+};
+
+// The firmware's own table, fed the topics a busy broker sends it
+static const char* const BenchPatterns[] = {
+    "aura/kitchen/backlight/set",
+    "aura/kitchen/loglevel/set",
+    "homeassistant/status",
+    "aura/fleet/weather/+/lease",
+    "aura/fleet/weather/+/forecast",
+};
+
+static const char* const BenchTopics[] = {
+    "aura/kitchen/backlight/set",
+    "aura/fleet/weather/51.50,-0.12/forecast",
+    "homeassistant/status",
+    "aura/fleet/weather/51.50,-0.12/lease",
+};
+
+static const int BenchRounds = 200000;
+
+template <typename Dispatch>
+static double nanosecondsPerMessage(Dispatch dispatch)
+{
+    const int topicCount = sizeof(BenchTopics) / sizeof(BenchTopics[0]);
+    auto start = std::chrono::steady_clock::now();
+    for (int i = 0; i < BenchRounds; i++)
+    {
+        dispatch(BenchTopics[i % topicCount]);
+    }
+    std::chrono::duration<double, std::nano> elapsed = std::chrono::steady_clock::now() - start;
+    return elapsed.count() / BenchRounds;
+}
+
+static void test_benchmark_against_linear_dispatcher()
+{
+    int trieCalls = 0;
+    int linearCalls = 0;
+    MQTTDispatcher trie;
+    LinearDispatcher linear;
+    for (const char* pattern : BenchPatterns)
+    {
+        trie.registerHandler(pattern, [&](std::string_view, const uint8_t*, size_t) { trieCalls++; });
+        linear.registerHandler(pattern, [&](const std::string&, const std::string&) { linearCalls++; });
+    }
+
+    static const uint8_t payload[64] = {};
+    double trieNs = nanosecondsPerMessage([&](const char* topic) { trie.dispatch(topic, payload, sizeof(payload)); });
+    double linearNs = nanosecondsPerMessage([&](const char* topic)
+    {
+        linear.dispatch(topic, std::string((const char*)payload, sizeof(payload)));
+    });
+
+    char line[96];
+    snprintf(line, sizeof(line), "dispatch: trie %.1f ns, linear %.1f ns per message", trieNs, linearNs);
+    TEST_MESSAGE(line);
+
+    TEST_ASSERT_EQUAL(BenchRounds, trieCalls);
+    TEST_ASSERT_EQUAL(BenchRounds, linearCalls);
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_exact_topic);
+    RUN_TEST(test_plus_matches_one_level);
+    RUN_TEST(test_hash_matches_the_rest);
+    RUN_TEST(test_hash_matches_its_parent);
+    RUN_TEST(test_system_topics_need_their_own_pattern);
+    RUN_TEST(test_every_match_fires_once);
+    RUN_TEST(test_payload_is_passed_through);
+    RUN_TEST(test_benchmark_against_linear_dispatcher);
+    return UNITY_END();
+}
@@ -0,0 +1,322 @@
+#include <unity.h>
+#include <arpa/inet.h>
+#include <poll.h>
+#include <string>
+#include <vector>
+#include "NatsClient.h"
+
+// Plays the server over loopback, so the parser sees real reads, split wherever the test
+// chooses to split them
+class FakeServer
+{
+public:
+    bool start()
+    {
+        received.clear();
+        listener = socket(AF_INET, SOCK_STREAM, 0);
+        sockaddr_in address = {};
+        address.sin_family = AF_INET;
+        address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+        socklen_t length = sizeof(address);
+        if (listener < 0 || bind(listener, (sockaddr *)&address, length) != 0 || listen(listener, 1) != 0 ||
+            getsockname(listener, (sockaddr *)&address, &length) != 0)
+            return false;
+        port = ntohs(address.sin_port);
+        return true;
+    }
+
+    bool accept()
+    {
+        connection = ::accept(listener, nullptr, nullptr);
+        int noDelay = 1;
+        setsockopt(connection, IPPROTO_TCP, TCP_NODELAY, &noDelay, sizeof(noDelay));
+        return connection >= 0;
+    }
+
+    void send(const std::string &data)
+    {
+        ::send(connection, data.data(), data.size(), MSG_NOSIGNAL);
+    }
+
+    // Everything the client has sent, once needle is among it or a second has passed
+    std::string readUntil(const char *needle)
+    {
+        for (int waits = 0; waits < 100 && received.find(needle) == std::string::npos; waits++)
+        {
+            pollfd ready = {connection, POLLIN, 0};
+            if (poll(&ready, 1, 10) <= 0)
+                continue;
+
+            char buffer[512];
+            ssize_t length = recv(connection, buffer, sizeof(buffer), 0);
+            if (length <= 0)
+                break;
+            received.append(buffer, length);
+        }
+        return received;
+    }
+
+    void forget() { received.clear(); }
+
+    void hangUp()
+    {
+        close(connection);
+        connection = -1;
+    }
+
+    void stop()
+    {
+        if (connection >= 0)
+            close(connection);
+        if (listener >= 0)
+            close(listener);
+        connection = listener = -1;
+    }
+
+    uint16_t port = 0;
+
+private:
+    int listener = -1;
+    int connection = -1;
+    std::string received;
+};
+
+struct message_t
+{
+    std::string subject;
+    std::string replyTo;
+    std::string payload;
+    bool hasReply;
+};
+
+static FakeServer server;
+static std::vector<message_t> messages;
+static uint32_t nowMs;
+
+static void collect(const char *subject, const char *replyTo, const uint8_t *payload, size_t length, void *)
+{
+    messages.push_back({subject, replyTo ? replyTo : "", std::string((const char *)payload, length), replyTo != nullptr});
+}
+
+// Gives loopback a moment to deliver, then lets the client read it
+static void pump(NatsClient &client)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        usleep(1000);
+        client.loop(++nowMs);
+    }
+}
+
+static void feed(NatsClient &client, const std::string &data)
+{
+    server.send(data);
+    pump(client);
+}
+
+static const char *const Info = "INFO {\"server_id\":\"test\",\"version\":\"2.10.0\",\"max_payload\":1048576}\r\n";
+
+static void handshake(NatsClient &client, const std::string &info = Info)
+{
+    client.setServer("127.0.0.1", server.port);
+    client.setCredentials("", "", "aura-test");
+    client.setMessageHandler(collect, nullptr);
+    client.connect();
+    client.loop(++nowMs);
+    TEST_ASSERT_TRUE(server.accept());
+    pump(client);
+    TEST_ASSERT_EQUAL(NatsClient::Handshaking, client.getState());
+
+    feed(client, info);
+    std::string sent = server.readUntil("PING\r\n");
+    TEST_ASSERT_TRUE(sent.find("CONNECT {") == 0);
+    TEST_ASSERT_TRUE(sent.find("\"name\":\"aura-test\"") != std::string::npos);
+    server.forget();
+
+    feed(client, "PONG\r\n");
+    TEST_ASSERT_EQUAL(NatsClient::Connected, client.getState());
+}
+
+void setUp()
+{
+    messages.clear();
+    nowMs = 1000;
+    TEST_ASSERT_TRUE(server.start());
+}
+
+void tearDown()
+{
+    server.stop();
+}
+
+static void test_handshake_renews_subscriptions()
+{
+    NatsClient client;
+    TEST_ASSERT_EQUAL(1, client.subscribe("aura.kitchen.>"));
+    TEST_ASSERT_EQUAL(2, client.subscribe("aura.all", "displays"));
+    client.setServer("127.0.0.1", server.port);
+    client.setCredentials("user", "p\"ss", "aura-test");
+    client.connect();
+    client.loop(++nowMs);
+    TEST_ASSERT_TRUE(server.accept());
+    pump(client);
+
+    feed(client, Info);
+    std::string sent = server.readUntil("PING\r\n");
+    TEST_ASSERT_TRUE(sent.find("\"user\":\"user\",\"pass\":\"p\\\"ss\"") != std::string::npos);
+    TEST_ASSERT_TRUE(sent.find("SUB aura.kitchen.> 1\r\nSUB aura.all displays 2\r\nPING\r\n") != std::string::npos);
+    TEST_ASSERT_EQUAL(NatsClient::Handshaking, client.getState());
+
+    feed(client, "PONG\r\n");
+    TEST_ASSERT_EQUAL(NatsClient::Connected, client.getState());
+    TEST_ASSERT_EQUAL_UINT32(1, client.connects());
+}
+
+static void test_info_split_across_reads()
+{
+    NatsClient client;
+    client.setServer("127.0.0.1", server.port);
+    client.connect();
+    client.loop(++nowMs);
+    TEST_ASSERT_TRUE(server.accept());
+    pump(client);
+
+    std::string info = Info;
+    for (char c : info)
+    {
+        server.send(std::string(1, c));
+        client.loop(++nowMs);
+    }
+    pump(client);
+    TEST_ASSERT_TRUE(server.readUntil("PING\r\n").find("CONNECT {") == 0);
+}
+
+static void test_ping_is_answered()
+{
+    NatsClient client;
+    handshake(client);
+
+    feed(client, "PI");
+    feed(client, "NG\r\n");
+    TEST_ASSERT_EQUAL_STRING("PONG\r\n", server.readUntil("PONG\r\n").c_str());
+}
+
+static void test_messages_with_and_without_reply()
+{
+    NatsClient client;
+    handshake(client);
+
+    feed(client, "MSG aura.kitchen.backlight 1 5\r\nhello\r\nMSG aura.rpc 2 _INBOX.abc 4\r\na\r\nb\r\n");
+    TEST_ASSERT_EQUAL(2, (int)messages.size());
+    TEST_ASSERT_EQUAL_STRING("aura.kitchen.backlight", messages[0].subject.c_str());
+    TEST_ASSERT_FALSE(messages[0].hasReply);
+    TEST_ASSERT_EQUAL_STRING("hello", messages[0].payload.c_str());
+    TEST_ASSERT_EQUAL_STRING("aura.rpc", messages[1].subject.c_str());
+    TEST_ASSERT_EQUAL_STRING("_INBOX.abc", messages[1].replyTo.c_str());
+
+    // The payload may hold CR LF; only the byte count delimits it
+    TEST_ASSERT_EQUAL_STRING("a\r\nb", messages[1].payload.c_str());
+    TEST_ASSERT_EQUAL_UINT32(2, client.received());
+}
+
+static void test_message_split_at_every_byte()
+{
+    NatsClient client;
+    handshake(client);
+
+    const std::string frame = "MSG aura.weather 3 _INBOX.x 11\r\n{\"t\":18.5}\n\r\nPING\r\n";
+    for (size_t cut = 1; cut < frame.size(); cut++)
+    {
+        messages.clear();
+        server.forget();
+        feed(client, frame.substr(0, cut));
+        feed(client, frame.substr(cut));
+
+        TEST_ASSERT_EQUAL(1, (int)messages.size());
+        TEST_ASSERT_EQUAL_STRING("aura.weather", messages[0].subject.c_str());
+        TEST_ASSERT_EQUAL_STRING("_INBOX.x", messages[0].replyTo.c_str());
+        TEST_ASSERT_EQUAL_STRING("{\"t\":18.5}\n", messages[0].payload.c_str());
+        TEST_ASSERT_EQUAL_STRING("PONG\r\n", server.readUntil("PONG\r\n").c_str());
+    }
+}
+
+static void test_oversized_message_is_skipped()
+{
+    NatsClient client(4096, 128);
+    handshake(client);
+
+    std::string big(300, 'x');
+    feed(client, "MSG aura.big 1 300\r\n" + big.substr(0, 50));
+    feed(client, big.substr(50, 200));
+    feed(client, big.substr(250) + "\r\nMSG aura.small 1 2\r\nok\r\n");
+
+    TEST_ASSERT_EQUAL(1, (int)messages.size());
+    TEST_ASSERT_EQUAL_STRING("aura.small", messages[0].subject.c_str());
+    TEST_ASSERT_EQUAL_UINT32(1, client.skipped());
+    TEST_ASSERT_EQUAL(NatsClient::Connected, client.getState());
+}
+
+static void test_error_while_connected_is_recorded()
+{
+    NatsClient client;
+    handshake(client);
+
+    feed(client, "-ERR 'Permissions Violation for Publish to \"x\"'\r\n");
+    TEST_ASSERT_EQUAL_STRING("'Permissions Violation for Publish to \"x\"'", client.lastError());
+    TEST_ASSERT_EQUAL(NatsClient::Connected, client.getState());
+}
+
+static void test_error_during_handshake_fails_the_attempt()
+{
+    NatsClient client;
+    client.setServer("127.0.0.1", server.port);
+    client.connect();
+    client.loop(++nowMs);
+    TEST_ASSERT_TRUE(server.accept());
+    pump(client);
+
+    feed(client, Info);
+    feed(client, "-ERR 'Authorization Violation'\r\n");
+    TEST_ASSERT_EQUAL(NatsClient::Waiting, client.getState());
+    TEST_ASSERT_EQUAL_STRING("'Authorization Violation'", client.lastError());
+}
+
+static void test_info_limits_publishes()
+{
+    NatsClient client;
+    handshake(client, "INFO {\"max_payload\":16}\r\n");
+
+    uint8_t payload[17] = {};
+    TEST_ASSERT_TRUE(client.publish("aura.t", payload, 16));
+    TEST_ASSERT_FALSE(client.publish("aura.t", payload, 17));
+    client.flush();
+    std::string sent = server.readUntil("\r\n\r\n");
+    TEST_ASSERT_TRUE(sent.find("PUB aura.t 16\r\n") == 0);
+}
+
+static void test_hang_up_waits_to_reconnect()
+{
+    NatsClient client;
+    handshake(client);
+
+    server.hangUp();
+    pump(client);
+    TEST_ASSERT_EQUAL(NatsClient::Waiting, client.getState());
+    TEST_ASSERT_EQUAL_STRING("connection closed", client.lastError());
+}
+
+int main()
+{
+    UNITY_BEGIN();
+    RUN_TEST(test_handshake_renews_subscriptions);
+    RUN_TEST(test_info_split_across_reads);
+    RUN_TEST(test_ping_is_answered);
+    RUN_TEST(test_messages_with_and_without_reply);
+    RUN_TEST(test_message_split_at_every_byte);
+    RUN_TEST(test_oversized_message_is_skipped);
+    RUN_TEST(test_error_while_connected_is_recorded);
+    RUN_TEST(test_error_during_handshake_fails_the_attempt);
+    RUN_TEST(test_info_limits_publishes);
+    RUN_TEST(test_hang_up_waits_to_reconnect);
+    return UNITY_END();
+}
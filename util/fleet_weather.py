@@ -0,0 +1,313 @@
+# Watches and exercises fleet forecast sharing against an MQTT broker such as a local
+# Mosquitto. Devices at one location share aura/fleet/weather/<lat>,<lon>/: "lease" holds
+# "<holder> <expires unix time>" and "forecast" the binary forecast from include/FleetForecast.h,
+# both retained.
+#
+#   python util/fleet_weather.py watch --server localhost
+#   python util/fleet_weather.py simulate --devices 3 --lease 30 --interval 10 --stop-holder-after 45
+#
+# "simulate" runs devices that follow the firmware's rules with a synthetic forecast, so
+# election and failover can be watched without hardware; stopping the holder shows another
+# device taking over once its lease runs out. Only the standard library is needed.
+
+import argparse
+import os
+import socket
+import struct
+import sys
+import threading
+import time
+from urllib.parse import urlparse
+
+TOPIC_PREFIX = 'aura/fleet/weather/'
+WIRE_VERSION = 1
+DAYS = 7
+HOURS = 7
+
+
+class MqttConnection:
+    """Just enough MQTT 3.1.1 for QoS 0 publishes and subscriptions."""
+
+    def __init__(self, url, client_id, user=None, password=None, keepalive=60):
+        parsed = urlparse(url if '://' in url else 'mqtt://' + url)
+        self.sock = socket.create_connection((parsed.hostname or 'localhost', parsed.port or 1883), timeout=5)
+        self.lock = threading.Lock()
+        self.keepalive = keepalive
+        self.last_sent = time.monotonic()
+
+        user = user or parsed.username
+        password = password or parsed.password
+        flags = 0x02
+        payload = self.string(client_id)
+        if user:
+            flags |= 0x80
+            payload += self.string(user)
+            if password:
+                flags |= 0x40
+                payload += self.string(password)
+        variable = self.string('MQTT') + bytes([4, flags]) + struct.pack('>H', keepalive)
+        self.send_packet(0x10, variable + payload)
+
+        packet_type, body = self.read_packet()
+        if packet_type != 0x20 or len(body) < 2 or body[1] != 0:
+            raise RuntimeError('connection refused (%r)' % body)
+
+    @staticmethod
+    def string(text):
+        data = text.encode() if isinstance(text, str) else text
+        return struct.pack('>H', len(data)) + data
+
+    def send_packet(self, header, body):
+        length = len(body)
+        encoded = bytearray()
+        while True:
+            byte = length % 128
+            length //= 128
+            encoded.append(byte | (0x80 if length else 0))
+            if not length:
+                break
+        with self.lock:
+            self.sock.sendall(bytes([header]) + bytes(encoded) + body)
+            self.last_sent = time.monotonic()
+
+    def read_exact(self, count):
+        data = b''
+        while len(data) < count:
+            chunk = self.sock.recv(count - len(data))
+            if not chunk:
+                raise ConnectionError('broker closed the connection')
+            data += chunk
+        return data
+
+    def read_packet(self):
+        header = self.read_exact(1)[0]
+        length, shift = 0, 0
+        while True:
+            byte = self.read_exact(1)[0]
+            length |= (byte & 0x7f) << shift
+            shift += 7
+            if not byte & 0x80:
+                break
+        return header & 0xf0, self.read_exact(length) if length else b''
+
+    def subscribe(self, *topics):
+        body = struct.pack('>H', 1) + b''.join(self.string(topic) + b'\x00' for topic in topics)
+        self.send_packet(0x82, body)
+
+    def publish(self, topic, payload, retain=False):
+        self.send_packet(0x30 | (0x01 if retain else 0), self.string(topic) + payload)
+
+    def poll(self, timeout):
+        """Returns (topic, payload) for the next message, or None when the timeout passes."""
+        if time.monotonic() - self.last_sent > self.keepalive / 2:
+            self.send_packet(0xc0, b'')
+        self.sock.settimeout(timeout)
+        try:
+            packet_type, body = self.read_packet()
+        except socket.timeout:
+            return None
+        if packet_type != 0x30:
+            return None
+        topic_length = struct.unpack('>H', body[:2])[0]
+        return body[2:2 + topic_length].decode(errors='replace'), body[2 + topic_length:]
+
+    def close(self):
+        self.sock.close()
+
+
+def decode_forecast(payload):
+    """The inverse of encodeForecast() in include/FleetForecast.h."""
+    if not payload or payload[0] != WIRE_VERSION:
+        raise ValueError('unknown forecast version')
+    publisher_length = payload[1]
+    publisher = payload[2:2 + publisher_length].decode(errors='replace')
+    offset = 2 + publisher_length
+    fetched_at, temperature, feels_like, code, is_day, days = struct.unpack_from('<IhhBBB', payload, offset)
+    offset += 11
+    forecast = {'publisher': publisher, 'fetchedAt': fetched_at, 'temperature': temperature / 10,
+                'feelsLike': feels_like / 10, 'code': code, 'isDay': is_day, 'days': [], 'hours': []}
+    for _ in range(days):
+        year, month, day, minimum, maximum, day_code = struct.unpack_from('<HBBhhB', payload, offset)
+        offset += 9
+        forecast['days'].append(['%04d-%02d-%02d' % (year, month, day), minimum / 10, maximum / 10, day_code])
+    hours = payload[offset]
+    offset += 1
+    for _ in range(hours):
+        hour, hour_temperature, precipitation, hour_code, hour_is_day = struct.unpack_from('<BhBBB', payload, offset)
+        offset += 6
+        forecast['hours'].append([hour, hour_temperature / 10, precipitation, hour_code, hour_is_day])
+    return forecast
+
+
+def encode_forecast(forecast, publisher):
+    publisher = publisher.encode()[:32]
+    data = bytes([WIRE_VERSION, len(publisher)]) + publisher
+    data += struct.pack('<IhhBBB', forecast['fetchedAt'], round(forecast['temperature'] * 10),
+                        round(forecast['feelsLike'] * 10), forecast['code'], forecast['isDay'], DAYS)
+    for date, minimum, maximum, code in forecast['days']:
+        year, month, day = (int(part) for part in date.split('-'))
+        data += struct.pack('<HBBhhB', year, month, day, round(minimum * 10), round(maximum * 10), code)
+    data += bytes([HOURS])
+    for hour, temperature, precipitation, code, is_day in forecast['hours']:
+        data += struct.pack('<BhBBB', hour, round(temperature * 10), precipitation, code, is_day)
+    return data
+
+
+def synthetic_forecast():
+    now = time.time()
+    today = time.localtime(now)
+    return {
+        'fetchedAt': int(now), 'temperature': 18.5, 'feelsLike': 17.0, 'code': 2, 'isDay': 1,
+        'days': [[time.strftime('%Y-%m-%d', time.localtime(now + day * 86400)), 10 + day / 2, 20 + day / 2, 3]
+                 for day in range(DAYS)],
+        'hours': [[(today.tm_hour + hour) % 24, 18 + hour / 2, 10 * hour, 1, 1] for hour in range(HOURS)],
+    }
+
+
+def location_key(latitude, longitude):
+    return '%.2f,%.2f' % (latitude, longitude)
+
+
+def watch(args):
+    connection = MqttConnection(args.server, 'fleet-watch-%s' % os.urandom(3).hex(), args.user, args.password)
+    connection.subscribe(TOPIC_PREFIX + '+/lease', TOPIC_PREFIX + '+/forecast')
+    while True:
+        message = connection.poll(1.0)
+        if message is None:
+            continue
+        topic, payload = message
+        stamp = time.strftime('%H:%M:%S')
+        if topic.endswith('/lease'):
+            text = payload.decode(errors='replace')
+            if text:
+                holder, _, expires = text.partition(' ')
+                print('%s %s: held by %s for %d s more' % (stamp, topic, holder, int(expires) - int(time.time())))
+            else:
+                print('%s %s: cleared' % (stamp, topic))
+        elif topic.endswith('/forecast'):
+            try:
+                forecast = decode_forecast(payload)
+            except (ValueError, struct.error) as error:
+                print('%s %s: unreadable (%s)' % (stamp, topic, error))
+                continue
+            print('%s %s: from %s, fetched %d s ago, %.1f°C (feels %.1f°C), code %d, %d bytes' % (
+                stamp, topic, forecast['publisher'], int(time.time()) - forecast['fetchedAt'], forecast['temperature'],
+                forecast['feelsLike'], forecast['code'], len(payload)))
+
+
+class SimulatedDevice(threading.Thread):
+    """Follows the firmware: fetch when holding the lease or when nobody validly does."""
+
+    def __init__(self, name, args):
+        super().__init__(daemon=True)
+        self.name = name
+        self.args = args
+        self.key = location_key(args.latitude, args.longitude)
+        self.holder = None
+        self.expires = 0
+        self.claim_at = None
+        self.stopped = threading.Event()
+
+    def log(self, text):
+        print('%s %-6s %s' % (time.strftime('%H:%M:%S'), self.name, text), flush=True)
+
+    def run(self):
+        connection = MqttConnection(self.args.server, self.name, self.args.user, self.args.password)
+        lease_topic = TOPIC_PREFIX + self.key + '/lease'
+        forecast_topic = TOPIC_PREFIX + self.key + '/forecast'
+        connection.subscribe(lease_topic, forecast_topic)
+
+        # Each device's weather job has its own phase
+        next_update = time.monotonic() + self.args.interval * (0.2 + 0.8 * os.urandom(1)[0] / 255)
+        while not self.stopped.is_set():
+            due = next_update if self.claim_at is None else min(next_update, self.claim_at)
+            message = connection.poll(max(0.05, min(1.0, due - time.monotonic())))
+            if message is not None:
+                topic, payload = message
+                if topic == lease_topic:
+                    holder, _, expires = payload.decode(errors='replace').partition(' ')
+                    self.holder, self.expires = (holder, int(expires)) if holder else (None, 0)
+                elif topic == forecast_topic:
+                    forecast = decode_forecast(payload)
+                    if forecast['publisher'] != self.name:
+                        self.log('renders the forecast from %s' % forecast['publisher'])
+
+            claim_due = self.claim_at is not None and time.monotonic() >= self.claim_at
+            if time.monotonic() < next_update and not claim_due:
+                continue
+            if not claim_due:
+                next_update += self.args.interval
+
+            now = int(time.time())
+            valid = self.holder is not None and self.expires > now
+            if valid and self.holder != self.name:
+                self.claim_at = None
+                self.log('leaves the fetch to %s (%d s left)' % (self.holder, self.expires - now))
+                continue
+            if not valid:
+                # As fleetShouldFetch(): wait a random share of the jitter, then claim if
+                # nobody has meanwhile
+                if not claim_due:
+                    if self.claim_at is None:
+                        delay = self.args.jitter * os.urandom(2)[0] / 255
+                        self.claim_at = time.monotonic() + delay
+                        self.log('finds no lease, claims in %.1f s unless another device does' % delay)
+                    continue
+                self.claim_at = None
+                self.log('claims the lease')
+            self.holder, self.expires = self.name, now + self.args.lease
+            lease = ('%s %d' % (self.name, self.expires)).encode()
+            connection.publish(lease_topic, lease, retain=True)
+            connection.publish(forecast_topic, encode_forecast(synthetic_forecast(), self.name), retain=True)
+            self.log('fetched and shared the forecast')
+
+        connection.close()
+        self.log('stopped')
+
+
+def simulate(args):
+    devices = [SimulatedDevice('sim-%d' % number, args) for number in range(1, args.devices + 1)]
+    for device in devices:
+        device.start()
+
+    started = time.monotonic()
+    stopped_holder = False
+    try:
+        while any(device.is_alive() for device in devices):
+            time.sleep(0.5)
+            if args.stop_holder_after and not stopped_holder and time.monotonic() - started >= args.stop_holder_after:
+                holders = [device for device in devices if device.holder == device.name and device.is_alive()]
+                if holders:
+                    print('--- stopping %s; another device should take over within %d s' % (
+                        holders[0].name, args.lease + args.interval), flush=True)
+                    holders[0].stopped.set()
+                    stopped_holder = True
+    except KeyboardInterrupt:
+        pass
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Watch or simulate Aura2 fleet forecast sharing over MQTT.')
+    parser.add_argument('--server', default=os.environ.get('MQTT_URL', 'mqtt://localhost:1883'))
+    parser.add_argument('--user', default=os.environ.get('MQTT_USER'))
+    parser.add_argument('--password', default=os.environ.get('MQTT_PASSWORD'))
+    commands = parser.add_subparsers(dest='command', required=True)
+
+    commands.add_parser('watch', help='print leases and forecasts as they are published')
+
+    simulation = commands.add_parser('simulate', help='run simulated devices at one location')
+    simulation.add_argument('--devices', type=int, default=3)
+    simulation.add_argument('--latitude', type=float, default=47.61)
+    simulation.add_argument('--longitude', type=float, default=-122.33)
+    simulation.add_argument('--interval', type=float, default=10, help='seconds between weather updates')
+    simulation.add_argument('--lease', type=int, default=30, help='lease length in seconds')
+    simulation.add_argument('--jitter', type=float, default=5, help='longest wait before claiming a free lease')
+    simulation.add_argument('--stop-holder-after', type=float, default=0, help='stop the fetcher after this many seconds')
+
+    args = parser.parse_args()
+    return watch(args) if args.command == 'watch' else simulate(args)
+
+
+if __name__ == '__main__':
+    sys.exit(main())
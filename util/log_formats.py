@@ -0,0 +1,65 @@
+# Generates util/log_formats.json, the table host tools use to turn the format IDs in
+# binary log records back into format strings. Runs before every PlatformIO build
+# (extra_scripts in platformio.ini) and can also be run by hand:
+#
+#   python util/log_formats.py
+#
+# IDs are the FNV-1a hash of the format string, matching logFormatId() in LogBinary.h.
+
+import json
+import os
+import re
+import sys
+
+# LOG_INFO(LOG_WEATHER, "format", ...) and LOG_AT(LOG_WEATHER, LOG_LEVEL_INFO, "format", ...)
+CALL = re.compile(r'\bLOG_(?:FATAL|ERROR|WARNING|INFO|TRACE|VERBOSE|AT)\s*\(\s*\w+\s*,\s*(?:[\w()]+\s*,\s*)?((?:"(?:[^"\\]|\\.)*"\s*)+)')
+LITERAL = re.compile(r'"((?:[^"\\]|\\.)*)"')
+ESCAPES = {'n': '\n', 't': '\t', 'r': '\r', '\\': '\\', '"': '"', "'": "'", '0': '\0'}
+
+
+def unescape(text):
+    return re.sub(r'\\(.)', lambda match: ESCAPES.get(match.group(1), match.group(1)), text)
+
+
+def format_id(text):
+    value = 2166136261
+    for byte in text.encode('utf-8'):
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def collect(source_dir):
+    formats = {}
+    for root, _, files in os.walk(source_dir):
+        for name in sorted(files):
+            if not name.endswith(('.cpp', '.c', '.h')):
+                continue
+
+            path = os.path.join(root, name)
+            with open(path, encoding='utf-8', errors='replace') as source:
+                text = source.read()
+
+            for call in CALL.finditer(text):
+                fmt = ''.join(unescape(part) for part in LITERAL.findall(call.group(1)))
+                key = '%08x' % format_id(fmt)
+                if key in formats and formats[key] != fmt:
+                    sys.exit('log_formats: ID %s is shared by "%s" and "%s"' % (key, formats[key], fmt))
+                formats[key] = fmt
+
+    return formats
+
+
+def generate(project_dir):
+    formats = collect(os.path.join(project_dir, 'src'))
+    output = os.path.join(project_dir, 'util', 'log_formats.json')
+    with open(output, 'w', encoding='utf-8') as table:
+        json.dump(formats, table, indent=2, sort_keys=True)
+        table.write('\n')
+    print('log_formats: %d formats written to %s' % (len(formats), output))
+
+
+if 'Import' in globals():
+    Import('env')
+    generate(env['PROJECT_DIR'])
+elif __name__ == '__main__':
+    generate(os.path.dirname(os.path.dirname(os.path.abspath(__file__))))
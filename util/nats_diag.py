@@ -0,0 +1,157 @@
+# Sweeps the fleet for diagnostics snapshots over NATS request/reply. Every device
+# answers on "aura2.diag", and on "aura2.diag.<device>" for itself; replies are collected
+# until the timeout and printed as a summary table, or as raw JSON lines with --json.
+#
+#   python util/nats_diag.py --server nats://picollect.local:4222 --user aura --password secret
+#   python util/nats_diag.py --device aura2-1a2b tasks stalls
+#
+# Sections: heap, tasks, jobs, wifi, stalls, nats, links, log; none asks for all of them. Only
+# the standard library is needed, so it runs anywhere Python does, including against a
+# local nats-server.
+
+import argparse
+import json
+import os
+import socket
+import sys
+import time
+from urllib.parse import urlparse
+
+
+class NatsConnection:
+    """Just enough of the NATS text protocol to publish a request and collect replies."""
+
+    def __init__(self, url, user=None, password=None):
+        parsed = urlparse(url if '://' in url else 'nats://' + url)
+        self.sock = socket.create_connection((parsed.hostname or 'localhost', parsed.port or 4222), timeout=5)
+        self.buffer = b''
+
+        info = self.read_line()
+        if not info.startswith(b'INFO '):
+            raise RuntimeError('not a NATS server: %r' % info[:40])
+
+        options = {'verbose': False, 'pedantic': False, 'lang': 'python', 'version': '1.0', 'protocol': 1,
+                   'name': 'aura2-diag'}
+        user = user or parsed.username
+        password = password or parsed.password
+        if user:
+            options['user'] = user
+            options['pass'] = password or ''
+        self.send('CONNECT %s\r\nPING\r\n' % json.dumps(options))
+
+        while True:
+            line = self.read_line()
+            if line == b'PONG':
+                break
+            if line.startswith(b'-ERR'):
+                raise RuntimeError(line.decode(errors='replace'))
+
+    def send(self, text, payload=b''):
+        self.sock.sendall(text.encode() + payload)
+
+    def read_line(self):
+        while b'\r\n' not in self.buffer:
+            data = self.sock.recv(65536)
+            if not data:
+                raise ConnectionError('server closed the connection')
+            self.buffer += data
+        line, self.buffer = self.buffer.split(b'\r\n', 1)
+        return line
+
+    def read_bytes(self, count):
+        while len(self.buffer) < count + 2:
+            data = self.sock.recv(65536)
+            if not data:
+                raise ConnectionError('server closed the connection')
+            self.buffer += data
+        payload, self.buffer = self.buffer[:count], self.buffer[count + 2:]
+        return payload
+
+    def request_all(self, subject, payload, timeout):
+        """Publishes one request and yields every reply that arrives before the timeout."""
+        inbox = '_INBOX.aura2diag.%s' % os.urandom(6).hex()
+        self.send('SUB %s 1\r\n' % inbox)
+        self.send('PUB %s %s %d\r\n' % (subject, inbox, len(payload)), payload + b'\r\n')
+
+        deadline = time.monotonic() + timeout
+        while True:
+            remaining = deadline - time.monotonic()
+            if remaining <= 0:
+                return
+            self.sock.settimeout(remaining)
+            try:
+                line = self.read_line()
+            except socket.timeout:
+                return
+
+            if line == b'PING':
+                self.send('PONG\r\n')
+            elif line.startswith(b'MSG '):
+                fields = line.split()
+                yield self.read_bytes(int(fields[-1]))
+            elif line.startswith(b'-ERR'):
+                raise RuntimeError(line.decode(errors='replace'))
+
+
+def summarize(snapshot):
+    heap = snapshot.get('heap', {})
+    wifi = snapshot.get('wifi', {})
+    stalls = snapshot.get('stalls', {})
+    tasks = snapshot.get('tasks', [])
+    jobs = snapshot.get('jobs', [])
+
+    tightest = min(tasks, key=lambda task: task[2]) if tasks else None
+    missed = sum(job[2] for job in jobs)
+    return [
+        snapshot.get('id', '?'),
+        '%dh%02dm' % (snapshot.get('uptime', 0) // 3600, snapshot.get('uptime', 0) // 60 % 60),
+        str(heap.get('free', '')),
+        str(heap.get('largest', '')),
+        '%s %d' % (tightest[0], tightest[2]) if tightest else '',
+        str(missed) if jobs else '',
+        str(wifi.get('rssi', '')),
+        str(stalls.get('count', '')),
+        snapshot.get('error', ''),
+    ]
+
+
+def main():
+    parser = argparse.ArgumentParser(description='Collect diagnostics snapshots from Aura2 devices over NATS.')
+    parser.add_argument('sections', nargs='*', help='heap, tasks, jobs, wifi, stalls, nats, links, log (default: all)')
+    parser.add_argument('--server', default=os.environ.get('NATS_URL', 'nats://localhost:4222'))
+    parser.add_argument('--user', default=os.environ.get('NATS_USER'))
+    parser.add_argument('--password', default=os.environ.get('NATS_PASSWORD'))
+    parser.add_argument('--device', help='query one device instead of the whole fleet')
+    parser.add_argument('--timeout', type=float, default=2.0, help='seconds to wait for replies')
+    parser.add_argument('--json', action='store_true', help='print each reply as a JSON line')
+    args = parser.parse_args()
+
+    subject = 'aura2.diag.' + args.device if args.device else 'aura2.diag'
+    connection = NatsConnection(args.server, args.user, args.password)
+
+    snapshots = []
+    for reply in connection.request_all(subject, ' '.join(args.sections).encode(), args.timeout):
+        try:
+            snapshot = json.loads(reply)
+        except ValueError:
+            print('unreadable reply: %r' % reply[:80], file=sys.stderr)
+            continue
+
+        if args.json:
+            print(json.dumps(snapshot, separators=(',', ':')))
+        snapshots.append(snapshot)
+
+    if args.json:
+        return 0 if snapshots else 1
+
+    header = ['device', 'up', 'free', 'largest', 'tightest stack', 'missed', 'rssi', 'stalls', 'error']
+    rows = [summarize(snapshot) for snapshot in sorted(snapshots, key=lambda snapshot: snapshot.get('id', ''))]
+    widths = [max(len(row[column]) for row in [header] + rows) for column in range(len(header))]
+    for row in [header] + rows:
+        print('  '.join(cell.ljust(width) for cell, width in zip(row, widths)).rstrip())
+    print('%d device(s) answered within %.1f s' % (len(snapshots), args.timeout))
+    return 0 if snapshots else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())